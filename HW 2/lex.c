@@ -6,12 +6,18 @@
  * Description: Reads a PL/0 source file, tokenizes the input, and outputs a lexeme table and token list
  */
 
+#define _DEFAULT_SOURCE // mmap
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#define MAX_LEXEMES 10000
 #define MAX_ID_LENGTH 11 
 #define MAX_NUM_LENGTH 5   
 #define MAX_LEXEME_LENGTH 64
@@ -24,103 +30,212 @@ typedef enum
     procsym,writesym,readsym, elsesym
 } tokenType;
 
-// Data type for reserved words
+// Data type for lexemes
 typedef struct
 {
-    char *name;
-    tokenType token;
-} ReservedWord; 
+    int token;  // Token type (0 = invalid lexeme, see LexError)
+    int offset; // Start of the lexeme in the source buffer
+    int length; // Length of the lexeme
+    int line;   // Line where the lexeme starts
+    int column; // Column where the lexeme starts
+} LexemeEntry;
 
-// List of reserved keywords
-ReservedWord reservedWords[] = 
+// Error message of an invalid lexeme
+typedef struct
 {
-    {"const", constsym}, {"var", varsym}, {"procedure", procsym}, {"call", callsym}, {"begin", beginsym}, {"end", endsym}, {"if", ifsym}, {"fi", fisym}, {"then", thensym}, {"else", elsesym}, {"while", whilesym}, {"do", dosym}, {"read", readsym}, {"write", writesym}
-};
-int numReservedWords = sizeof(reservedWords) / sizeof(ReservedWord);
+    int lexeme;                      // Index of the invalid lexeme
+    char message[MAX_LEXEME_LENGTH]; // Error message
+} LexError;
 
-// Data type for lexemes
-typedef struct
+// Source program (memory-mapped, or read into a buffer)
+const char *source = NULL;
+size_t sourceLength = 0;
+
+// Lexeme list (grows as needed)
+LexemeEntry *lexemes = NULL;
+int lexCount = 0, lexCapacity = 0;
+
+// Lexical errors, in lexeme order
+LexError *lexErrors = NULL;
+int errorCount = 0, errorCapacity = 0;
+
+// Helper function that prints a fatal error and ends the program
+void fatalError(const char *msg)
 {
-    char lexeme[MAX_LEXEME_LENGTH];
-    int token;
-    char errorMsg[MAX_LEXEME_LENGTH];
-    int isError;
-} LexemeEntry;
-LexemeEntry lexemes[MAX_LEXEMES];
-int lexCount = 0;
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
 
-// Function that finds the token type of the given lexeme
-tokenType getToken(char *lexeme)
+// Function that finds the token type of an identifier-like lexeme. Reserved words are matched by
+// length, then first character, then a single memcmp (no table scan).
+tokenType getToken(const char *text, int length)
 {
-    for (int i = 0; i < numReservedWords; i++)
+    switch (length)
     {
-        if (strcmp(lexeme, reservedWords[i].name) == 0)
-            return reservedWords[i].token;
+    case 2:
+        switch (text[0])
+        {
+        case 'i':
+            return memcmp(text, "if", 2) == 0 ? ifsym : identsym;
+        case 'f':
+            return memcmp(text, "fi", 2) == 0 ? fisym : identsym;
+        case 'd':
+            return memcmp(text, "do", 2) == 0 ? dosym : identsym;
+        }
+        break;
+    case 3:
+        switch (text[0])
+        {
+        case 'v':
+            return memcmp(text, "var", 3) == 0 ? varsym : identsym;
+        case 'e':
+            return memcmp(text, "end", 3) == 0 ? endsym : identsym;
+        }
+        break;
+    case 4:
+        switch (text[0])
+        {
+        case 't':
+            return memcmp(text, "then", 4) == 0 ? thensym : identsym;
+        case 'e':
+            return memcmp(text, "else", 4) == 0 ? elsesym : identsym;
+        case 'r':
+            return memcmp(text, "read", 4) == 0 ? readsym : identsym;
+        case 'c':
+            return memcmp(text, "call", 4) == 0 ? callsym : identsym;
+        }
+        break;
+    case 5:
+        switch (text[0])
+        {
+        case 'c':
+            return memcmp(text, "const", 5) == 0 ? constsym : identsym;
+        case 'b':
+            return memcmp(text, "begin", 5) == 0 ? beginsym : identsym;
+        case 'w':
+            if (memcmp(text, "while", 5) == 0)
+                return whilesym;
+            return memcmp(text, "write", 5) == 0 ? writesym : identsym;
+        }
+        break;
+    case 9:
+        return memcmp(text, "procedure", 9) == 0 ? procsym : identsym;
     }
     return identsym;
 }
 
-// Function that adds a lexeme (+ token type) to the lexeme table
-void addToken(int token, const char *lexeme)
+// Function that reads a whole source file into memory (memory-mapped when possible)
+int loadSource(const char *fileName)
 {
-    // Check for available space
-    if (lexCount < MAX_LEXEMES)
-    {
-        // Store the lexeme
-        strncpy(lexemes[lexCount].lexeme, lexeme, MAX_LEXEME_LENGTH - 1);
-        lexemes[lexCount].lexeme[MAX_LEXEME_LENGTH - 1] = '\0';
-        lexemes[lexCount].token = token; // Token type
-
-        // Indicate its a valid lexeme (no error flag/message)
-        lexemes[lexCount].errorMsg[0] = '\0';
-        lexemes[lexCount].isError = 0;
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+        return 0;
 
-        // Continue
-        lexCount++;
+    // Regular files are mapped in place
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        if (info.st_size > INT_MAX)
+        {
+            close(fd);
+            fatalError("Error: Source file too large.");
+        }
+        void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED)
+        {
+            close(fd);
+            source = mapped;
+            sourceLength = info.st_size;
+            return 1;
+        }
     }
-    else
+
+    // Anything else (pipes, empty files) is read in large blocks
+    char *buffer = NULL;
+    size_t capacity = 0, length = 0;
+    for (;;)
     {
-        fprintf(stderr, "Error: Lexeme buffer overflow.\n"); // Debugging - edge cases
-        exit(1);
+        if (length == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 65536;
+            if (capacity > INT_MAX || !(buffer = realloc(buffer, capacity)))
+            {
+                close(fd);
+                fatalError("Error: Source file too large.");
+            }
+        }
+        ssize_t count = read(fd, buffer + length, capacity - length);
+        if (count < 0)
+        {
+            free(buffer);
+            close(fd);
+            return 0;
+        }
+        if (count == 0)
+            break;
+        length += count;
     }
+    close(fd);
+    source = buffer;
+    sourceLength = length;
+    return 1;
 }
 
-// Function that adds an invalid lexeme and stores an error message for it
-void addErrorToken(const char *lexeme, const char *errMsg)
+// Function that adds a lexeme (+ token type) to the lexeme table. The lexeme stays in the source buffer.
+void addToken(int token, int offset, int length, int line, int column)
 {
-    // Check for available space
-    if (lexCount < MAX_LEXEMES)
+    // Grow the lexeme table as needed
+    if (lexCount == lexCapacity)
     {
-        // Store the invalid lexeme
-        strncpy(lexemes[lexCount].lexeme, lexeme, MAX_LEXEME_LENGTH - 1);
-        lexemes[lexCount].lexeme[MAX_LEXEME_LENGTH - 1] = '\0';
-        lexemes[lexCount].token = 0; // No valid token type
-
-        // Store error message
-        strncpy(lexemes[lexCount].errorMsg, errMsg, sizeof(lexemes[lexCount].errorMsg) - 1);
-        lexemes[lexCount].errorMsg[sizeof(lexemes[lexCount].errorMsg) - 1] = '\0';
-        lexemes[lexCount].isError = 1; // Invalid flag
-
-        // Continue
-        lexCount++;
+        lexCapacity = lexCapacity ? 2 * lexCapacity : 4096;
+        lexemes = realloc(lexemes, lexCapacity * sizeof(LexemeEntry));
+        if (!lexemes)
+            fatalError("Error: Out of memory.");
     }
-    else
+
+    LexemeEntry *lex = &lexemes[lexCount++];
+    lex->token = token;
+    lex->offset = offset;
+    lex->length = length;
+    lex->line = line;
+    lex->column = column;
+}
+
+// Function that adds an invalid lexeme (token 0) and stores its error message in the error table
+void addErrorToken(int offset, int length, int line, int column, const char *errMsg)
+{
+    // Grow the error table as needed
+    if (errorCount == errorCapacity)
     {
-        fprintf(stderr, "Error: Lexeme buffer overflow.\n"); // Debugging - edge cases
-        exit(1);
+        errorCapacity = errorCapacity ? 2 * errorCapacity : 64;
+        lexErrors = realloc(lexErrors, errorCapacity * sizeof(LexError));
+        if (!lexErrors)
+            fatalError("Error: Out of memory.");
     }
+
+    // Store error message
+    lexErrors[errorCount].lexeme = lexCount;
+    strncpy(lexErrors[errorCount].message, errMsg, sizeof(lexErrors[errorCount].message) - 1);
+    lexErrors[errorCount].message[sizeof(lexErrors[errorCount].message) - 1] = '\0';
+    errorCount++;
+
+    addToken(0, offset, length, line, column); // No valid token type
 }
 
-// Function that tokenizes a PL/0 file
-void lexicalAnalyzer(FILE *input)
+// Function that tokenizes the source buffer
+void lexicalAnalyzer()
 {
     // Initialize variables
-    char c, buffer[MAX_LEXEME_LENGTH];
-    int pos, line = 1, column = 1;
+    int i = 0, length = (int)sourceLength;
+    int line = 1, lineStart = 0;
 
-    // Read entire file char by char
-    while ((c = fgetc(input)) != EOF)
+    // Scan the entire buffer
+    while (i < length)
     {
+        unsigned char c = source[i];
+        int start = i++;
+        int column = start - lineStart + 1;
+
         // Skip whitespaces
         if (isspace(c))
         {
@@ -128,12 +243,7 @@ void lexicalAnalyzer(FILE *input)
             if (c == '\n')
             {
                 line++; // Move to next line
-                column = 1; // Reset column
-            }
-            // For spaces and tabs
-            else
-            {
-                column++; // Move to next col
+                lineStart = i; // Reset column
             }
 
             // Process next char
@@ -143,26 +253,27 @@ void lexicalAnalyzer(FILE *input)
         // Comment handling
         if (c == '/')
         {
-            int next = fgetc(input);
-            
             // Opening comment symbol /* found
-            if (next == '*')
+            if (i < length && source[i] == '*')
             {
-                int prev = 0, closed = 0;
+                int startLine = line, prev = 0, closed = 0;
 
                 // Now look for closing */ until found or end of file
-                while ((c = fgetc(input)) != EOF)
+                for (i++; i < length; i++)
                 {
+                    c = source[i];
+
                     // Newline -> same as earlier
                     if (c == '\n')
                     {
                         line++; // Go to next line
-                        column = 1; // Reset column
+                        lineStart = i + 1; // Reset column
                     }
                     // Proper closing comment symbol */ found
                     if (prev == '*' && c == '/')
                     {
                         closed = 1; // Mark as closed
+                        i++;
                         break;
                     }
                     prev = c;
@@ -172,16 +283,15 @@ void lexicalAnalyzer(FILE *input)
                 if (!closed)
                 {
                     // Treat as normal tokens
-                    addToken(slashsym, "/");
-                    addToken(multsym, "*");
+                    addToken(slashsym, start, 1, startLine, column);
+                    addToken(multsym, start + 1, 1, startLine, column + 1);
                 }
                 continue;
             }
             // Just a slash
             else
             {
-                ungetc(next, input); // Put back in input stream
-                addToken(slashsym, "/"); // Add as token
+                addToken(slashsym, start, 1, line, column); // Add as token
 
                 // Process next char
                 continue;
@@ -191,45 +301,18 @@ void lexicalAnalyzer(FILE *input)
         // Tokenize identifiers (vars, keywords)
         if (isalpha(c))
         {
-            // Initialize position trackers
-            pos = 0;
-            buffer[pos++] = c;
-            column++;
-            
-            // Read full identifier char by char in a loop
-            while ((c = fgetc(input)) != EOF && (isalpha(c) || isdigit(c)))
-            {
-                // Check that it's a valid size (not exceding 11)
-                if (pos < MAX_ID_LENGTH) 
-                {
-                    buffer[pos++] = c; // Store in buffer
-                }
-                // Too long
-                else
-                {
-                    // Discard remaining chars
-                    while (isalpha(c) || isdigit(c))
-                    {
-                        c = fgetc(input);
-                        column++;
-                    }
-                    buffer[pos] = '\0'; // Terminate lexeme
-                    addErrorToken(buffer, "Error: Ident length too long."); // Error: identifier is too long
+            // Find the end of the identifier
+            while (i < length && isalnum((unsigned char)source[i]))
+                i++;
+            int span = i - start;
 
-                    // Exit loop
-                    break;
-                }
-                column++;
+            // Check that it's a valid size (not exceding 11)
+            if (span > MAX_ID_LENGTH)
+            {
+                addErrorToken(start, MAX_ID_LENGTH, line, column, "Error: Ident length too long."); // Error: identifier is too long
+                span = MAX_ID_LENGTH; // First 11 chars are still added as a token
             }
-            buffer[pos] = '\0';
-
-            // If not the end of file
-            if (c != EOF)
-                ungetc(c, input); // Push back to input stream
-
-            // If lenght was valid
-            if (pos <= MAX_ID_LENGTH)
-                addToken(getToken(buffer), buffer); // Add as token
+            addToken(getToken(source + start, span), start, span, line, column); // Add as token
 
             // Process next char
             continue;
@@ -238,44 +321,18 @@ void lexicalAnalyzer(FILE *input)
         // Tokenize numbers
         if (isdigit(c))
         {
-            // Initialize position trackers
-            pos = 0;
-            buffer[pos++] = c;
-            column++;
+            // Find the end of the number
+            while (i < length && isdigit((unsigned char)source[i]))
+                i++;
+            int span = i - start;
 
-            // Read all digits char by char in a loop
-            while ((c = fgetc(input)) != EOF && isdigit(c))
+            // Check that it's a valid size (not exceding 5)
+            if (span > MAX_NUM_LENGTH)
             {
-                // Check that it's a valid size (not exceding 5)
-                if (pos < MAX_NUM_LENGTH)
-                {
-                    buffer[pos++] = c; // Store in buffer
-                }
-                else
-                {
-                    // Discard remaining digits
-                    while (isdigit(c))
-                    {
-                        c = fgetc(input);
-                        column++;
-                    }
-                    buffer[pos] = '\0'; // Terminate lexeme
-                    addErrorToken(buffer, "Error: Number too long."); // Error: number is too long
-
-                    // Exit loop
-                    break;
-                }
-                column++;
+                addErrorToken(start, MAX_NUM_LENGTH, line, column, "Error: Number too long."); // Error: number is too long
+                span = MAX_NUM_LENGTH; // First 5 digits are still added as a token
             }
-            buffer[pos] = '\0';
-            
-            // If not the end of file
-            if (c != EOF)
-                ungetc(c, input); // Push back to input stream
-            
-            // If length was valid
-            if (pos <= MAX_NUM_LENGTH)
-                addToken(numbersym, buffer); // Add as token
+            addToken(numbersym, start, span, line, column); // Add as token
 
             // Process next char
             continue;
@@ -285,66 +342,64 @@ void lexicalAnalyzer(FILE *input)
         switch (c)
         {
         case '+': // Plus
-            addToken(plussym, "+");
+            addToken(plussym, start, 1, line, column);
             break;
         case '-': // Minus
-            addToken(minussym, "-");
+            addToken(minussym, start, 1, line, column);
             break;
         case '*': // Multiplication
-            addToken(multsym, "*");
-            break;
-        case '/': // Division
-            addToken(slashsym, "/");
+            addToken(multsym, start, 1, line, column);
             break;
         case '(': // Left parenthesis
-            addToken(lparentsym, "(");
+            addToken(lparentsym, start, 1, line, column);
             break;
         case ')': // Right parenthesis
-            addToken(rparentsym, ")");
+            addToken(rparentsym, start, 1, line, column);
             break;
         case '=': // Equal
-            addToken(eqlsym, "=");
+            addToken(eqlsym, start, 1, line, column);
             break;
         case ',': // Comma
-            addToken(commasym, ",");
+            addToken(commasym, start, 1, line, column);
             break;
         case '.': // Period
-            addToken(periodsym, ".");
+            addToken(periodsym, start, 1, line, column);
             break;
         case ';': // Semicolon
-            addToken(semicolonsym, ";");
+            addToken(semicolonsym, start, 1, line, column);
             break;
-        case ':': // Colon
-            if ((c = fgetc(input)) == '=')
-                addToken(becomessym, ":="); // Definition of
+        case ':': // Colon (the next char is consumed either way)
+            if (i < length && source[i++] == '=')
+                addToken(becomessym, start, 2, line, column); // Definition of
             else
-                addErrorToken(":", "Error: Invalid symbol ':'"); // Not a valid symbol
+                addErrorToken(start, 1, line, column, "Error: Invalid symbol ':'"); // Not a valid symbol
             break;
-        case '<': // Less than
-            if ((c = fgetc(input)) == '=') // less than or equal to
-                addToken(leqsym, "<=");
+        case '<': // Less than (the next char is consumed either way)
+            c = i < length ? source[i++] : 0;
+            if (c == '=') // less than or equal to
+                addToken(leqsym, start, 2, line, column);
             else if (c == '>') // not equal to
-                addToken(neqsym, "<>"); 
+                addToken(neqsym, start, 2, line, column); 
             else
-                addToken(lessym, "<"); // regular less than
+                addToken(lessym, start, 1, line, column); // regular less than
             break;
-        case '>': // Greater than
-            if ((c = fgetc(input)) == '=') // greater than or equal to
-                addToken(geqsym, ">=");
+        case '>': // Greater than (the next char is consumed either way)
+            c = i < length ? source[i++] : 0;
+            if (c == '=') // greater than or equal to
+                addToken(geqsym, start, 2, line, column);
             else
-                addToken(gtrsym, ">"); // regular greater than
+                addToken(gtrsym, start, 1, line, column); // regular greater than
             break;
 
         // Invalid symbols
         default:
         {
             // Add error message
-            char lex[2] = {c, '\0'};
             char err[64];
             snprintf(err, sizeof(err), "Error: Invalid symbol '%c'", c);
 
             // Add error token to list
-            addErrorToken(lex, err); 
+            addErrorToken(start, 1, line, column, err); 
 
             // Process next char
             break;
@@ -364,8 +419,7 @@ int main(int argc, char *argv[])
     }
 
     // Error opening input file
-    FILE *input = fopen(argv[1], "r");
-    if (!input)
+    if (!loadSource(argv[1]))
     {
         perror("Error opening file");
         return 1;
@@ -373,31 +427,25 @@ int main(int argc, char *argv[])
 
     // Print Source Program
     printf("Source Program:\n");
-    char line[256];
-    while (fgets(line, sizeof(line), input))
-    {
-        printf("%s", line);
-    }
-    rewind(input); // Reset fpointer
+    fwrite(source, 1, sourceLength, stdout);
 
     // Analyze input and tokenize it
-    lexicalAnalyzer(input);
-
-    // Close input file
-    fclose(input);
+    lexicalAnalyzer();
 
     // Print lexeme table with lexemes and token types
     printf("\n\nLexeme Table:\n\n");
     printf("lexeme\t\ttoken type\n");
+    int nextError = 0;
     for (int i = 0; i < lexCount; i++)
     {
-        if (lexemes[i].isError)
+        if (nextError < errorCount && lexErrors[nextError].lexeme == i)
         {
-            printf("%-10s\t%s\n", lexemes[i].lexeme, lexemes[i].errorMsg); // Error message
+            printf("%-10.*s\t%s\n", lexemes[i].length, source + lexemes[i].offset, lexErrors[nextError].message); // Error message
+            nextError++;
         }
         else
         {
-            printf("%-10s\t%d\n", lexemes[i].lexeme, lexemes[i].token); // Token
+            printf("%-10.*s\t%d\n", lexemes[i].length, source + lexemes[i].offset, lexemes[i].token); // Token
         }
     }
 
@@ -406,14 +454,14 @@ int main(int argc, char *argv[])
     for (int i = 0; i < lexCount; i++)
     {
         // Only print valid tokens
-        if (!lexemes[i].isError)
+        if (lexemes[i].token != 0)
         {
             printf("%d", lexemes[i].token); // Token number
 
             // For identifiers and nymbers print associated lexeme as well
             if (lexemes[i].token == identsym || lexemes[i].token == numbersym)
             {
-                printf(" %s", lexemes[i].lexeme); 
+                printf(" %.*s", lexemes[i].length, source + lexemes[i].offset); 
             }
             // Separate each token for formatting
             printf(" ");                         
@@ -6,17 +6,22 @@
  * Description: Implements a PL/0 Tiny Compiler. Generates P-code instructions
  */
 
+#define _DEFAULT_SOURCE // mmap
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#define MAX_LEXEMES 10000   // From lex.c
 #define MAX_ID_LENGTH 11    // From lex.c
 #define MAX_NUM_LENGTH 5    // From lex.c
 #define MAX_LEXEME_LENGTH 64 // From lex.c
 #define MAX_INSTRUCTIONS 9999
-#define MAX_SYMBOLS 500
 
 // P-code opcodes
 #define LIT 1    // Load literal
@@ -54,29 +59,21 @@ typedef enum {
     elsesym = 33, oddsym = 34 
 } tokenType; 
 
-// Reserved words
-typedef struct {
-    char *name;
-    tokenType token;
-} ReservedWord;
-
-// List of reserved words
-ReservedWord reservedWords[] = 
-{
-    {"const", constsym}, {"var", varsym}, {"begin", beginsym}, {"end", endsym}, 
-    {"if", ifsym}, {"fi", fisym}, {"then", thensym}, {"else", elsesym}, 
-    {"while", whilesym}, {"do", dosym}, {"read", readsym}, {"write", writesym}, 
-    {"mod", modsym}
-}; 
-
 // Lexeme entry
 typedef struct {
-    char lexeme[MAX_LEXEME_LENGTH];
-    int token;
-    char errorMsg[MAX_LEXEME_LENGTH];
-    int isError;
+    int token;  // Token type (0 = invalid lexeme, see LexError)
+    int offset; // Start of the lexeme in the source buffer
+    int length; // Length of the lexeme
+    int line;   // Line where the lexeme starts
+    int column; // Column where the lexeme starts
 } LexemeEntry;
 
+// Error message of an invalid lexeme
+typedef struct {
+    int lexeme;                      // Index of the invalid lexeme
+    char message[MAX_LEXEME_LENGTH]; // Error message
+} LexError;
+
 
 // Instruction
 typedef struct {
@@ -89,29 +86,46 @@ typedef struct {
 // Symbol table
 typedef struct {
     int kind;      // 1 = const, 2 = var, 3 = procedure
-    char name[MAX_LEXEME_LENGTH]; 
+    const char *name; // Interned name (see InternEntry)
     int value;     // For constants
     int level;     // Scope level
     int address;   // Memory location
     int mark;      // 0 if active, 1 if marked for deletion
+    int nameId;    // Index of the name in the intern table
 } SymbolEntry;
 
+// Interned identifier: every distinct name is stored once and bound to the first symbol declared with it
+typedef struct {
+    const char *text;  // Name (NULL = empty slot)
+    unsigned int hash; // Hash of the name
+    int symbol;        // Symbol bound to the name, -1 if none
+} InternEntry;
+
 // Initializations for Global Variables
 
 // Token list 
 int tokenIndex = 0;
 tokenType currentToken;
 
-// Number of reserved words
-int numReservedWords = sizeof(reservedWords) / sizeof(ReservedWord); 
+// Source program (memory-mapped, or read into a buffer)
+const char *source = NULL;
+size_t sourceLength = 0;
 
-// Lexeme list
-LexemeEntry lexemes[MAX_LEXEMES];
-int lexCount = 0;
+// Lexeme list (grows as needed)
+LexemeEntry *lexemes = NULL;
+int lexCount = 0, lexCapacity = 0;
 
-// Symbol table
-SymbolEntry symbolTable[MAX_SYMBOLS];
-int symbolCount = 0;
+// Lexical errors, in lexeme order
+LexError *lexErrors = NULL;
+int errorCount = 0, errorCapacity = 0;
+
+// Symbol table (grows as needed)
+SymbolEntry *symbolTable = NULL;
+int symbolCount = 0, symbolCapacity = 0;
+
+// Intern table: open addressing, capacity is a power of two kept at most half full
+InternEntry *internTable = NULL;
+int internCount = 0, internCapacity = 0;
 
 // P-code instructions
 Instruction instructions[MAX_INSTRUCTIONS];
@@ -120,10 +134,12 @@ int instructionCount = 0;
 // Function Prototypes
 
 // Lexical Analyzer function prototypes -> From lex.c
-tokenType getToken(char *lexeme);
-void addToken(int token, const char *lexeme);
-void addErrorToken(const char *lexeme, const char *errMsg);
-void lexicalAnalyzer(FILE *input);
+tokenType getToken(const char *text, int length);
+int loadSource(const char *fileName);
+void addToken(int token, int offset, int length, int line, int column);
+void addErrorToken(int offset, int length, int line, int column, const char *errMsg);
+char *lexemeText(int index);
+void lexicalAnalyzer();
 
 // Tiny PL/0 Compiler
 void getNextToken();
@@ -138,6 +154,7 @@ void factor();
 void condition();
 void emit(int op, int l, int m);
 int symbolTableCheck(char *name);
+void addSymbol(int kind, const char *name, int value, int level, int address);
 void printAssemblyCode();
 void printSymbolTable();
 void error(const char *msg);
@@ -158,75 +175,186 @@ void error(const char *msg)
 }
 
 // Lexical Analyzer functions -> From lex.c
-tokenType getToken(char *lexeme) {
-    for (int i = 0; i < numReservedWords; i++) {
-        if (strcmp(lexeme, reservedWords[i].name) == 0)
-            return reservedWords[i].token;
+// Function that finds the token type of an identifier-like lexeme. Reserved words are matched by
+// length, then first character, then a single memcmp (no table scan).
+tokenType getToken(const char *text, int length)
+{
+    switch (length)
+    {
+    case 2:
+        switch (text[0])
+        {
+        case 'i':
+            return memcmp(text, "if", 2) == 0 ? ifsym : identsym;
+        case 'f':
+            return memcmp(text, "fi", 2) == 0 ? fisym : identsym;
+        case 'd':
+            return memcmp(text, "do", 2) == 0 ? dosym : identsym;
+        }
+        break;
+    case 3:
+        switch (text[0])
+        {
+        case 'v':
+            return memcmp(text, "var", 3) == 0 ? varsym : identsym;
+        case 'e':
+            return memcmp(text, "end", 3) == 0 ? endsym : identsym;
+        case 'm':
+            return memcmp(text, "mod", 3) == 0 ? modsym : identsym;
+        case 'o':
+            return memcmp(text, "odd", 3) == 0 ? oddsym : identsym;
+        }
+        break;
+    case 4:
+        switch (text[0])
+        {
+        case 't':
+            return memcmp(text, "then", 4) == 0 ? thensym : identsym;
+        case 'e':
+            return memcmp(text, "else", 4) == 0 ? elsesym : identsym;
+        case 'r':
+            return memcmp(text, "read", 4) == 0 ? readsym : identsym;
+        }
+        break;
+    case 5:
+        switch (text[0])
+        {
+        case 'c':
+            return memcmp(text, "const", 5) == 0 ? constsym : identsym;
+        case 'b':
+            return memcmp(text, "begin", 5) == 0 ? beginsym : identsym;
+        case 'w':
+            if (memcmp(text, "while", 5) == 0)
+                return whilesym;
+            return memcmp(text, "write", 5) == 0 ? writesym : identsym;
+        }
+        break;
     }
     return identsym;
 }
 
-// Function that adds a lexeme (+ token type) to the lexeme table
-void addToken(int token, const char *lexeme)
+// Function that reads a whole source file into memory (memory-mapped when possible)
+int loadSource(const char *fileName)
 {
-    // Check for available space
-    if (lexCount < MAX_LEXEMES)
-    {
-        // Store the lexeme
-        strncpy(lexemes[lexCount].lexeme, lexeme, MAX_LEXEME_LENGTH - 1);
-        lexemes[lexCount].lexeme[MAX_LEXEME_LENGTH - 1] = '\0';
-        lexemes[lexCount].token = token; // Token type
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+        return 0;
 
-        // Indicate its a valid lexeme (no error flag/message)
-        lexemes[lexCount].errorMsg[0] = '\0';
-        lexemes[lexCount].isError = 0;
-
-        // Continue
-        lexCount++;
+    // Regular files are mapped in place
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        if (info.st_size > INT_MAX)
+        {
+            close(fd);
+            error("Source file too large");
+        }
+        void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED)
+        {
+            close(fd);
+            source = mapped;
+            sourceLength = info.st_size;
+            return 1;
+        }
     }
-    else
+
+    // Anything else (pipes, empty files) is read in large blocks
+    char *buffer = NULL;
+    size_t capacity = 0, length = 0;
+    for (;;)
     {
-        fprintf(stderr, "Error: Lexeme buffer overflow.\n"); // Debugging - edge cases
-        exit(1);
+        if (length == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 65536;
+            if (capacity > INT_MAX || !(buffer = realloc(buffer, capacity)))
+            {
+                close(fd);
+                error("Source file too large");
+            }
+        }
+        ssize_t count = read(fd, buffer + length, capacity - length);
+        if (count < 0)
+        {
+            free(buffer);
+            close(fd);
+            return 0;
+        }
+        if (count == 0)
+            break;
+        length += count;
     }
+    close(fd);
+    source = buffer;
+    sourceLength = length;
+    return 1;
 }
 
-// Function that adds an invalid lexeme and stores an error message for it
-void addErrorToken(const char *lexeme, const char *errMsg)
+// Function that adds a lexeme (+ token type) to the lexeme table. The lexeme stays in the source buffer.
+void addToken(int token, int offset, int length, int line, int column)
 {
-    // Check for available space
-    if (lexCount < MAX_LEXEMES)
+    // Grow the lexeme table as needed
+    if (lexCount == lexCapacity)
     {
-        // Store the invalid lexeme
-        strncpy(lexemes[lexCount].lexeme, lexeme, MAX_LEXEME_LENGTH - 1);
-        lexemes[lexCount].lexeme[MAX_LEXEME_LENGTH - 1] = '\0';
-        lexemes[lexCount].token = 0; // No valid token type
-
-        // Store error message
-        strncpy(lexemes[lexCount].errorMsg, errMsg, sizeof(lexemes[lexCount].errorMsg) - 1);
-        lexemes[lexCount].errorMsg[sizeof(lexemes[lexCount].errorMsg) - 1] = '\0';
-        lexemes[lexCount].isError = 1; // Invalid flag
-
-        // Continue
-        lexCount++;
+        lexCapacity = lexCapacity ? 2 * lexCapacity : 4096;
+        lexemes = realloc(lexemes, lexCapacity * sizeof(LexemeEntry));
+        if (!lexemes)
+            error("Out of memory");
     }
-    else
+
+    LexemeEntry *lex = &lexemes[lexCount++];
+    lex->token = token;
+    lex->offset = offset;
+    lex->length = length;
+    lex->line = line;
+    lex->column = column;
+}
+
+// Function that adds an invalid lexeme (token 0) and stores its error message in the error table
+void addErrorToken(int offset, int length, int line, int column, const char *errMsg)
+{
+    // Grow the error table as needed
+    if (errorCount == errorCapacity)
     {
-        fprintf(stderr, "Error: Lexeme buffer overflow.\n"); // Debugging - edge cases
-        exit(1);
+        errorCapacity = errorCapacity ? 2 * errorCapacity : 64;
+        lexErrors = realloc(lexErrors, errorCapacity * sizeof(LexError));
+        if (!lexErrors)
+            error("Out of memory");
     }
+
+    // Store error message
+    lexErrors[errorCount].lexeme = lexCount;
+    strncpy(lexErrors[errorCount].message, errMsg, sizeof(lexErrors[errorCount].message) - 1);
+    lexErrors[errorCount].message[sizeof(lexErrors[errorCount].message) - 1] = '\0';
+    errorCount++;
+
+    addToken(0, offset, length, line, column); // No valid token type
 }
 
-// Function that tokenizes a PL/0 file
-void lexicalAnalyzer(FILE *input)
+// Function that returns the text of a lexeme as a string (valid until the next call)
+char *lexemeText(int index)
+{
+    static char text[MAX_LEXEME_LENGTH];
+    int length = lexemes[index].length < MAX_LEXEME_LENGTH ? lexemes[index].length : MAX_LEXEME_LENGTH - 1;
+    memcpy(text, source + lexemes[index].offset, length);
+    text[length] = '\0';
+    return text;
+}
+
+// Function that tokenizes the source buffer
+void lexicalAnalyzer()
 {
     // Initialize variables
-    char c, buffer[MAX_LEXEME_LENGTH];
-    int pos, line = 1, column = 1;
+    int i = 0, length = (int)sourceLength;
+    int line = 1, lineStart = 0;
 
-    // Read entire file char by char
-    while ((c = fgetc(input)) != EOF)
+    // Scan the entire buffer
+    while (i < length)
     {
+        unsigned char c = source[i];
+        int start = i++;
+        int column = start - lineStart + 1;
+
         // Skip whitespaces
         if (isspace(c))
         {
@@ -234,12 +362,7 @@ void lexicalAnalyzer(FILE *input)
             if (c == '\n')
             {
                 line++; // Move to next line
-                column = 1; // Reset column
-            }
-            // For spaces and tabs
-            else
-            {
-                column++; // Move to next col
+                lineStart = i; // Reset column
             }
 
             // Process next char
@@ -249,26 +372,27 @@ void lexicalAnalyzer(FILE *input)
         // Comment handling
         if (c == '/')
         {
-            int next = fgetc(input);
-            
             // Opening comment symbol /* found
-            if (next == '*')
+            if (i < length && source[i] == '*')
             {
-                int prev = 0, closed = 0;
+                int startLine = line, prev = 0, closed = 0;
 
                 // Now look for closing */ until found or end of file
-                while ((c = fgetc(input)) != EOF)
+                for (i++; i < length; i++)
                 {
+                    c = source[i];
+
                     // Newline -> same as earlier
                     if (c == '\n')
                     {
                         line++; // Go to next line
-                        column = 1; // Reset column
+                        lineStart = i + 1; // Reset column
                     }
                     // Proper closing comment symbol */ found
                     if (prev == '*' && c == '/')
                     {
                         closed = 1; // Mark as closed
+                        i++;
                         break;
                     }
                     prev = c;
@@ -278,16 +402,15 @@ void lexicalAnalyzer(FILE *input)
                 if (!closed)
                 {
                     // Treat as normal tokens
-                    addToken(slashsym, "/");
-                    addToken(multsym, "*");
+                    addToken(slashsym, start, 1, startLine, column);
+                    addToken(multsym, start + 1, 1, startLine, column + 1);
                 }
                 continue;
             }
             // Just a slash
             else
             {
-                ungetc(next, input); // Put back in input stream
-                addToken(slashsym, "/"); // Add as token
+                addToken(slashsym, start, 1, line, column); // Add as token
 
                 // Process next char
                 continue;
@@ -297,45 +420,18 @@ void lexicalAnalyzer(FILE *input)
         // Tokenize identifiers (vars, keywords)
         if (isalpha(c))
         {
-            // Initialize position trackers
-            pos = 0;
-            buffer[pos++] = c;
-            column++;
-            
-            // Read full identifier char by char in a loop
-            while ((c = fgetc(input)) != EOF && (isalpha(c) || isdigit(c)))
-            {
-                // Check that it's a valid size (not exceding 11)
-                if (pos < MAX_ID_LENGTH) 
-                {
-                    buffer[pos++] = c; // Store in buffer
-                }
-                // Too long
-                else
-                {
-                    // Discard remaining chars
-                    while (isalpha(c) || isdigit(c))
-                    {
-                        c = fgetc(input);
-                        column++;
-                    }
-                    buffer[pos] = '\0'; // Terminate lexeme
-                    addErrorToken(buffer, "Error: Ident length too long."); // Error: identifier is too long
+            // Find the end of the identifier
+            while (i < length && isalnum((unsigned char)source[i]))
+                i++;
+            int span = i - start;
 
-                    // Exit loop
-                    break;
-                }
-                column++;
+            // Check that it's a valid size (not exceding 11)
+            if (span > MAX_ID_LENGTH)
+            {
+                addErrorToken(start, MAX_ID_LENGTH, line, column, "Error: Ident length too long."); // Error: identifier is too long
+                span = MAX_ID_LENGTH; // First 11 chars are still added as a token
             }
-            buffer[pos] = '\0';
-
-            // If not the end of file
-            if (c != EOF)
-                ungetc(c, input); // Push back to input stream
-
-            // If lenght was valid
-            if (pos <= MAX_ID_LENGTH)
-                addToken(getToken(buffer), buffer); // Add as token
+            addToken(getToken(source + start, span), start, span, line, column); // Add as token
 
             // Process next char
             continue;
@@ -344,44 +440,18 @@ void lexicalAnalyzer(FILE *input)
         // Tokenize numbers
         if (isdigit(c))
         {
-            // Initialize position trackers
-            pos = 0;
-            buffer[pos++] = c;
-            column++;
+            // Find the end of the number
+            while (i < length && isdigit((unsigned char)source[i]))
+                i++;
+            int span = i - start;
 
-            // Read all digits char by char in a loop
-            while ((c = fgetc(input)) != EOF && isdigit(c))
+            // Check that it's a valid size (not exceding 5)
+            if (span > MAX_NUM_LENGTH)
             {
-                // Check that it's a valid size (not exceding 5)
-                if (pos < MAX_NUM_LENGTH)
-                {
-                    buffer[pos++] = c; // Store in buffer
-                }
-                else
-                {
-                    // Discard remaining digits
-                    while (isdigit(c))
-                    {
-                        c = fgetc(input);
-                        column++;
-                    }
-                    buffer[pos] = '\0'; // Terminate lexeme
-                    addErrorToken(buffer, "Error: Number too long."); // Error: number is too long
-
-                    // Exit loop
-                    break;
-                }
-                column++;
+                addErrorToken(start, MAX_NUM_LENGTH, line, column, "Error: Number too long."); // Error: number is too long
+                span = MAX_NUM_LENGTH; // First 5 digits are still added as a token
             }
-            buffer[pos] = '\0';
-            
-            // If not the end of file
-            if (c != EOF)
-                ungetc(c, input); // Push back to input stream
-            
-            // If length was valid
-            if (pos <= MAX_NUM_LENGTH)
-                addToken(numbersym, buffer); // Add as token
+            addToken(numbersym, start, span, line, column); // Add as token
 
             // Process next char
             continue;
@@ -391,66 +461,64 @@ void lexicalAnalyzer(FILE *input)
         switch (c)
         {
         case '+': // Plus
-            addToken(plussym, "+");
+            addToken(plussym, start, 1, line, column);
             break;
         case '-': // Minus
-            addToken(minussym, "-");
+            addToken(minussym, start, 1, line, column);
             break;
         case '*': // Multiplication
-            addToken(multsym, "*");
-            break;
-        case '/': // Division
-            addToken(slashsym, "/");
+            addToken(multsym, start, 1, line, column);
             break;
         case '(': // Left parenthesis
-            addToken(lparentsym, "(");
+            addToken(lparentsym, start, 1, line, column);
             break;
         case ')': // Right parenthesis
-            addToken(rparentsym, ")");
+            addToken(rparentsym, start, 1, line, column);
             break;
         case '=': // Equal
-            addToken(eqlsym, "=");
+            addToken(eqlsym, start, 1, line, column);
             break;
         case ',': // Comma
-            addToken(commasym, ",");
+            addToken(commasym, start, 1, line, column);
             break;
         case '.': // Period
-            addToken(periodsym, ".");
+            addToken(periodsym, start, 1, line, column);
             break;
         case ';': // Semicolon
-            addToken(semicolonsym, ";");
+            addToken(semicolonsym, start, 1, line, column);
             break;
-        case ':': // Colon
-            if ((c = fgetc(input)) == '=')
-                addToken(becomessym, ":="); // Definition of
+        case ':': // Colon (the next char is consumed either way)
+            if (i < length && source[i++] == '=')
+                addToken(becomessym, start, 2, line, column); // Definition of
             else
-                addErrorToken(":", "Error: Invalid symbol ':'"); // Not a valid symbol
+                addErrorToken(start, 1, line, column, "Error: Invalid symbol ':'"); // Not a valid symbol
             break;
-        case '<': // Less than
-            if ((c = fgetc(input)) == '=') // less than or equal to
-                addToken(legsym, "<=");
+        case '<': // Less than (the next char is consumed either way)
+            c = i < length ? source[i++] : 0;
+            if (c == '=') // less than or equal to
+                addToken(legsym, start, 2, line, column);
             else if (c == '>') // not equal to
-                addToken(negsym, "<>"); 
+                addToken(negsym, start, 2, line, column); 
             else
-                addToken(lessym, "<"); // regular less than
+                addToken(lessym, start, 1, line, column); // regular less than
             break;
-        case '>': // Greater than
-            if ((c = fgetc(input)) == '=') // greater than or equal to
-                addToken(gegsym, ">=");
+        case '>': // Greater than (the next char is consumed either way)
+            c = i < length ? source[i++] : 0;
+            if (c == '=') // greater than or equal to
+                addToken(gegsym, start, 2, line, column);
             else
-                addToken(gtrsym, ">"); // regular greater than
+                addToken(gtrsym, start, 1, line, column); // regular greater than
             break;
 
         // Invalid symbols
         default:
         {
             // Add error message
-            char lex[2] = {c, '\0'};
             char err[64];
             snprintf(err, sizeof(err), "Error: Invalid symbol '%c'", c);
 
             // Add error token to list
-            addErrorToken(lex, err); 
+            addErrorToken(start, 1, line, column, err); 
 
             // Process next char
             break;
@@ -523,7 +591,7 @@ void constDeclaration()
                 error("Expected identifier after 'const'");
             }
             char name[MAX_LEXEME_LENGTH];
-            strcpy(name, lexemes[tokenIndex - 1].lexeme);   // Save name
+            strcpy(name, lexemeText(tokenIndex - 1));   // Save name
 
             // Get equal sign
             getNextToken();
@@ -537,16 +605,10 @@ void constDeclaration()
             if (currentToken != numbersym) {
                 error("Expected number after '='");
             }
-            int value = atoi(lexemes[tokenIndex - 1].lexeme); // Convert to int
+            int value = atoi(lexemeText(tokenIndex - 1)); // Convert to int
 
             // Add constant to symbol table
-            strcpy(symbolTable[symbolCount].name, name);
-            symbolTable[symbolCount].kind = 1;
-            symbolTable[symbolCount].value = value;
-            symbolTable[symbolCount].level = 0;
-            symbolTable[symbolCount].address = 0;
-            symbolTable[symbolCount].mark = 0;
-            symbolCount++;
+            addSymbol(1, name, value, 0, 0);
             
             getNextToken(); // Get next token
         } while (currentToken == commasym);
@@ -578,16 +640,10 @@ int varDeclaration()
                 error("Expected identifier after 'var'");
             }
             char name[MAX_LEXEME_LENGTH];
-            strcpy(name, lexemes[tokenIndex - 1].lexeme); // Save name
+            strcpy(name, lexemeText(tokenIndex - 1)); // Save name
             
             // Add variable to symbol table
-            strcpy(symbolTable[symbolCount].name, name);
-            symbolTable[symbolCount].kind = 2;
-            symbolTable[symbolCount].value = 0;
-            symbolTable[symbolCount].level = 0;
-            symbolTable[symbolCount].address = numVars + 2;
-            symbolTable[symbolCount].mark = 0;
-            symbolCount++;
+            addSymbol(2, name, 0, 0, numVars + 2);
             
             // Get next token
             getNextToken();
@@ -664,7 +720,7 @@ void factor()
     if (currentToken == identsym) 
     {
         // Check if identifier is in symbol table
-        int symIdx = symbolTableCheck(lexemes[tokenIndex - 1].lexeme);
+        int symIdx = symbolTableCheck(lexemeText(tokenIndex - 1));
         if (symIdx == -1)
         {
             error("Undeclared identifier");
@@ -677,7 +733,7 @@ void factor()
     // Process numbers
     else if (currentToken == numbersym) 
     {
-        int num = atoi(lexemes[tokenIndex - 1].lexeme);
+        int num = atoi(lexemeText(tokenIndex - 1));
         emit(LIT, 0, num);
         getNextToken();
     } 
@@ -780,7 +836,7 @@ void statement()
     if (currentToken == identsym) 
     {
         //  Check if identifier is in symbol table
-        int symIdx = symbolTableCheck(lexemes[tokenIndex - 1].lexeme);
+        int symIdx = symbolTableCheck(lexemeText(tokenIndex - 1));
 
         // Not found
         if (symIdx == -1)
@@ -886,7 +942,7 @@ void statement()
         {
             error("Expected an identifier after 'read'");
         }
-        int symIdx = symbolTableCheck(lexemes[tokenIndex - 1].lexeme);
+        int symIdx = symbolTableCheck(lexemeText(tokenIndex - 1));
 
         // Not found
         if (symIdx == -1)
@@ -930,21 +986,114 @@ void emit(int op, int l, int m)
     instructionCount++;
 }
 
-// Function that searches the symbol table for an identifier
-int symbolTableCheck(char *name) 
+// Helper function that hashes an identifier (FNV-1a)
+unsigned int hashName(const char *name)
 {
-    // Loop through symbol table
-    for (int i = 0; i < symbolCount; i++) 
+    unsigned int hash = 2166136261u;
+    for (; *name; name++)
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    return hash;
+}
+
+// Helper function that finds the intern table slot for name: its entry, or the empty slot where it belongs
+int findInternSlot(const char *name, unsigned int hash)
+{
+    int slot = hash & (internCapacity - 1);
+    while (internTable[slot].text &&
+           (internTable[slot].hash != hash || strcmp(internTable[slot].text, name) != 0))
     {
-        // Check if identifier is in table
-        if (strcmp(symbolTable[i].name, name) == 0) 
+        slot = (slot + 1) & (internCapacity - 1);
+    }
+    return slot;
+}
+
+// Function that returns the intern table index of name, adding it if it's new
+int internName(const char *name)
+{
+    // Keep the table at most half full
+    if (2 * (internCount + 1) > internCapacity)
+    {
+        InternEntry *oldTable = internTable;
+        int oldCapacity = internCapacity;
+        internCapacity = internCapacity ? 2 * internCapacity : 256;
+        internTable = calloc(internCapacity, sizeof(InternEntry));
+        if (!internTable)
+            error("Out of memory");
+
+        // Rehash existing names; symbols refer to them by index, so remap those too
+        int *newSlot = malloc((oldCapacity + 1) * sizeof(int));
+        if (!newSlot)
+            error("Out of memory");
+        for (int i = 0; i < oldCapacity; i++)
         {
-            return i; // Success
+            if (oldTable[i].text)
+            {
+                newSlot[i] = findInternSlot(oldTable[i].text, oldTable[i].hash);
+                internTable[newSlot[i]] = oldTable[i];
+            }
         }
+        for (int i = 0; i < symbolCount; i++)
+            symbolTable[i].nameId = newSlot[symbolTable[i].nameId];
+        free(newSlot);
+        free(oldTable);
     }
 
-    // Not found
-    return -1;
+    unsigned int hash = hashName(name);
+    int slot = findInternSlot(name, hash);
+    if (!internTable[slot].text)
+    {
+        // New name: store one copy of it
+        size_t length = strlen(name) + 1;
+        char *text = malloc(length);
+        if (!text)
+            error("Out of memory");
+        memcpy(text, name, length);
+
+        internTable[slot].text = text;
+        internTable[slot].hash = hash;
+        internTable[slot].symbol = -1;
+        internCount++;
+    }
+    return slot;
+}
+
+// Function that adds a symbol to the table. A name keeps the first symbol declared with it.
+void addSymbol(int kind, const char *name, int value, int level, int address)
+{
+    // Grow the symbol table as needed
+    if (symbolCount == symbolCapacity)
+    {
+        symbolCapacity = symbolCapacity ? 2 * symbolCapacity : 256;
+        symbolTable = realloc(symbolTable, symbolCapacity * sizeof(SymbolEntry));
+        if (!symbolTable)
+            error("Out of memory");
+    }
+
+    int nameId = internName(name);
+    SymbolEntry *sym = &symbolTable[symbolCount];
+    sym->kind = kind;
+    sym->name = internTable[nameId].text;
+    sym->value = value;
+    sym->level = level;
+    sym->address = address;
+    sym->mark = 0;
+    sym->nameId = nameId;
+
+    if (internTable[nameId].symbol == -1)
+        internTable[nameId].symbol = symbolCount;
+    symbolCount++;
+}
+
+// Function that searches the symbol table for an identifier
+int symbolTableCheck(char *name) 
+{
+    // Empty symbol table
+    if (internCapacity == 0)
+        return -1;
+
+    // Symbol bound to the name
+    int slot = findInternSlot(name, hashName(name));
+    return internTable[slot].text ? internTable[slot].symbol : -1;
 }
 
 // Helper function that prints the generated assembly code.
@@ -1018,9 +1167,8 @@ int main(int argc, char *argv[])
         return 1;
     }
     
-    // Open input file
-    FILE *input = fopen(argv[1], "r");
-    if (!input) {
+    // Load input file
+    if (!loadSource(argv[1])) {
         perror("Error opening file"); // Error opening file
         return 1;
     }
@@ -1034,8 +1182,7 @@ int main(int argc, char *argv[])
     }
         
     // Do lexical analysis on input file
-    lexicalAnalyzer(input);
-    fclose(input);
+    lexicalAnalyzer();
     
     // Parse lexemes and generate P-code instructions 
     program();
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Times compiling many generated programs: one compiler process per file, then --batch on one thread and on every
+# core. Checks that the batch writes the same elf and listing for every file as the single-file compiler.
+# Usage (from "HW 4"): sh bench/batch.sh [files]
+
+FILES=${1:-1000}
+GEN=./bench/plgen_batch
+COMPILER=./bench/hw4_batch
+DIR=bench/batch_work
+
+gcc -std=c17 -Wall -O2 -o "$GEN" bench/plgen.c || exit 1
+gcc -std=c17 -Wall -O2 -pthread -o "$COMPILER" hw4compiler.c || exit 1
+
+# Programs of every kind and a few sizes
+rm -rf "$DIR"
+mkdir -p "$DIR/src" "$DIR/single" "$DIR/batch"
+i=0
+for kind in symbols nested procedures expressions loops recursion
+do
+    for size in 5 20 60
+    do
+        "$GEN" $kind $size $i > "$DIR/src/${kind}_${size}_$i.pl0"
+        i=$((i + 1))
+    done
+done
+while [ $i -lt "$FILES" ]
+do
+    cp "$DIR/src/$(ls "$DIR/src" | sed -n "$((i % 18 + 1))p")" "$DIR/src/copy_$i.pl0"
+    i=$((i + 1))
+done
+ls "$DIR"/src/*.pl0 > "$DIR/list.txt"
+
+# One process per file (each writes elf.txt in the working directory)
+start=$(date +%s%N)
+for source in "$DIR"/src/*.pl0
+do
+    name=$(basename "$source")
+    (cd "$DIR/single" && "../../../$COMPILER" --no-lines "../src/$name" > "$name.lst" && mv elf.txt "$name.elf.txt")
+done
+end=$(date +%s%N)
+echo "$FILES files, one process each: $(( (end - start) / 1000000 )) ms"
+
+for jobs in 1 $(nproc)
+do
+    "$COMPILER" --no-lines --batch="$DIR/list.txt" --jobs=$jobs --out-dir="$DIR/batch" --listing
+done
+
+# Same outputs
+if diff -r -q "$DIR/single" "$DIR/batch" > /dev/null
+then
+    echo "Batch outputs match the single-file compiler"
+else
+    echo "MISMATCH between the batch and the single-file compiler"
+fi
+
+rm -rf "$DIR" "$GEN" "$COMPILER"
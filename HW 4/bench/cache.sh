@@ -0,0 +1,65 @@
+#!/bin/sh
+# Times compiling generated programs with an empty compilation cache (every file misses and is stored) and again
+# with the warm cache (every file hits), one compiler process per file and then --batch on every core. Checks that
+# the cold and warm outputs are the same as the compiler's without the cache.
+# Usage (from "HW 4"): sh bench/cache.sh [files]
+
+FILES=${1:-200}
+GEN=./bench/plgen_cache
+COMPILER=./bench/hw4_cache
+DIR=bench/cache_work
+
+gcc -std=c17 -Wall -O2 -o "$GEN" bench/plgen.c || exit 1
+gcc -std=c17 -Wall -O2 -pthread -o "$COMPILER" hw4compiler.c || exit 1
+
+# Different programs of every kind, so that every file gets its own entry
+rm -rf "$DIR"
+mkdir -p "$DIR/src" "$DIR/plain" "$DIR/cold" "$DIR/warm" "$DIR/batch"
+i=0
+while [ $i -lt "$FILES" ]
+do
+    for kind in symbols nested procedures expressions loops recursion
+    do
+        [ $i -lt "$FILES" ] || break
+        case $kind in
+            symbols) size=2000 ;;
+            nested) size=60 ;;
+            *) size=200 ;;
+        esac
+        "$GEN" $kind $size $i > "$DIR/src/${kind}_$i.pl0"
+        i=$((i + 1))
+    done
+done
+ls "$DIR"/src/*.pl0 > "$DIR/list.txt"
+
+# One process per file (each writes elf.txt and elf.txt.lines in the working directory), all sharing one cache
+compileAll()
+{
+    start=$(date +%s%N)
+    for source in "$DIR"/src/*.pl0
+    do
+        name=$(basename "$source")
+        (cd "$DIR/$1" && "../../../$COMPILER" $2 "../src/$name" > "$name.lst" &&
+            mv elf.txt "$name.elf.txt" && mv elf.txt.lines "$name.elf.txt.lines")
+    done
+    end=$(date +%s%N)
+    echo "$FILES files, one process each, $3: $(( (end - start) / 1000000 )) ms"
+}
+compileAll plain "" "no cache"
+compileAll cold --cache=../cache "cold cache"
+compileAll warm --cache=../cache "warm cache"
+echo "Cache: $(ls "$DIR/cache" | wc -l) entries, $(du -sk "$DIR/cache" | cut -f1) KB"
+
+# The batch, cold then warm, with its own cache
+"$COMPILER" --batch="$DIR/list.txt" --out-dir="$DIR/batch" --listing --cache="$DIR/batch_cache"
+"$COMPILER" --batch="$DIR/list.txt" --out-dir="$DIR/batch" --listing --cache="$DIR/batch_cache"
+
+# Same outputs
+if diff -r -q "$DIR/plain" "$DIR/cold" > /dev/null && diff -r -q "$DIR/plain" "$DIR/warm" > /dev/null
+then
+    echo "Cached outputs match the compiler without the cache"
+else
+    echo "MISMATCH between the cached and uncached outputs"
+fi
+
+rm -rf "$DIR" "$GEN" "$COMPILER"
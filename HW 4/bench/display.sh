@@ -0,0 +1,51 @@
+#!/bin/sh
+# Times the threaded engine (display) and the switch engine (static link walks) on generated programs with
+# deeply nested procedures that use the variables of every enclosing level. Pass the source of another VM
+# (e.g. an older vm.c) to time its threaded engine on the same programs and check that it prints the same.
+# Usage (from "HW 4"): sh bench/display.sh [runs] [other_vm.c]
+
+RUNS=${1:-3}
+OTHER=$2
+GEN=./bench/plgen_bench
+COMPILER=./bench/hw4compiler_bench
+VM=./bench/vm_bench
+OTHER_VM=./bench/other_vm_bench
+
+gcc -std=c17 -Wall -O2 -o "$GEN" bench/plgen.c || exit 1
+gcc -std=c17 -Wall -O2 -o "$COMPILER" hw4compiler.c || exit 1
+gcc -std=c17 -Wall -O2 -o "$VM" vm.c || exit 1
+if [ -n "$OTHER" ]
+then
+    gcc -std=c17 -O2 -I. -o "$OTHER_VM" "$OTHER" || exit 1
+fi
+
+for depth in 2 4 8 16
+do
+    "$GEN" nested $depth > bench/nested_input.txt
+    "$COMPILER" bench/nested_input.txt > /dev/null && mv elf.txt bench/nested_elf.txt
+
+    "$VM" --engine=switch --quiet bench/nested_elf.txt > bench/switch.out
+    for run in "$VM --engine=threaded" ${OTHER:+"$OTHER_VM --engine=threaded"}
+    do
+        $run --quiet bench/nested_elf.txt > bench/threaded.out
+        if ! cmp -s bench/switch.out bench/threaded.out
+        then
+            echo "MISMATCH at depth $depth: $run"
+        fi
+    done
+
+    for run in "$VM --engine=switch" "$VM --engine=threaded" ${OTHER:+"$OTHER_VM --engine=threaded"}
+    do
+        start=$(date +%s%N)
+        i=0
+        while [ $i -lt "$RUNS" ]
+        do
+            $run --quiet bench/nested_elf.txt > /dev/null
+            i=$((i + 1))
+        done
+        end=$(date +%s%N)
+        echo "depth $depth $(basename "${run% *}") ${run##* }: $(( (end - start) / RUNS / 1000 )) us/run"
+    done
+done
+
+rm -f "$GEN" "$COMPILER" "$VM" "$OTHER_VM" elf.txt.lines bench/nested_input.txt bench/nested_elf.txt bench/switch.out bench/threaded.out
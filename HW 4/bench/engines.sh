@@ -0,0 +1,39 @@
+#!/bin/sh
+# Compares the switch and threaded VM engines on the loop-heavy benchmark programs,
+# with the full trace and in production (--quiet) mode.
+# Usage (from "HW 4"): sh bench/engines.sh [runs]
+
+RUNS=${1:-3}
+VM=./bench/vm_bench
+
+gcc -std=c17 -Wall -O2 -o "$VM" vm.c || exit 1
+
+for program in bench/loop_elf.txt bench/call_elf.txt
+do
+    # Both engines must agree before timing means anything
+    "$VM" --engine=switch "$program" > bench/switch.out
+    "$VM" --engine=threaded "$program" > bench/threaded.out
+    if ! cmp -s bench/switch.out bench/threaded.out
+    then
+        echo "MISMATCH: $program"
+        exit 1
+    fi
+
+    for mode in --trace-every=1 --quiet
+    do
+        for engine in switch threaded
+        do
+            start=$(date +%s%N)
+            i=0
+            while [ $i -lt "$RUNS" ]
+            do
+                "$VM" --engine=$engine $mode "$program" > /dev/null
+                i=$((i + 1))
+            done
+            end=$(date +%s%N)
+            echo "$program $engine $mode: $(( (end - start) / RUNS / 1000 )) us/run"
+        done
+    done
+done
+
+rm -f "$VM" bench/switch.out bench/threaded.out
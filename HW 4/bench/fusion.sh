@@ -0,0 +1,41 @@
+#!/bin/sh
+# Compares bench/loop_input.txt compiled with and without --fuse, on both VM engines (--quiet).
+# Usage (from "HW 4"): sh bench/fusion.sh [runs]
+
+RUNS=${1:-3}
+COMPILER=./bench/hw4compiler_bench
+VM=./bench/vm_bench
+
+gcc -std=c17 -Wall -O2 -o "$COMPILER" hw4compiler.c || exit 1
+gcc -std=c17 -Wall -O2 -o "$VM" vm.c || exit 1
+
+# Compile both versions (the compiler always writes elf.txt in the current directory)
+"$COMPILER" bench/loop_input.txt > /dev/null && mv elf.txt bench/plain_elf.txt
+"$COMPILER" --fuse bench/loop_input.txt | grep "^Fusion:" && mv elf.txt bench/fused_elf.txt
+
+# Fusion must not change the program's output
+"$VM" --quiet bench/plain_elf.txt > bench/plain.out
+"$VM" --quiet bench/fused_elf.txt > bench/fused.out
+if ! cmp -s bench/plain.out bench/fused.out
+then
+    echo "MISMATCH: fused program output differs"
+    exit 1
+fi
+
+for program in bench/plain_elf.txt bench/fused_elf.txt
+do
+    for engine in switch threaded
+    do
+        start=$(date +%s%N)
+        i=0
+        while [ $i -lt "$RUNS" ]
+        do
+            "$VM" --engine=$engine --quiet "$program" > /dev/null
+            i=$((i + 1))
+        done
+        end=$(date +%s%N)
+        echo "$program $engine: $(( (end - start) / RUNS / 1000 )) us/run"
+    done
+done
+
+rm -f "$COMPILER" "$VM" elf.txt.lines bench/plain_elf.txt bench/fused_elf.txt bench/plain.out bench/fused.out
@@ -0,0 +1,50 @@
+#!/bin/sh
+# Compares bench/loop_input.txt and bench/helpers_input.txt (small procedures called in loops) compiled
+# without and with --inline, on every VM engine (--quiet). Each program must print the same in every build.
+# Usage (from "HW 4"): sh bench/inline.sh [runs]
+
+RUNS=${1:-3}
+COMPILER=./bench/hw4compiler_bench
+VM=./bench/vm_bench
+
+gcc -std=c17 -Wall -O2 -o "$COMPILER" hw4compiler.c || exit 1
+gcc -std=c17 -Wall -O2 -o "$VM" vm.c || exit 1
+
+for name in loop helpers
+do
+    # Compile every build (the compiler always writes elf.txt in the current directory)
+    "$COMPILER" bench/${name}_input.txt > /dev/null && mv elf.txt bench/${name}_plain_elf.txt
+    "$COMPILER" --inline bench/${name}_input.txt | grep "^Inlining:" && mv elf.txt bench/${name}_inlined_elf.txt
+    "$COMPILER" --inline --peephole --prune --fuse bench/${name}_input.txt > /dev/null &&
+        mv elf.txt bench/${name}_all_elf.txt
+
+    "$VM" --quiet bench/${name}_plain_elf.txt > bench/plain.out
+    for build in inlined all
+    do
+        "$VM" --quiet bench/${name}_${build}_elf.txt > bench/inlined.out
+        if ! cmp -s bench/plain.out bench/inlined.out
+        then
+            echo "MISMATCH: $name $build"
+            exit 1
+        fi
+    done
+
+    for build in plain inlined all
+    do
+        for engine in switch threaded jit register
+        do
+            start=$(date +%s%N)
+            i=0
+            while [ $i -lt "$RUNS" ]
+            do
+                "$VM" --engine=$engine --quiet bench/${name}_${build}_elf.txt > /dev/null
+                i=$((i + 1))
+            done
+            end=$(date +%s%N)
+            echo "$name $build $engine: $(( (end - start) / RUNS / 1000 )) us/run"
+        done
+    done
+done
+
+rm -f "$COMPILER" "$VM" elf.txt.lines bench/*_plain_elf.txt bench/*_inlined_elf.txt bench/*_all_elf.txt bench/plain.out \
+    bench/inlined.out
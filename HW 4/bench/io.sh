@@ -0,0 +1,72 @@
+#!/bin/sh
+# Times an I/O-bound program (read n values, write each one doubled, then the sum) with printf/scanf per value
+# (--quiet) and with the buffered --io=stream and --io=raw modes, on every engine. Checks that the outputs agree.
+# Usage (from "HW 4"): sh bench/io.sh [values] [runs]
+
+VALUES=${1:-1000000}
+RUNS=${2:-3}
+DIR=bench/io_work
+
+gcc -std=c17 -Wall -O2 -pthread -o bench/hw4_io hw4compiler.c || exit 1
+gcc -std=c17 -Wall -O2 -pthread -o bench/vm_io vm.c || exit 1
+
+rm -rf "$DIR"
+mkdir -p "$DIR"
+cat > "$DIR/sum.pl0" << 'PL0'
+var n, x, s, i;
+begin
+  read n;
+  s := 0;
+  i := 0;
+  while i < n do
+  begin
+    read x;
+    s := s + x;
+    write x * 2;
+    i := i + 1
+  end;
+  write s
+end.
+PL0
+(cd "$DIR" && ../hw4_io sum.pl0 > /dev/null) || exit 1
+
+# The same values as text and as native 32-bit integers
+awk -v n="$VALUES" 'BEGIN { srand(1); print n; for (i = 0; i < n; i++) print int(rand() * 200001) - 100000 }' \
+    > "$DIR/input.txt"
+python3 -c "
+import struct, sys
+values = [int(line) for line in open(sys.argv[1])]
+sys.stdout.buffer.write(struct.pack('<%di' % len(values), *values))" "$DIR/input.txt" > "$DIR/input.bin" || exit 1
+
+printf "%-9s %10s %10s %10s\n" engine "stdio ms" "stream ms" "raw ms"
+for engine in switch threaded jit register
+do
+    line=$engine
+    for mode in "--quiet" "--io=stream" "--io=raw"
+    do
+        input="$DIR/input.txt"
+        [ "$mode" = "--io=raw" ] && input="$DIR/input.bin"
+        "./bench/vm_io" --engine=$engine $mode "$DIR/elf.txt" < "$input" > "$DIR/output_${mode#--}"
+        start=$(date +%s%N)
+        i=0
+        while [ $i -lt "$RUNS" ]
+        do
+            "./bench/vm_io" --engine=$engine $mode "$DIR/elf.txt" < "$input" > /dev/null
+            i=$((i + 1))
+        done
+        end=$(date +%s%N)
+        line="$line $(( (end - start) / RUNS / 1000000 ))"
+    done
+    printf "%-9s %10s %10s %10s\n" $line
+
+    # Same values in every mode
+    python3 -c "
+import struct, sys
+raw = open(sys.argv[3], 'rb').read()
+values = ['Output result is: %d' % v for v in struct.unpack('<%di' % (len(raw) // 4), raw)]
+text = open(sys.argv[1]).read().split('\n')[:-1]
+sys.exit(not (text == values and open(sys.argv[2]).read() == open(sys.argv[1]).read()))" \
+        "$DIR/output_quiet" "$DIR/output_io=stream" "$DIR/output_io=raw" || echo "MISMATCH between the I/O modes on $engine"
+done
+
+rm -rf "$DIR" bench/hw4_io bench/vm_io
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Compares the interpreters with the JIT engine (--quiet) on an arithmetic loop (bench/loop_input.txt)
+# and a recursive procedure (bench/recursive_input.txt), each compiled with and without --fuse.
+# Every test program in HW 4 and HW 1 must first print the same thing on the JIT as on the threaded engine.
+# Usage (from "HW 4"): sh bench/jit.sh [runs]
+
+RUNS=${1:-3}
+COMPILER=./bench/hw4compiler_bench
+VM=./bench/vm_bench
+INPUT="3
+4
+5
+6
+7"
+
+gcc -std=c17 -Wall -O2 -o "$COMPILER" hw4compiler.c || exit 1
+gcc -std=c17 -Wall -O2 -o "$VM" vm.c || exit 1
+
+# Compile the benchmarks (the compiler always writes elf.txt in the current directory)
+for name in loop recursive
+do
+    "$COMPILER" bench/${name}_input.txt > /dev/null && mv elf.txt bench/${name}_plain_elf.txt
+    "$COMPILER" --fuse bench/${name}_input.txt > /dev/null && mv elf.txt bench/${name}_fused_elf.txt
+done
+
+# The JIT must agree with the interpreter before timing means anything
+for program in test*_elf.txt bench/*_elf.txt "../HW 1/test1.txt" "../HW 1/test2.txt"
+do
+    echo "$INPUT" | "$VM" --engine=threaded --quiet "$program" > bench/threaded.out
+    echo "$INPUT" | "$VM" --engine=jit --quiet "$program" > bench/jit.out
+    if ! cmp -s bench/threaded.out bench/jit.out
+    then
+        echo "MISMATCH: $program"
+        exit 1
+    fi
+done
+
+for program in bench/loop_plain_elf.txt bench/loop_fused_elf.txt bench/recursive_plain_elf.txt bench/recursive_fused_elf.txt
+do
+    for engine in switch threaded jit
+    do
+        start=$(date +%s%N)
+        i=0
+        while [ $i -lt "$RUNS" ]
+        do
+            "$VM" --engine=$engine --quiet "$program" > /dev/null
+            i=$((i + 1))
+        done
+        end=$(date +%s%N)
+        echo "$program $engine: $(( (end - start) / RUNS / 1000 )) us/run"
+    done
+done
+
+rm -f "$COMPILER" "$VM" elf.txt.lines bench/loop_plain_elf.txt bench/loop_fused_elf.txt bench/recursive_plain_elf.txt \
+      bench/recursive_fused_elf.txt bench/threaded.out bench/jit.out
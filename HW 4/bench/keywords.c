@@ -0,0 +1,198 @@
+/*
+ * COP 3402 Systems Software
+ * Homework 4: Reserved word lookup micro-benchmark
+ * Author: Esteban Ramirez
+ * Description: Classifies every identifier-like word of a PL/0 file many times, with the old
+ *              reserved word table scan and with the length/first-char switch used by the lexers.
+ */
+
+#define _DEFAULT_SOURCE // clock_gettime with -std=c17
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+// Token types (same values as hw4compiler.c)
+typedef enum {
+    modsym = 1, identsym = 2, fisym = 8, beginsym = 21, endsym = 22, ifsym = 23, thensym = 24, whilesym = 25,
+    dosym = 26, callsym = 27, constsym = 28, varsym = 29, procsym = 30, writesym = 31, readsym = 32, elsesym = 33,
+    oddsym = 34
+} tokenType;
+
+// Reserved word table (previous lexer)
+typedef struct {
+    char *name;
+    tokenType token;
+} ReservedWord;
+
+ReservedWord reservedWords[] =
+{
+    {"const", constsym}, {"var", varsym}, {"begin", beginsym}, {"end", endsym},
+    {"if", ifsym}, {"fi", fisym}, {"then", thensym}, {"else", elsesym},
+    {"while", whilesym}, {"do", dosym}, {"read", readsym}, {"write", writesym},
+    {"mod", modsym}, {"procedure", procsym}, {"call", callsym}, {"odd", oddsym}
+};
+int numReservedWords = sizeof(reservedWords) / sizeof(ReservedWord);
+
+// Word list
+typedef struct {
+    const char *text;
+    int length;
+} Word;
+
+// Function that finds the token type with a linear scan of the reserved word table
+tokenType tableToken(const char *text, int length)
+{
+    for (int i = 0; i < numReservedWords; i++)
+    {
+        if (strncmp(text, reservedWords[i].name, length) == 0 && reservedWords[i].name[length] == '\0')
+            return reservedWords[i].token;
+    }
+    return identsym;
+}
+
+// Function that finds the token type by length and first character (copy of getToken in hw4compiler.c)
+tokenType switchToken(const char *text, int length)
+{
+    switch (length)
+    {
+    case 2:
+        switch (text[0])
+        {
+        case 'i':
+            return memcmp(text, "if", 2) == 0 ? ifsym : identsym;
+        case 'f':
+            return memcmp(text, "fi", 2) == 0 ? fisym : identsym;
+        case 'd':
+            return memcmp(text, "do", 2) == 0 ? dosym : identsym;
+        }
+        break;
+    case 3:
+        switch (text[0])
+        {
+        case 'v':
+            return memcmp(text, "var", 3) == 0 ? varsym : identsym;
+        case 'e':
+            return memcmp(text, "end", 3) == 0 ? endsym : identsym;
+        case 'm':
+            return memcmp(text, "mod", 3) == 0 ? modsym : identsym;
+        case 'o':
+            return memcmp(text, "odd", 3) == 0 ? oddsym : identsym;
+        }
+        break;
+    case 4:
+        switch (text[0])
+        {
+        case 't':
+            return memcmp(text, "then", 4) == 0 ? thensym : identsym;
+        case 'e':
+            return memcmp(text, "else", 4) == 0 ? elsesym : identsym;
+        case 'r':
+            return memcmp(text, "read", 4) == 0 ? readsym : identsym;
+        case 'c':
+            return memcmp(text, "call", 4) == 0 ? callsym : identsym;
+        }
+        break;
+    case 5:
+        switch (text[0])
+        {
+        case 'c':
+            return memcmp(text, "const", 5) == 0 ? constsym : identsym;
+        case 'b':
+            return memcmp(text, "begin", 5) == 0 ? beginsym : identsym;
+        case 'w':
+            if (memcmp(text, "while", 5) == 0)
+                return whilesym;
+            return memcmp(text, "write", 5) == 0 ? writesym : identsym;
+        }
+        break;
+    case 9:
+        return memcmp(text, "procedure", 9) == 0 ? procsym : identsym;
+    }
+    return identsym;
+}
+
+// Helper function that returns the current time in seconds
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Helper function that classifies every word rounds times and returns the elapsed seconds
+double timeLookup(tokenType (*lookup)(const char *, int), const Word *words, int count, int rounds, long *checksum)
+{
+    double start = now();
+    for (int r = 0; r < rounds; r++)
+        for (int i = 0; i < count; i++)
+            *checksum += lookup(words[i].text, words[i].length);
+    return now() - start;
+}
+
+// Times both lookups on the words of a PL/0 file. Usage: keywords <input_file> [rounds]
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <input_file> [rounds]\n", argv[0]);
+        return 1;
+    }
+    int rounds = argc > 2 ? atoi(argv[2]) : 200;
+
+    // Read the whole file
+    FILE *input = fopen(argv[1], "rb");
+    if (!input)
+    {
+        perror("Error opening file");
+        return 1;
+    }
+    fseek(input, 0, SEEK_END);
+    long size = ftell(input);
+    rewind(input);
+    char *source = malloc(size + 1);
+    if (!source || fread(source, 1, size, input) != (size_t)size)
+    {
+        printf("Error reading file\n");
+        return 1;
+    }
+    fclose(input);
+
+    // Collect identifier-like words (what the lexer classifies)
+    Word *words = malloc((size / 2 + 1) * sizeof(Word));
+    int count = 0;
+    for (long i = 0; i < size;)
+    {
+        if (isalpha((unsigned char)source[i]))
+        {
+            long start = i;
+            while (i < size && isalnum((unsigned char)source[i]))
+                i++;
+            words[count].text = source + start;
+            words[count].length = (int)(i - start);
+            count++;
+        }
+        else
+            i++;
+    }
+
+    // Both lookups must agree
+    for (int i = 0; i < count; i++)
+    {
+        if (tableToken(words[i].text, words[i].length) != switchToken(words[i].text, words[i].length))
+        {
+            printf("MISMATCH: %.*s\n", words[i].length, words[i].text);
+            return 1;
+        }
+    }
+
+    long checksum = 0;
+    double table = timeLookup(tableToken, words, count, rounds, &checksum);
+    double sw = timeLookup(switchToken, words, count, rounds, &checksum);
+    printf("%d words x %d rounds (checksum %ld)\n", count, rounds, checksum);
+    printf("table scan: %.2f ns/word\n", table * 1e9 / ((double)count * rounds));
+    printf("switch:     %.2f ns/word\n", sw * 1e9 / ((double)count * rounds));
+    return 0;
+}
@@ -0,0 +1,76 @@
+#!/bin/sh
+# Times every engine on the benchmark programs against another VM (e.g. the vm.c with the code in PAS), to
+# check that the separate stack and code segment cost nothing per instruction, then runs a generated program
+# with more than 9999 instructions and 4000 globals (too big for the fixed layout) with a larger --stack.
+# Usage (from "HW 4"): sh bench/layout.sh [runs] [other_vm.c]
+
+RUNS=${1:-5}
+OTHER=$2
+GEN=./bench/plgen_bench
+COMPILER=./bench/hw4compiler_bench
+VM=./bench/vm_bench
+OTHER_VM=./bench/other_vm_bench
+
+gcc -std=c17 -Wall -O2 -o "$GEN" bench/plgen.c || exit 1
+gcc -std=c17 -Wall -O2 -o "$COMPILER" hw4compiler.c || exit 1
+gcc -std=c17 -Wall -O2 -o "$VM" vm.c || exit 1
+if [ -n "$OTHER" ]
+then
+    gcc -std=c17 -O2 -I. -o "$OTHER_VM" "$OTHER" || exit 1
+fi
+
+# Runs "$1" RUNS times on elf file $2 with input file $3 and prints the average time
+time_run()
+{
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt "$RUNS" ]
+    do
+        $1 --quiet "$2" < "$3" > /dev/null 2>&1
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    echo "$(( (end - start) / RUNS / 1000000 )) ms"
+}
+
+# Compile the benchmarks (the compiler always writes elf.txt in the current directory)
+for name in loop recursive
+do
+    "$COMPILER" bench/${name}_input.txt > /dev/null && mv elf.txt bench/${name}_bench_elf.txt
+done
+
+for program in loop recursive
+do
+    for engine in switch threaded jit register
+    do
+        for run in "$VM --engine=$engine" ${OTHER:+"$OTHER_VM --engine=$engine"}
+        do
+            $run --quiet bench/${program}_bench_elf.txt < /dev/null > bench/layout.out 2>&1
+            $VM --engine=switch --quiet bench/${program}_bench_elf.txt < /dev/null > bench/expected.out 2>&1
+            if ! cmp -s bench/expected.out bench/layout.out
+            then
+                echo "MISMATCH on $program: $run"
+            fi
+            echo "$program $(basename "${run% *}") $engine: $(time_run "$run" bench/${program}_bench_elf.txt /dev/null)"
+        done
+    done
+done
+
+# A program the fixed layout can't hold: 13004 instructions, 4000 globals
+"$GEN" symbols 4000 > bench/large_input.txt
+"$COMPILER" bench/large_input.txt > /dev/null && mv elf.txt bench/large_elf.txt
+echo "1 2 3" > bench/large.in
+$VM --engine=switch --quiet --stack=8000 bench/large_elf.txt < bench/large.in > bench/expected.out 2>&1
+for engine in switch threaded jit register
+do
+    $VM --engine=$engine --quiet --stack=8000 bench/large_elf.txt < bench/large.in > bench/layout.out 2>&1
+    if ! cmp -s bench/expected.out bench/layout.out
+    then
+        echo "MISMATCH on large: $engine"
+    fi
+    echo "large $engine --stack=8000: $(time_run "$VM --engine=$engine --stack=8000" bench/large_elf.txt bench/large.in)"
+done
+echo "large with the default stack: $($VM --quiet bench/large_elf.txt < bench/large.in 2>&1 | tail -1)"
+
+rm -f "$GEN" "$COMPILER" "$VM" "$OTHER_VM" elf.txt.lines bench/loop_bench_elf.txt bench/recursive_bench_elf.txt bench/large_input.txt bench/large_elf.txt \
+    bench/large.in bench/layout.out bench/expected.out
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Times the HW 2 lexer on large generated programs (source read, tokens, lexeme table).
+# Pass the source of another lexer (e.g. an older lex.c) to time it on the same programs
+# and check that both print the same lexeme table.
+# Usage (from "HW 4"): sh bench/lexer.sh [runs] [other_lex.c]
+
+RUNS=${1:-10}
+OTHER=$2
+GEN=./bench/plgen_bench
+LEXER=./bench/lex_bench
+OTHER_LEXER=./bench/other_lex_bench
+
+gcc -std=c17 -Wall -O2 -o "$GEN" bench/plgen.c || exit 1
+gcc -std=c17 -Wall -O2 -o "$LEXER" "../HW 2/lex.c" || exit 1
+if [ -n "$OTHER" ]
+then
+    gcc -std=c17 -O2 -o "$OTHER_LEXER" "$OTHER" || exit 1
+fi
+
+for size in 200 1000 4000 16000
+do
+    "$GEN" symbols $size > bench/lexer_input.txt
+
+    for lexer in "$LEXER" ${OTHER:+"$OTHER_LEXER"}
+    do
+        name=$(basename "$lexer")
+        if ! "$lexer" bench/lexer_input.txt > "bench/$name.out" 2>&1
+        then
+            echo "size $size $name: failed"
+            continue
+        fi
+
+        start=$(date +%s%N)
+        i=0
+        while [ $i -lt "$RUNS" ]
+        do
+            "$lexer" bench/lexer_input.txt > /dev/null
+            i=$((i + 1))
+        done
+        end=$(date +%s%N)
+        echo "size $size $name: $(( (end - start) / RUNS / 1000 )) us/run"
+    done
+
+    if [ -n "$OTHER" ] && [ -s bench/other_lex_bench.out ] && ! grep -q overflow bench/other_lex_bench.out &&
+       ! cmp -s bench/lex_bench.out bench/other_lex_bench.out
+    then
+        echo "MISMATCH at size $size"
+    fi
+    rm -f bench/lex_bench.out bench/other_lex_bench.out
+done
+
+rm -f bench/lexer_input.txt "$GEN" "$LEXER" "$OTHER_LEXER"
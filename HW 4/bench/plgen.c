@@ -0,0 +1,245 @@
+/*
+ * COP 3402 Systems Software
+ * Homework 4: Synthetic PL/0 program generator (benchmarks)
+ * Author: Esteban Ramirez
+ * Description: Writes a generated PL/0 program of a given kind and size to stdout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOCALS_PER_PROCEDURE 10
+
+// Generator state
+unsigned int seed = 1;
+
+// Helper function that returns a pseudo-random number in [0, n) (deterministic for a given seed)
+int randomBelow(int n)
+{
+    seed = seed * 1103515245u + 12345u;
+    return (int)((seed >> 16) % (unsigned int)n);
+}
+
+// Helper function that prints a comma-separated declaration list: prefix0, prefix1, ...
+void printDeclarations(const char *keyword, const char *prefix, int count)
+{
+    printf("%s ", keyword);
+    for (int i = 0; i < count; i++)
+        printf("%s%s%d", i ? ", " : "", prefix, i);
+    printf(";\n");
+}
+
+// Symbols: size identifiers in total. Half are globals, the rest are locals of procedures that each
+// reference globals and their own locals, so every scope is pushed, searched and popped.
+void generateSymbols(int size)
+{
+    int globals = size / 2 > 0 ? size / 2 : 1;
+    int procedures = (size - globals) / LOCALS_PER_PROCEDURE;
+
+    printDeclarations("var", "g", globals);
+    for (int p = 0; p < procedures; p++)
+    {
+        printf("procedure p%d;\n", p);
+        printDeclarations("  var", "a", LOCALS_PER_PROCEDURE);
+        printf("  begin\n");
+        for (int i = 0; i < LOCALS_PER_PROCEDURE; i++)
+            printf("    a%d := g%d + a%d;\n", i, randomBelow(globals), randomBelow(LOCALS_PER_PROCEDURE));
+        printf("    g%d := a%d\n", randomBelow(globals), randomBelow(LOCALS_PER_PROCEDURE));
+        printf("  end;\n");
+    }
+
+    printf("begin\n");
+    for (int i = 0; i < globals; i++)
+        printf("  g%d := g%d;\n", i, randomBelow(globals));
+    printf("  write g0\n");
+    printf("end.\n");
+}
+
+// Nested: size procedures, each declared inside the previous one with a variable of its own. The innermost
+// one loops over expressions and assignments on variables of every enclosing level, so almost every access
+// goes some static links up.
+void generateNested(int size)
+{
+    printf("var g, n;\n");
+    for (int p = 0; p < size; p++)
+    {
+        printf("%*sprocedure p%d;\n", 2 * p, "", p);
+        printf("%*svar v%d%s;\n", 2 * p + 2, "", p, p == size - 1 ? ", i" : "");
+    }
+
+    // Innermost body
+    int indent = 2 * size;
+    printf("%*sbegin\n", indent, "");
+    printf("%*sv%d := %d; i := 0;\n", indent + 2, "", size - 1, size);
+    printf("%*swhile i < 200 do\n", indent + 2, "");
+    printf("%*sbegin\n", indent + 2, "");
+    for (int k = 0; k < 4; k++)
+    {
+        int a = randomBelow(size), b = randomBelow(size), c = randomBelow(size);
+        printf("%*sv%d := v%d + v%d mod 7;\n", indent + 4, "", a, b, c);
+    }
+    printf("%*sg := g + v%d mod 11;\n", indent + 4, "", randomBelow(size));
+    printf("%*si := i + 1\n", indent + 4, "");
+    printf("%*send\n", indent + 2, "");
+    printf("%*send;\n", indent, "");
+
+    // Every other procedure sets its variable and calls the one it contains
+    for (int p = size - 2; p >= 0; p--)
+        printf("%*sbegin v%d := %d; call p%d end;\n", 2 * p + 2, "", p, p + 1, p + 1);
+
+    printf("begin\n");
+    printf("  g := 0; n := 0;\n");
+    printf("  while n < 1000 do\n");
+    printf("  begin\n");
+    printf("    call p0;\n");
+    printf("    g := g mod 10007;\n");
+    printf("    n := n + 1\n");
+    printf("  end;\n");
+    printf("  write g\n");
+    printf("end.\n");
+}
+
+// Procedures: size procedures with two locals each, all called from a loop in the main block (many small
+// frames to build and tear down, and a long program to compile).
+void generateProcedures(int size)
+{
+    printf("var g, n;\n");
+    for (int p = 0; p < size; p++)
+    {
+        printf("procedure p%d;\n", p);
+        printf("  var a, b;\n");
+        printf("  begin\n");
+        printf("    a := g + %d; b := a * %d mod 97;\n", randomBelow(100), 1 + randomBelow(9));
+        printf("    g := (a + b) mod 1000\n");
+        printf("  end;\n");
+    }
+
+    printf("begin\n");
+    printf("  g := 0; n := 0;\n");
+    printf("  while n < 100 do\n");
+    printf("  begin\n");
+    for (int p = 0; p < size; p++)
+        printf("    call p%d;\n", p);
+    printf("    n := n + 1\n");
+    printf("  end;\n");
+    printf("  write g\n");
+    printf("end.\n");
+}
+
+// Expressions: one assignment whose expression has size terms (some parenthesized, every term kept small with
+// mod so nothing overflows), evaluated in a loop of 1000 iterations.
+void generateExpressions(int size)
+{
+    static const char *names[] = { "x", "y", "z", "i" };
+    static const char *operators[] = { "+", "-", "*" };
+
+    printf("var x, y, z, i, r;\n");
+    printf("begin\n");
+    printf("  x := 1; y := 2; z := 3; i := 0;\n");
+    printf("  while i < 1000 do\n");
+    printf("  begin\n");
+    printf("    r := 0");
+    for (int t = 0; t < size; t++)
+    {
+        if (t % 8 == 0)
+            printf("\n     ");
+        const char *name = names[randomBelow(4)];
+        int constant = 1 + randomBelow(99), modulus = 2 + randomBelow(97);
+        if (randomBelow(3) == 0)
+            printf(" %s (%s %s %d) mod %d", t % 2 ? "-" : "+", name, operators[randomBelow(3)], constant, modulus);
+        else
+            printf(" %s %s mod %d", t % 2 ? "-" : "+", name, modulus);
+    }
+    printf(";\n");
+    printf("    x := (x + r) mod 1000; y := (y + x) mod 1000; z := (z * 7 + y) mod 1000;\n");
+    printf("    i := i + 1\n");
+    printf("  end;\n");
+    printf("  write x\n");
+    printf("end.\n");
+}
+
+// Loops: size iterations of an outer loop around an inner loop of 100 iterations, doing arithmetic, comparisons
+// and a branch on every pass (size is at most 99999, the longest number a PL/0 program may hold).
+void generateLoops(int size)
+{
+    printf("var i, j, s, t;\n");
+    printf("begin\n");
+    printf("  i := 0; s := 0; t := 0;\n");
+    printf("  while i < %d do\n", size);
+    printf("  begin\n");
+    printf("    j := 0;\n");
+    printf("    while j < 100 do\n");
+    printf("    begin\n");
+    printf("      s := (s + i * j + %d) mod 10007;\n", 1 + randomBelow(99));
+    printf("      if s > t then t := s else t := t - 1 fi;\n");
+    printf("      j := j + 1\n");
+    printf("    end;\n");
+    printf("    i := i + 1\n");
+    printf("  end;\n");
+    printf("  write s;\n");
+    printf("  write t\n");
+    printf("end.\n");
+}
+
+// Recursion: the recursive Fibonacci of size (passed in globals, with a local to keep the first result), computed
+// 10 times. The calls go size frames deep.
+void generateRecursion(int size)
+{
+    printf("var n, r, k, s;\n");
+    printf("procedure fib;\n");
+    printf("  var a;\n");
+    printf("begin\n");
+    printf("  if n < 2 then\n");
+    printf("    r := n\n");
+    printf("  else\n");
+    printf("  begin\n");
+    printf("    n := n - 1; call fib; a := r;\n");
+    printf("    n := n - 1; call fib; r := (r + a) mod 10007;\n");
+    printf("    n := n + 2\n");
+    printf("  end\n");
+    printf("  fi\n");
+    printf("end;\n");
+    printf("begin\n");
+    printf("  k := 0; s := 0;\n");
+    printf("  while k < 10 do\n");
+    printf("  begin\n");
+    printf("    n := %d; call fib;\n", size);
+    printf("    s := (s + r) mod 10007;\n");
+    printf("    k := k + 1\n");
+    printf("  end;\n");
+    printf("  write s\n");
+    printf("end.\n");
+}
+
+// Generates a PL/0 program. Usage: plgen <kind> <size> [seed]
+int main(int argc, char *argv[])
+{
+    if (argc < 3 || atoi(argv[2]) <= 0)
+    {
+        printf("Usage: %s symbols|nested|procedures|expressions|loops|recursion <size> [seed]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 3)
+        seed = (unsigned int)strtoul(argv[3], NULL, 10);
+
+    int size = atoi(argv[2]);
+    if (strcmp(argv[1], "symbols") == 0)
+        generateSymbols(size);
+    else if (strcmp(argv[1], "nested") == 0)
+        generateNested(size);
+    else if (strcmp(argv[1], "procedures") == 0)
+        generateProcedures(size);
+    else if (strcmp(argv[1], "expressions") == 0)
+        generateExpressions(size);
+    else if (strcmp(argv[1], "loops") == 0)
+        generateLoops(size);
+    else if (strcmp(argv[1], "recursion") == 0)
+        generateRecursion(size);
+    else
+    {
+        printf("Unknown program kind: %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Measures the profiler's overhead: the threaded engine with and without --profile on bench/loop_input.txt,
+# bench/recursive_input.txt and bench/helpers_input.txt (--quiet), and shows the procedure table of each profile.
+# Usage (from "HW 4"): sh bench/profile.sh [runs]
+
+RUNS=${1:-3}
+COMPILER=./bench/hw4compiler_bench
+VM=./bench/vm_bench
+
+gcc -std=c17 -Wall -O2 -o "$COMPILER" hw4compiler.c || exit 1
+gcc -std=c17 -Wall -O2 -o "$VM" vm.c || exit 1
+
+for name in loop recursive helpers
+do
+    # Binary elf files carry the procedure names (the compiler writes elf.bin in the current directory)
+    "$COMPILER" --format=binary bench/${name}_input.txt > /dev/null && mv elf.bin bench/${name}_profile.bin &&
+        mv elf.bin.lines bench/${name}_profile.bin.lines
+
+    for options in "" "--profile=bench/${name}_profile.txt"
+    do
+        start=$(date +%s%N)
+        i=0
+        while [ $i -lt "$RUNS" ]
+        do
+            "$VM" --engine=threaded --quiet $options bench/${name}_profile.bin > /dev/null
+            i=$((i + 1))
+        done
+        end=$(date +%s%N)
+        echo "$name threaded ${options%%=*}: $(( (end - start) / RUNS / 1000 )) us/run"
+    done
+    sed -n '/^Procedures:/,$p' bench/${name}_profile.txt
+done
+
+rm -f "$COMPILER" "$VM" bench/*_profile.bin bench/*_profile.bin.lines bench/*_profile.txt
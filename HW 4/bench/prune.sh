@@ -0,0 +1,53 @@
+#!/bin/sh
+# Compares the code generated with and without --prune (and --peephole) on generated programs whose
+# procedures are never called (plgen symbols) and on the benchmark programs: instructions, binary elf size
+# and VM load + run time. Both builds must print the same.
+# Usage (from "HW 4"): sh bench/prune.sh [runs]
+
+RUNS=${1:-5}
+GEN=./bench/plgen_bench
+COMPILER=./bench/hw4compiler_bench
+VM=./bench/vm_bench
+
+gcc -std=c17 -Wall -O2 -o "$GEN" bench/plgen.c || exit 1
+gcc -std=c17 -Wall -O2 -o "$COMPILER" hw4compiler.c || exit 1
+gcc -std=c17 -Wall -O2 -o "$VM" vm.c || exit 1
+
+for size in 1000 4000 16000
+do
+    "$GEN" symbols $size > bench/prune_symbols$size.txt
+done
+
+for program in bench/prune_symbols1000.txt bench/prune_symbols4000.txt bench/prune_symbols16000.txt \
+               bench/loop_input.txt bench/recursive_input.txt
+do
+    for options in "" "--prune" "--peephole --prune"
+    do
+        "$COMPILER" $options "$program" > /dev/null || exit 1
+        instructions=$(wc -l < elf.txt)
+        "$COMPILER" --format=binary $options "$program" > /dev/null || exit 1
+        mv elf.bin bench/prune.bin
+        $VM --quiet --stack=20000 bench/prune.bin > bench/prune.out 2>&1
+        if [ -z "$options" ]
+        then
+            mv bench/prune.out bench/expected.out
+        elif ! cmp -s bench/expected.out bench/prune.out
+        then
+            echo "MISMATCH: $program $options"
+        fi
+
+        start=$(date +%s%N)
+        i=0
+        while [ $i -lt "$RUNS" ]
+        do
+            $VM --quiet --stack=20000 bench/prune.bin > /dev/null 2>&1
+            i=$((i + 1))
+        done
+        end=$(date +%s%N)
+        bytes=$(wc -c < bench/prune.bin)
+        echo "$(basename "$program") ${options:-(none)}: $instructions instructions, $bytes bytes," \
+             "$(( (end - start) / RUNS / 1000 )) us/run"
+    done
+done
+
+rm -f "$GEN" "$COMPILER" "$VM" elf.txt elf.txt.lines elf.bin.lines bench/prune_symbols*.txt bench/prune.bin bench/prune.out bench/expected.out
@@ -0,0 +1,49 @@
+#!/bin/sh
+# Compares the stack P-code with its register form on bench/loop_input.txt and bench/recursive_input.txt:
+# instructions per statement (compiler report), dispatches and PAS reads/writes per run (-DVM_STATS build),
+# and run time of the threaded engine against the register engine (--quiet).
+# Usage (from "HW 4"): sh bench/registers.sh [runs]
+
+RUNS=${1:-3}
+COMPILER=./bench/hw4compiler_bench
+VM=./bench/vm_bench
+STATS=./bench/vm_stats
+
+gcc -std=c17 -Wall -O2 -o "$COMPILER" hw4compiler.c || exit 1
+gcc -std=c17 -Wall -O2 -o "$VM" vm.c || exit 1
+gcc -std=c17 -Wall -O2 -DVM_STATS -o "$STATS" vm.c || exit 1
+
+for name in loop recursive
+do
+    # Both forms of the same program (the compiler writes elf.txt/elf.reg in the current directory)
+    "$COMPILER" bench/${name}_input.txt > /dev/null && mv elf.txt bench/${name}_stack_elf.txt
+    "$COMPILER" --format=register bench/${name}_input.txt | grep "^Register form:" && mv elf.reg bench/${name}.reg
+
+    # The register form must print the same thing
+    "$VM" --quiet bench/${name}_stack_elf.txt > bench/stack.out
+    "$VM" bench/${name}.reg > bench/register.out
+    if ! cmp -s bench/stack.out bench/register.out
+    then
+        echo "MISMATCH: bench/${name}_input.txt"
+        exit 1
+    fi
+
+    echo "bench/${name}_input.txt stack:    $("$STATS" --quiet bench/${name}_stack_elf.txt 2>&1 > /dev/null)"
+    echo "bench/${name}_input.txt register: $("$STATS" bench/${name}.reg 2>&1 > /dev/null)"
+
+    for run in "--engine=threaded bench/${name}_stack_elf.txt" "bench/${name}.reg"
+    do
+        start=$(date +%s%N)
+        i=0
+        while [ $i -lt "$RUNS" ]
+        do
+            "$VM" --quiet $run > /dev/null
+            i=$((i + 1))
+        done
+        end=$(date +%s%N)
+        echo "$run: $(( (end - start) / RUNS / 1000 )) us/run"
+    done
+done
+
+rm -f "$COMPILER" "$VM" "$STATS" elf.txt.lines bench/loop_stack_elf.txt bench/recursive_stack_elf.txt bench/loop.reg \
+      bench/recursive.reg bench/stack.out bench/register.out
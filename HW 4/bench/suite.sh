@@ -0,0 +1,123 @@
+#!/bin/sh
+# Benchmark suite: generates PL/0 programs of every kind with bench/plgen.c (many identifiers, deep nesting, many
+# procedures, long expressions, tight loops, recursion) and times each stage on its own: lexing and parsing/code
+# generation (from the compiler's --timing report) on large programs, then execution on every VM engine.
+# Reports lexemes/s, instructions generated/s and instructions executed/s (counted with the VM's --profile).
+# Pass another "HW 4" directory (e.g. a git worktree of an older commit) to time its build on the same programs;
+# a compiler without --timing only gets its total compile time.
+# Usage (from "HW 4"): sh bench/suite.sh [runs] [other_directory]
+
+RUNS=${1:-3}
+OTHER=$2
+GEN=./bench/plgen_suite
+STACK=--stack=100000
+
+# Large programs for the compiler, and programs that run for a while for the VM
+COMPILE_WORKLOADS="symbols:20000 nested:200 procedures:2000 expressions:4000"
+RUN_WORKLOADS="nested:16 procedures:200 expressions:200 loops:2000 recursion:20"
+
+# Builds: this directory, and the other one if given
+gcc -std=c17 -Wall -O2 -o "$GEN" bench/plgen.c || exit 1
+gcc -std=c17 -Wall -O2 -o bench/hw4_this hw4compiler.c || exit 1
+gcc -std=c17 -Wall -O2 -o bench/vm_this vm.c || exit 1
+BUILDS=this
+if [ -n "$OTHER" ]
+then
+    gcc -std=c17 -O2 -I"$OTHER" -o bench/hw4_other "$OTHER/hw4compiler.c" || exit 1
+    gcc -std=c17 -O2 -I"$OTHER" -o bench/vm_other "$OTHER/vm.c" || exit 1
+    BUILDS="this other"
+fi
+
+# The compilers write elf.txt into the working directory, so run them from bench/
+cd bench
+
+echo "Compiler (us per run, averaged over $RUNS runs)"
+printf "%-8s %-18s %9s %9s %12s %9s %9s %12s %9s\n" \
+    build program lexemes "lex us" lexemes/s instrs "parse us" instrs/s "total us"
+for workload in $COMPILE_WORKLOADS
+do
+    kind=${workload%%:*}
+    size=${workload##*:}
+    "../$GEN" $kind $size > suite_input.txt
+
+    for build in $BUILDS
+    do
+        compiler=./hw4_$build
+        lexemes=0 lex=0 parse=0 instructions=0 timed=1
+        start=$(date +%s%N)
+        i=0
+        while [ $i -lt "$RUNS" ]
+        do
+            report=$("$compiler" --timing suite_input.txt 2>&1 > /dev/null | grep '^Timing:')
+            if [ -z "$report" ]
+            then
+                timed=0
+                "$compiler" suite_input.txt > /dev/null
+            else
+                set -- $(echo "$report" |
+                    sed 's/.*lex \([0-9]*\) us (\([0-9]*\) lexemes), parse \([0-9]*\) us (\([0-9]*\) instr.*/\1 \2 \3 \4/')
+                lex=$((lex + $1))
+                lexemes=$2
+                parse=$((parse + $3))
+                instructions=$4
+            fi
+            i=$((i + 1))
+        done
+        end=$(date +%s%N)
+        total=$(( (end - start) / RUNS / 1000 ))
+
+        if [ $timed -eq 1 ]
+        then
+            lex=$((lex / RUNS))
+            parse=$((parse / RUNS))
+            printf "%-8s %-18s %9d %9d %12.0f %9d %9d %12.0f %9d\n" $build "$kind $size" $lexemes $lex \
+                $(awk "BEGIN { print $lexemes * 1000000 / ($lex ? $lex : 1) }") $instructions $parse \
+                $(awk "BEGIN { print $instructions * 1000000 / ($parse ? $parse : 1) }") $total
+        else
+            printf "%-8s %-18s %9s %9s %12s %9s %9s %12s %9d\n" $build "$kind $size" - - - - - - $total
+        fi
+    done
+done
+
+echo
+echo "VM (us per run, averaged over $RUNS runs)"
+printf "%-8s %-18s %-9s %12s %12s %14s %s\n" build program engine instrs "run us" instrs/s output
+for workload in $RUN_WORKLOADS
+do
+    kind=${workload%%:*}
+    size=${workload##*:}
+    "../$GEN" $kind $size > suite_input.txt
+
+    for build in $BUILDS
+    do
+        if ! "./hw4_$build" suite_input.txt > /dev/null
+        then
+            echo "$build $kind $size: compile failed"
+            continue
+        fi
+
+        # Instructions executed, counted once by this build's profiler (the same for every engine)
+        ./vm_this --quiet $STACK --profile=suite_profile.txt elf.txt > /dev/null
+        executed=$(awk 'NR == 1 { print $4 }' suite_profile.txt)
+
+        for engine in switch threaded jit register
+        do
+            output=$("./vm_$build" --engine=$engine --quiet $STACK elf.txt | tr '\n' ' ')
+            start=$(date +%s%N)
+            i=0
+            while [ $i -lt "$RUNS" ]
+            do
+                "./vm_$build" --engine=$engine --quiet $STACK elf.txt > /dev/null
+                i=$((i + 1))
+            done
+            end=$(date +%s%N)
+            us=$(( (end - start) / RUNS / 1000 ))
+            printf "%-8s %-18s %-9s %12d %12d %14.0f %s\n" $build "$kind $size" $engine $executed $us \
+                $(awk "BEGIN { print $executed * 1000000 / ($us ? $us : 1) }") "$output"
+        done
+    done
+done
+
+rm -f suite_input.txt suite_profile.txt elf.txt elf.txt.lines hw4_this vm_this hw4_other vm_other
+cd ..
+rm -f "$GEN"
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Times the compiler on generated programs with many identifiers (symbol table lookups and scope pops).
+# Pass the source of another compiler (e.g. an older hw4compiler.c) to time it on the same programs
+# and check that both produce the same elf.
+# Usage (from "HW 4"): sh bench/symbols.sh [runs] [other_compiler.c]
+
+RUNS=${1:-10}
+OTHER=$2
+GEN=./bench/plgen_bench
+COMPILER=./bench/hw4_bench
+OTHER_COMPILER=./bench/other_bench
+
+gcc -std=c17 -Wall -O2 -o "$GEN" bench/plgen.c || exit 1
+gcc -std=c17 -Wall -O2 -o "$COMPILER" hw4compiler.c || exit 1
+if [ -n "$OTHER" ]
+then
+    gcc -std=c17 -O2 -I. -o "$OTHER_COMPILER" "$OTHER" || exit 1
+fi
+
+# The compilers write elf.txt into the working directory, so run them from bench/
+cd bench
+for size in 100 200 400 800 1000
+do
+    "./$(basename "$GEN")" symbols $size > symbols_input.txt
+
+    for compiler in "$COMPILER" ${OTHER:+"$OTHER_COMPILER"}
+    do
+        name=$(basename "$compiler")
+        if ! "../$compiler" symbols_input.txt > /dev/null
+        then
+            echo "size $size $name: failed"
+            continue
+        fi
+        cp elf.txt "$name.elf"
+
+        start=$(date +%s%N)
+        i=0
+        while [ $i -lt "$RUNS" ]
+        do
+            "../$compiler" symbols_input.txt > /dev/null
+            i=$((i + 1))
+        done
+        end=$(date +%s%N)
+        echo "size $size $name: $(( (end - start) / RUNS / 1000 )) us/run"
+    done
+
+    if [ -n "$OTHER" ] && [ -f other_bench.elf ] && ! cmp -s hw4_bench.elf other_bench.elf
+    then
+        echo "MISMATCH at size $size"
+    fi
+    rm -f hw4_bench.elf other_bench.elf
+done
+
+rm -f symbols_input.txt elf.txt elf.txt.lines
+cd ..
+rm -f "$GEN" "$COMPILER" "$OTHER_COMPILER"
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Compares bench/tail_input.txt (tail recursion 10000 calls deep) compiled without and with --tail-calls: the stack
+# each build needs (the default 500 words, then the smallest power of two it runs in) and the run time on every VM
+# engine. Both builds must print the same.
+# Usage (from "HW 4"): sh bench/tailcall.sh [runs]
+
+RUNS=${1:-3}
+COMPILER=./bench/hw4compiler_bench
+VM=./bench/vm_bench
+STACK=--stack=1000000
+
+gcc -std=c17 -Wall -O2 -o "$COMPILER" hw4compiler.c || exit 1
+gcc -std=c17 -Wall -O2 -o "$VM" vm.c || exit 1
+
+# Compile both builds (the compiler always writes elf.txt in the current directory)
+"$COMPILER" bench/tail_input.txt > /dev/null && mv elf.txt bench/tail_plain_elf.txt || exit 1
+"$COMPILER" --tail-calls bench/tail_input.txt | grep "^Tail calls:" && mv elf.txt bench/tail_calls_elf.txt || exit 1
+
+"$VM" --quiet $STACK bench/tail_plain_elf.txt > bench/plain.out
+"$VM" --quiet $STACK bench/tail_calls_elf.txt > bench/tail.out
+if ! cmp -s bench/plain.out bench/tail.out
+then
+    echo "MISMATCH between the builds"
+    exit 1
+fi
+
+for build in plain calls
+do
+    # Smallest stack (the default, doubled until it's enough) that runs the program
+    words=500
+    while [ $words -lt 100000000 ] && "$VM" --quiet --stack=$words bench/tail_${build}_elf.txt 2>&1 |
+          grep -q "Stack overflow"
+    do
+        words=$((words * 2))
+    done
+    echo "tail $build: runs with --stack=$words"
+
+    for engine in switch threaded jit register
+    do
+        start=$(date +%s%N)
+        i=0
+        while [ $i -lt "$RUNS" ]
+        do
+            "$VM" --engine=$engine --quiet $STACK bench/tail_${build}_elf.txt > /dev/null
+            i=$((i + 1))
+        done
+        end=$(date +%s%N)
+        echo "tail $build $engine: $(( (end - start) / RUNS / 1000 )) us/run"
+    done
+done
+
+rm -f "$COMPILER" "$VM" elf.txt.lines bench/tail_plain_elf.txt bench/tail_calls_elf.txt bench/plain.out bench/tail.out
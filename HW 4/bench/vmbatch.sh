@@ -0,0 +1,73 @@
+#!/bin/sh
+# Times running many (program, input) jobs: one VM process per job, then --batch on one thread and on every core.
+# Checks that every job prints the same output in the batch as in its own process.
+# Usage (from "HW 4"): sh bench/vmbatch.sh [jobs] [engine]
+
+JOBS=${1:-2000}
+ENGINE=${2:-threaded}
+GEN=./bench/plgen_vmbatch
+COMPILER=./bench/hw4_vmbatch
+VM=./bench/vm_vmbatch
+DIR=bench/vmbatch_work
+STACK=--stack=100000
+
+gcc -std=c17 -Wall -O2 -o "$GEN" bench/plgen.c || exit 1
+gcc -std=c17 -Wall -O2 -pthread -o "$COMPILER" hw4compiler.c || exit 1
+gcc -std=c17 -Wall -O2 -pthread -o "$VM" vm.c || exit 1
+
+# Short programs of every kind, plus the test programs that read values
+rm -rf "$DIR"
+mkdir -p "$DIR/src"
+i=0
+for kind in symbols nested procedures expressions loops recursion
+do
+    for size in 1 2 3
+    do
+        "$GEN" $kind $size $i > "$DIR/src/${kind}_${size}.pl0"
+        i=$((i + 1))
+    done
+done
+cp test*_input.txt "$DIR/src/"
+ls "$DIR"/src/* > "$DIR/sources.txt"
+"$COMPILER" --batch="$DIR/sources.txt" --out-dir="$DIR" > /dev/null 2>&1
+ls "$DIR"/*.elf.txt > "$DIR/programs.txt"
+programs=$(wc -l < "$DIR/programs.txt")
+
+# Jobs cycle through the programs, each with its own input values
+i=0
+: > "$DIR/jobs.txt"
+while [ $i -lt "$JOBS" ]
+do
+    printf '%d\n%d\n%d\n%d\n' $i $((i % 7)) $((i % 13)) 3 > "$DIR/input_$i.txt"
+    echo "$(sed -n "$((i % programs + 1))p" "$DIR/programs.txt") $DIR/input_$i.txt" >> "$DIR/jobs.txt"
+    i=$((i + 1))
+done
+
+# One process per job
+start=$(date +%s%N)
+: > "$DIR/single.txt"
+i=1
+while read -r program input
+do
+    echo "Job $i: $program $input" >> "$DIR/single.txt"
+    "$VM" --engine=$ENGINE --quiet $STACK "$program" < "$input" >> "$DIR/single.txt" 2>&1
+    i=$((i + 1))
+done < "$DIR/jobs.txt"
+end=$(date +%s%N)
+echo "$JOBS jobs, one process each: $(( (end - start) / 1000000 )) ms"
+
+for jobs in 1 $(nproc)
+do
+    "$VM" --engine=$ENGINE $STACK --batch="$DIR/jobs.txt" --jobs=$jobs > "$DIR/batch.txt"
+    tail -n 1 "$DIR/batch.txt"
+done
+
+# Same outputs
+if sed '$d' "$DIR/batch.txt" | cmp -s - "$DIR/single.txt"
+then
+    echo "Batch outputs match one process per job"
+else
+    echo "MISMATCH between the batch and one process per job"
+fi
+
+rm -rf "$DIR" "$GEN" "$COMPILER" "$VM"
@@ -6,42 +6,63 @@
  * Description: Implements a PL/0 Compiler. Generates P-code instructions. Extended from HW 3.
  */
 
+#define _DEFAULT_SOURCE // mmap
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pcode.h"
+#include "regcode.h"
 
-#define MAX_LEXEMES 10000   // From lex.c
 #define MAX_ID_LENGTH 11    // From lex.c
 #define MAX_NUM_LENGTH 5    // From lex.c
 #define MAX_LEXEME_LENGTH 64 // From lex.c
-#define MAX_INSTRUCTIONS 9999
-#define MAX_SYMBOLS 500
+#define MAX_INSTRUCTIONS ((INT_MAX - 10) / 3) // Largest program whose code addresses fit in 32 bits
+#define INLINE_LIMIT 16 // Default --inline threshold: largest procedure body (instructions) copied into callers
+
+// Output formats
+#define FORMAT_TEXT 0     // elf.txt: "op l m" per line
+#define FORMAT_BINARY 1   // elf.bin: see pcode.h
+#define FORMAT_REGISTER 2 // elf.reg: register code, see regcode.h
 
 // P-code opcodes
 #define LIT 1    // Load literal
 #define OPR 2  // Arithmetic and logical operations
 #define LOD 3    // Load variable
 #define STO 4    // Store variable
+#define CAL 5    // Call procedure
 #define INC 6    // Allocate memory
 #define JMP 7    // Jump
 #define JPC 8    // Jump conditional
 #define SYS 9    // System call (HALT)
 
-// Arithmetic/Comparison operations
-#define ADD 2   // Addition
-#define SUB 3   // Subtraction
-#define MUL 4   // Multiplication
-#define DIV 5   // Division
-#define OPR_MOD 7  // Modulus
-#define MOD OPR_MOD
-#define ODD 6   // Odd test
-#define EQL 8   // Equals
-#define NEQ 9   // Not equals
-#define LSS 10  // Less than
-#define LEQ 11  // Less than or equal
-#define GTR 12  // Greater than
-#define GEQ 13  // Greater than or equal
+// Arithmetic/Comparison operations (M field of OPR, as implemented by vm.c)
+#define RTN 0   // Return
+#define ADD 1   // Addition
+#define SUB 2   // Subtraction
+#define MUL 3   // Multiplication
+#define DIV 4   // Division
+#define EQL 5   // Equals
+#define NEQ 6   // Not equals
+#define LSS 7   // Less than
+#define LEQ 8   // Less than or equal
+#define GTR 9   // Greater than
+#define GEQ 10  // Greater than or equal
+#define MOD 11  // Modulus
 
 // Data structures
 
@@ -53,77 +74,165 @@ typedef enum {
     dosym = 26, callsym = 27, constsym = 28, varsym = 29, procsym = 30, writesym = 31, readsym = 32, elsesym = 33, oddsym = 34
 } tokenType; 
 
-// Reserved words
-typedef struct {
-    char *name;
-    tokenType token;
-} ReservedWord;
-
-// List of reserved words
-ReservedWord reservedWords[] = 
-{
-    {"const", constsym}, {"var", varsym}, {"begin", beginsym}, {"end", endsym}, 
-    {"if", ifsym}, {"fi", fisym}, {"then", thensym}, {"else", elsesym}, 
-    {"while", whilesym}, {"do", dosym}, {"read", readsym}, {"write", writesym}, 
-    {"mod", modsym}, {"procedure", procsym},  {"call", callsym}
-}; 
-
 // Lexeme entry
 typedef struct {
-    char lexeme[MAX_LEXEME_LENGTH];
-    int token;
-    char errorMsg[MAX_LEXEME_LENGTH];
-    int isError;
+    int token;  // Token type (0 = invalid lexeme, see LexError)
+    int offset; // Start of the lexeme in the source buffer
+    int length; // Length of the lexeme
+    int line;   // Line where the lexeme starts
+    int column; // Column where the lexeme starts
 } LexemeEntry;
 
+// Error message of an invalid lexeme
+typedef struct {
+    int lexeme;                      // Index of the invalid lexeme
+    char message[MAX_LEXEME_LENGTH]; // Error message
+} LexError;
+
 
 // Instruction
 typedef struct {
     int op;  // Opcode
     int l;   // Level
     int m;   // Modifier (address, value, etc.)
+    int line; // Source line it was compiled from (for the line table)
 } Instruction;
 
 
 // Symbol table
 typedef struct {
     int kind;      // 1 = const, 2 = var, 3 = procedure
-    char name[MAX_LEXEME_LENGTH]; 
+    const char *name; // Interned name (see InternEntry)
     int value;     // For constants
     int level;     // Scope level
     int address;   // Memory location
     int mark;      // 0 if active, 1 if marked for deletion
+    int nameId;    // Index of the name in the intern table
+    int shadowed;  // Symbol with the same name that this one hides, -1 if none
+    int scopeNext; // Previous symbol declared in the same scope, -1 if none
 } SymbolEntry;
 
-// Initializations for Global Variables
-int currentLevel = 0;
+// Interned identifier: every distinct name is stored once and bound to its innermost active symbol
+typedef struct {
+    const char *text;  // Name (NULL = empty slot)
+    unsigned int hash; // Hash of the name
+    int symbol;        // Innermost active symbol with this name, -1 if none
+} InternEntry;
+
+// Initializations for Global Variables. The state of a compilation is thread-local, so every worker thread of a
+// batch (--batch) compiles with its own copy; the options below it are shared.
+_Thread_local int currentLevel = 0;
 
 // Token list 
-int tokenIndex = 0;
-tokenType currentToken;
+_Thread_local int tokenIndex = 0;
+_Thread_local tokenType currentToken;
 
-// Number of reserved words
-int numReservedWords = sizeof(reservedWords) / sizeof(ReservedWord); 
+// Source program (memory-mapped, or read into a buffer)
+_Thread_local const char *source = NULL;
+_Thread_local size_t sourceLength = 0;
+_Thread_local int sourceMapped = 0; // 1 if source is a file mapping, 0 if it was read into a buffer
 
-// Lexeme list
-LexemeEntry lexemes[MAX_LEXEMES];
-int lexCount = 0;
+// Lexeme list (grows as needed)
+_Thread_local LexemeEntry *lexemes = NULL;
+_Thread_local int lexCount = 0, lexCapacity = 0;
 
-// Symbol table
-SymbolEntry symbolTable[MAX_SYMBOLS];
-int symbolCount = 0;
+// Lexical errors, in lexeme order
+_Thread_local LexError *lexErrors = NULL;
+_Thread_local int errorCount = 0, errorCapacity = 0;
+
+// Symbol table (grows as needed)
+_Thread_local SymbolEntry *symbolTable = NULL;
+_Thread_local int symbolCount = 0, symbolCapacity = 0;
+
+// Intern table: open addressing, capacity is a power of two kept at most half full
+_Thread_local InternEntry *internTable = NULL;
+_Thread_local int internCount = 0, internCapacity = 0;
+
+// Most recent symbol declared in each scope (indexed by level), -1 if none
+_Thread_local int *scopeHeads = NULL;
+_Thread_local int scopeCapacity = 0;
 
 // P-code instructions
-Instruction instructions[MAX_INSTRUCTIONS];
-int instructionCount = 0;
+_Thread_local Instruction *instructions = NULL;
+_Thread_local int instructionCount = 0, instructionCapacity = 0;
+
+// Optimization passes (enabled from the command line) and their reports
+int fuseEnabled = 0, foldEnabled = 0, peepholeEnabled = 0, pruneEnabled = 0, tailCallsEnabled = 0;
+int inlineLimit = 0; // Largest procedure body that --inline copies into its callers (see INLINE_LIMIT), 0 = off
+_Thread_local int fusedSequences = 0, fusedDispatches = 0, fusedRemoved = 0;
+_Thread_local int peepholeRemoved = 0, peepholeRetargeted = 0, peepholeReturns = 0;
+_Thread_local int prunedProcedures = 0, prunedInstructions = 0;
+_Thread_local int *inlinedCalls = NULL; // Call sites inlined for each symbol (indexed like symbolTable)
+_Thread_local int inlinedSites = 0, inlinedLocals = 0;
+_Thread_local int foldedOperations = 0, foldedBranches = 0;
+_Thread_local int tailCalls = 0;
+_Thread_local int statementCount = 0; // Simple statements compiled (for the register form report)
+_Thread_local int registerCount = -1; // Instructions of the register form, -1 if it wasn't generated
+
+// Time spent in each stage, with --timing (microseconds)
+int timingEnabled = 0;
+
+// Write the source line table next to the elf (on by default, --no-lines turns it off)
+int linesEnabled = 1;
+_Thread_local struct timespec stageStart;
+_Thread_local long long readTime = 0, lexTime = 0, parseTime = 0, optimizeTime = 0, outputTime = 0;
+
+// Output of a compilation: the listing (stdout, a batch job's listing file, or NULL for none) and how an error
+// ends it (exit, or a jump back to the batch job when set)
+_Thread_local FILE *listing = NULL;
+_Thread_local jmp_buf *errorExit = NULL;
+_Thread_local char errorMessage[128];
+
+// Batch mode (--batch): inputs, their results and the worker threads
+typedef struct {
+    const char *input;   // Source file
+    int ok;              // 1 if it compiled
+    int lexemes;         // Lexemes and instructions, for the throughput report
+    int instructions;
+    char message[128];   // Error that stopped it
+} BatchJob;
+const char *outputDirectory = NULL; // Where batch outputs go (default: next to each input)
+int listingEnabled = 0;             // Batch mode writes each job's listing next to its elf
+BatchJob *batchJobs = NULL;
+int batchCount = 0, batchCapacity = 0;
+atomic_int batchNext = 0;           // Next job to hand out
+int outputFormat = FORMAT_TEXT;
+
+// Compilation cache (--cache=DIR): one entry file per compiled source, named after a hash of the source bytes, the
+// compiler build and the options, that holds the listing, the elf and its line table. Entries are written to a
+// temporary file and renamed into place, so processes sharing the directory only ever see whole entries.
+#define CACHE_MAGIC "PL0C"
+#define CACHE_VERSION 1
+#define CACHE_BUILD __DATE__ " " __TIME__ // Entries of another build of the compiler never match
+#define CACHE_SIZE_LIMIT 64               // Default bound on the cache directory, in MiB (--cache-size=N)
+typedef struct {
+    char magic[4];          // CACHE_MAGIC
+    uint32_t version;       // CACHE_VERSION
+    uint64_t sourceLength;  // Length of the source it was compiled from
+    uint32_t listingLength; // Then the listing, the elf and the line table (0 = none), in this order
+    uint32_t elfLength;
+    uint32_t linesLength;
+    uint32_t lexemes;       // Lexemes and instructions, for the batch report
+    uint32_t instructions;
+} CacheHeader;
+const char *cacheDirectory = NULL;
+long long cacheLimit = (long long)CACHE_SIZE_LIMIT << 20;
+long long cacheBytes = -1;          // Size of the cache directory as far as this process knows, -1 = not scanned
+pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER; // Guards cacheBytes and eviction
+atomic_int cacheHits = 0;
+_Thread_local char *capturedListing = NULL; // Listing of a compilation that goes into the cache
+_Thread_local size_t capturedLength = 0, capturedCapacity = 0;
+_Thread_local int capturing = 0;
 
 // Function Prototypes
 
 // Lexical Analyzer function prototypes -> From lex.c
-tokenType getToken(char *lexeme);
-void addToken(int token, const char *lexeme);
-void addErrorToken(const char *lexeme, const char *errMsg);
-void lexicalAnalyzer(FILE *input);
+tokenType getToken(const char *text, int length);
+int loadSource(const char *fileName);
+void addToken(int token, int offset, int length, int line, int column);
+void addErrorToken(int offset, int length, int line, int column, const char *errMsg);
+char *lexemeText(int index);
+void lexicalAnalyzer();
 
 // Tiny PL/0 Compiler
 void getNextToken();
@@ -137,20 +246,111 @@ void term();
 void factor();
 void condition();
 void emit(int op, int l, int m);
+void emitOperation(int op, int leftIdx, int rightIdx);
+int foldCondition(int condIdx);
 int symbolTableCheck(char *name);
+void addSymbol(int kind, const char *name, int value, int level, int address);
+void popScope(int level);
 void printAssemblyCode();
 void printSymbolTable();
 void error(const char *msg);
 const char* getKindName(int kind);
+int instructionLength(int op);
+void markJumpTargets(char *isTarget);
+void relocateCode(Instruction *newCode, int newCount, const int *newIndex);
+void fuseInstructions();
+int jumpDestination(int index);
+int peepholePass(char *isTarget, int *newIndex, Instruction *newCode);
+void peepholeInstructions();
+void pruneInstructions();
+int procedureBody(int entry, int *bodyStart, int *bodyEnd);
+int callsItself(int symbol, const int *procedureAt, const int *bodyStart, const int *bodyEnd);
+int inlinePass(int budget);
+void inlineProcedures();
+void tailCallInstructions();
+void printOptimizationReport();
+void writeTextElf(const char *fileName);
+void writeBinaryElf(const char *fileName);
+void writeRegisterElf(const char *fileName);
+int *packInstructions();
+void writeLineTable(const char *elfName, const char *sourceName);
+
+// Helper function that makes room for at least needed more bytes of captured listing. Returns 0 when out of memory.
+int growCapture(size_t needed)
+{
+    if (capturedLength + needed <= capturedCapacity)
+        return 1;
+    size_t capacity = capturedCapacity ? capturedCapacity : 4096;
+    while (capturedLength + needed > capacity)
+        capacity *= 2;
+    char *grown = realloc(capturedListing, capacity);
+    if (!grown)
+        return 0;
+    capturedListing = grown;
+    capturedCapacity = capacity;
+    return 1;
+}
+
+// Helper function that prints to the listing (nothing if there is none), and keeps a copy for the cache. A copied
+// line is formatted once, into the copy, and written from there.
+void printListing(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    if (capturing && growCapture(256))
+    {
+        va_list copy;
+        va_copy(copy, args);
+        int length = vsnprintf(capturedListing + capturedLength, capturedCapacity - capturedLength, format, copy);
+        va_end(copy);
+        if (length >= 0 && (size_t)length >= capturedCapacity - capturedLength && growCapture((size_t)length + 1))
+        {
+            va_copy(copy, args);
+            vsnprintf(capturedListing + capturedLength, capturedCapacity - capturedLength, format, copy);
+            va_end(copy);
+        }
+        if (length >= 0 && (size_t)length < capturedCapacity - capturedLength)
+        {
+            if (listing)
+                fwrite(capturedListing + capturedLength, 1, length, listing);
+            capturedLength += length;
+            va_end(args);
+            return;
+        }
+    }
+    capturing = 0; // Out of memory (or never on): this compilation isn't cached
+    if (listing)
+        vfprintf(listing, format, args);
+    va_end(args);
+}
+
+// Helper function that ends the compilation unsuccessfully: exits, or in a batch job returns to the job
+void stopCompiling()
+{
+    if (errorExit)
+        longjmp(*errorExit, 1);
+    exit(1);
+}
+
+// Helper function that reports a failed file operation like perror (kept for the batch summary in batch mode),
+// and ends the compilation
+void fileError(const char *msg)
+{
+    snprintf(errorMessage, sizeof(errorMessage), "%s: %s", msg, strerror(errno));
+    if (!errorExit)
+        fprintf(stderr, "%s\n", errorMessage);
+    stopCompiling();
+}
 
 // Helper function that prints an error to the console
 void error(const char *msg) 
 {
     // Print error
-    printf("Error: %s\n", msg);
+    printListing("Error: %s\n", msg);
+    snprintf(errorMessage, sizeof(errorMessage), "%s", msg);
 
     // End program unsucessfully
-    exit(1);
+    stopCompiling();
 }
 
 // Helper function that prints an undeclared identifier error (special case) to the console. 
@@ -162,77 +362,192 @@ void undeclaredIdentifierError(char *name)
 }
 
 // Lexical Analyzer functions -> From lex.c
-tokenType getToken(char *lexeme) {
-    for (int i = 0; i < numReservedWords; i++) {
-        if (strcmp(lexeme, reservedWords[i].name) == 0)
-            return reservedWords[i].token;
+// Function that finds the token type of an identifier-like lexeme. Reserved words are matched by
+// length, then first character, then a single memcmp (no table scan).
+tokenType getToken(const char *text, int length)
+{
+    switch (length)
+    {
+    case 2:
+        switch (text[0])
+        {
+        case 'i':
+            return memcmp(text, "if", 2) == 0 ? ifsym : identsym;
+        case 'f':
+            return memcmp(text, "fi", 2) == 0 ? fisym : identsym;
+        case 'd':
+            return memcmp(text, "do", 2) == 0 ? dosym : identsym;
+        }
+        break;
+    case 3:
+        switch (text[0])
+        {
+        case 'v':
+            return memcmp(text, "var", 3) == 0 ? varsym : identsym;
+        case 'e':
+            return memcmp(text, "end", 3) == 0 ? endsym : identsym;
+        case 'm':
+            return memcmp(text, "mod", 3) == 0 ? modsym : identsym;
+        case 'o':
+            return memcmp(text, "odd", 3) == 0 ? oddsym : identsym;
+        }
+        break;
+    case 4:
+        switch (text[0])
+        {
+        case 't':
+            return memcmp(text, "then", 4) == 0 ? thensym : identsym;
+        case 'e':
+            return memcmp(text, "else", 4) == 0 ? elsesym : identsym;
+        case 'r':
+            return memcmp(text, "read", 4) == 0 ? readsym : identsym;
+        case 'c':
+            return memcmp(text, "call", 4) == 0 ? callsym : identsym;
+        }
+        break;
+    case 5:
+        switch (text[0])
+        {
+        case 'c':
+            return memcmp(text, "const", 5) == 0 ? constsym : identsym;
+        case 'b':
+            return memcmp(text, "begin", 5) == 0 ? beginsym : identsym;
+        case 'w':
+            if (memcmp(text, "while", 5) == 0)
+                return whilesym;
+            return memcmp(text, "write", 5) == 0 ? writesym : identsym;
+        }
+        break;
+    case 9:
+        return memcmp(text, "procedure", 9) == 0 ? procsym : identsym;
     }
     return identsym;
 }
 
-// Function that adds a lexeme (+ token type) to the lexeme table
-void addToken(int token, const char *lexeme)
+// Function that reads a whole source file into memory (memory-mapped when possible)
+int loadSource(const char *fileName)
 {
-    // Check for available space
-    if (lexCount < MAX_LEXEMES)
-    {
-        // Store the lexeme
-        strncpy(lexemes[lexCount].lexeme, lexeme, MAX_LEXEME_LENGTH - 1);
-        lexemes[lexCount].lexeme[MAX_LEXEME_LENGTH - 1] = '\0';
-        lexemes[lexCount].token = token; // Token type
-
-        // Indicate its a valid lexeme (no error flag/message)
-        lexemes[lexCount].errorMsg[0] = '\0';
-        lexemes[lexCount].isError = 0;
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+        return 0;
 
-        // Continue
-        lexCount++;
+    // Regular files are mapped in place
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        if (info.st_size > INT_MAX)
+        {
+            close(fd);
+            error("Source file too large");
+        }
+        void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED)
+        {
+            close(fd);
+            source = mapped;
+            sourceMapped = 1;
+            sourceLength = info.st_size;
+            return 1;
+        }
     }
-    else
+
+    // Anything else (pipes, empty files) is read in large blocks
+    char *buffer = NULL;
+    size_t capacity = 0, length = 0;
+    for (;;)
     {
-        fprintf(stderr, "Error: Lexeme buffer overflow.\n"); // Debugging - edge cases
-        exit(1);
+        if (length == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 65536;
+            if (capacity > INT_MAX || !(buffer = realloc(buffer, capacity)))
+            {
+                close(fd);
+                error("Source file too large");
+            }
+        }
+        ssize_t count = read(fd, buffer + length, capacity - length);
+        if (count < 0)
+        {
+            free(buffer);
+            close(fd);
+            return 0;
+        }
+        if (count == 0)
+            break;
+        length += count;
     }
+    close(fd);
+    source = buffer;
+    sourceLength = length;
+    sourceMapped = 0;
+    return 1;
 }
 
-// Function that adds an invalid lexeme and stores an error message for it
-void addErrorToken(const char *lexeme, const char *errMsg)
+// Function that adds a lexeme (+ token type) to the lexeme table. The lexeme stays in the source buffer.
+void addToken(int token, int offset, int length, int line, int column)
 {
-    // Check for available space
-    if (lexCount < MAX_LEXEMES)
+    // Grow the lexeme table as needed
+    if (lexCount == lexCapacity)
     {
-        // Store the invalid lexeme
-        strncpy(lexemes[lexCount].lexeme, lexeme, MAX_LEXEME_LENGTH - 1);
-        lexemes[lexCount].lexeme[MAX_LEXEME_LENGTH - 1] = '\0';
-        lexemes[lexCount].token = 0; // No valid token type
+        lexCapacity = lexCapacity ? 2 * lexCapacity : 4096;
+        lexemes = realloc(lexemes, lexCapacity * sizeof(LexemeEntry));
+        if (!lexemes)
+            error("Out of memory");
+    }
 
-        // Store error message
-        strncpy(lexemes[lexCount].errorMsg, errMsg, sizeof(lexemes[lexCount].errorMsg) - 1);
-        lexemes[lexCount].errorMsg[sizeof(lexemes[lexCount].errorMsg) - 1] = '\0';
-        lexemes[lexCount].isError = 1; // Invalid flag
+    LexemeEntry *lex = &lexemes[lexCount++];
+    lex->token = token;
+    lex->offset = offset;
+    lex->length = length;
+    lex->line = line;
+    lex->column = column;
+}
 
-        // Continue
-        lexCount++;
-    }
-    else
+// Function that adds an invalid lexeme (token 0) and stores its error message in the error table
+void addErrorToken(int offset, int length, int line, int column, const char *errMsg)
+{
+    // Grow the error table as needed
+    if (errorCount == errorCapacity)
     {
-        fprintf(stderr, "Error: Lexeme buffer overflow.\n"); // Debugging - edge cases
-        exit(1);
+        errorCapacity = errorCapacity ? 2 * errorCapacity : 64;
+        lexErrors = realloc(lexErrors, errorCapacity * sizeof(LexError));
+        if (!lexErrors)
+            error("Out of memory");
     }
+
+    // Store error message
+    lexErrors[errorCount].lexeme = lexCount;
+    strncpy(lexErrors[errorCount].message, errMsg, sizeof(lexErrors[errorCount].message) - 1);
+    lexErrors[errorCount].message[sizeof(lexErrors[errorCount].message) - 1] = '\0';
+    errorCount++;
+
+    addToken(0, offset, length, line, column); // No valid token type
+}
+
+// Function that returns the text of a lexeme as a string (valid until the next call)
+char *lexemeText(int index)
+{
+    static _Thread_local char text[MAX_LEXEME_LENGTH];
+    int length = lexemes[index].length < MAX_LEXEME_LENGTH ? lexemes[index].length : MAX_LEXEME_LENGTH - 1;
+    memcpy(text, source + lexemes[index].offset, length);
+    text[length] = '\0';
+    return text;
 }
 
-// Function that tokenizes a PL/0 file
-void lexicalAnalyzer(FILE *input)
+// Function that tokenizes the source buffer
+void lexicalAnalyzer()
 {
     // Initialize variables
-    char c, buffer[MAX_LEXEME_LENGTH];
-    int pos, line = 1, column = 1;
-    (void)line; // Ignore warnings for these 2
-    (void)column;
+    int i = 0, length = (int)sourceLength;
+    int line = 1, lineStart = 0;
 
-    // Read entire file char by char
-    while ((c = fgetc(input)) != EOF)
+    // Scan the entire buffer
+    while (i < length)
     {
+        unsigned char c = source[i];
+        int start = i++;
+        int column = start - lineStart + 1;
+
         // Skip whitespaces
         if (isspace(c))
         {
@@ -240,12 +555,7 @@ void lexicalAnalyzer(FILE *input)
             if (c == '\n')
             {
                 line++; // Move to next line
-                column = 1; // Reset column
-            }
-            // For spaces and tabs
-            else
-            {
-                column++; // Move to next col
+                lineStart = i; // Reset column
             }
 
             // Process next char
@@ -255,26 +565,27 @@ void lexicalAnalyzer(FILE *input)
         // Comment handling
         if (c == '/')
         {
-            int next = fgetc(input);
-            
             // Opening comment symbol /* found
-            if (next == '*')
+            if (i < length && source[i] == '*')
             {
-                int prev = 0, closed = 0;
+                int startLine = line, prev = 0, closed = 0;
 
                 // Now look for closing */ until found or end of file
-                while ((c = fgetc(input)) != EOF)
+                for (i++; i < length; i++)
                 {
+                    c = source[i];
+
                     // Newline -> same as earlier
                     if (c == '\n')
                     {
                         line++; // Go to next line
-                        column = 1; // Reset column
+                        lineStart = i + 1; // Reset column
                     }
                     // Proper closing comment symbol */ found
                     if (prev == '*' && c == '/')
                     {
                         closed = 1; // Mark as closed
+                        i++;
                         break;
                     }
                     prev = c;
@@ -284,16 +595,15 @@ void lexicalAnalyzer(FILE *input)
                 if (!closed)
                 {
                     // Treat as normal tokens
-                    addToken(slashsym, "/");
-                    addToken(multsym, "*");
+                    addToken(slashsym, start, 1, startLine, column);
+                    addToken(multsym, start + 1, 1, startLine, column + 1);
                 }
                 continue;
             }
             // Just a slash
             else
             {
-                ungetc(next, input); // Put back in input stream
-                addToken(slashsym, "/"); // Add as token
+                addToken(slashsym, start, 1, line, column); // Add as token
 
                 // Process next char
                 continue;
@@ -303,45 +613,18 @@ void lexicalAnalyzer(FILE *input)
         // Tokenize identifiers (vars, keywords)
         if (isalpha(c))
         {
-            // Initialize position trackers
-            pos = 0;
-            buffer[pos++] = c;
-            column++;
-            
-            // Read full identifier char by char in a loop
-            while ((c = fgetc(input)) != EOF && (isalpha(c) || isdigit(c)))
-            {
-                // Check that it's a valid size (not exceding 11)
-                if (pos < MAX_ID_LENGTH) 
-                {
-                    buffer[pos++] = c; // Store in buffer
-                }
-                // Too long
-                else
-                {
-                    // Discard remaining chars
-                    while (isalpha(c) || isdigit(c))
-                    {
-                        c = fgetc(input);
-                        column++;
-                    }
-                    buffer[pos] = '\0'; // Terminate lexeme
-                    addErrorToken(buffer, "Error: Ident length too long."); // Error: identifier is too long
+            // Find the end of the identifier
+            while (i < length && isalnum((unsigned char)source[i]))
+                i++;
+            int span = i - start;
 
-                    // Exit loop
-                    break;
-                }
-                column++;
+            // Check that it's a valid size (not exceding 11)
+            if (span > MAX_ID_LENGTH)
+            {
+                addErrorToken(start, MAX_ID_LENGTH, line, column, "Error: Ident length too long."); // Error: identifier is too long
+                span = MAX_ID_LENGTH; // First 11 chars are still added as a token
             }
-            buffer[pos] = '\0';
-
-            // If not the end of file
-            if (c != EOF)
-                ungetc(c, input); // Push back to input stream
-
-            // If lenght was valid
-            if (pos <= MAX_ID_LENGTH)
-                addToken(getToken(buffer), buffer); // Add as token
+            addToken(getToken(source + start, span), start, span, line, column); // Add as token
 
             // Process next char
             continue;
@@ -350,44 +633,18 @@ void lexicalAnalyzer(FILE *input)
         // Tokenize numbers
         if (isdigit(c))
         {
-            // Initialize position trackers
-            pos = 0;
-            buffer[pos++] = c;
-            column++;
+            // Find the end of the number
+            while (i < length && isdigit((unsigned char)source[i]))
+                i++;
+            int span = i - start;
 
-            // Read all digits char by char in a loop
-            while ((c = fgetc(input)) != EOF && isdigit(c))
+            // Check that it's a valid size (not exceding 5)
+            if (span > MAX_NUM_LENGTH)
             {
-                // Check that it's a valid size (not exceding 5)
-                if (pos < MAX_NUM_LENGTH)
-                {
-                    buffer[pos++] = c; // Store in buffer
-                }
-                else
-                {
-                    // Discard remaining digits
-                    while (isdigit(c))
-                    {
-                        c = fgetc(input);
-                        column++;
-                    }
-                    buffer[pos] = '\0'; // Terminate lexeme
-                    addErrorToken(buffer, "Error: Number too long."); // Error: number is too long
-
-                    // Exit loop
-                    break;
-                }
-                column++;
+                addErrorToken(start, MAX_NUM_LENGTH, line, column, "Error: Number too long."); // Error: number is too long
+                span = MAX_NUM_LENGTH; // First 5 digits are still added as a token
             }
-            buffer[pos] = '\0';
-            
-            // If not the end of file
-            if (c != EOF)
-                ungetc(c, input); // Push back to input stream
-            
-            // If length was valid
-            if (pos <= MAX_NUM_LENGTH)
-                addToken(numbersym, buffer); // Add as token
+            addToken(numbersym, start, span, line, column); // Add as token
 
             // Process next char
             continue;
@@ -397,66 +654,64 @@ void lexicalAnalyzer(FILE *input)
         switch (c)
         {
         case '+': // Plus
-            addToken(plussym, "+");
+            addToken(plussym, start, 1, line, column);
             break;
         case '-': // Minus
-            addToken(minussym, "-");
+            addToken(minussym, start, 1, line, column);
             break;
         case '*': // Multiplication
-            addToken(multsym, "*");
-            break;
-        case '/': // Division
-            addToken(slashsym, "/");
+            addToken(multsym, start, 1, line, column);
             break;
         case '(': // Left parenthesis
-            addToken(lparentsym, "(");
+            addToken(lparentsym, start, 1, line, column);
             break;
         case ')': // Right parenthesis
-            addToken(rparentsym, ")");
+            addToken(rparentsym, start, 1, line, column);
             break;
         case '=': // Equal
-            addToken(eqlsym, "=");
+            addToken(eqlsym, start, 1, line, column);
             break;
         case ',': // Comma
-            addToken(commasym, ",");
+            addToken(commasym, start, 1, line, column);
             break;
         case '.': // Period
-            addToken(periodsym, ".");
+            addToken(periodsym, start, 1, line, column);
             break;
         case ';': // Semicolon
-            addToken(semicolonsym, ";");
+            addToken(semicolonsym, start, 1, line, column);
             break;
-        case ':': // Colon
-            if ((c = fgetc(input)) == '=')
-                addToken(becomessym, ":="); // Definition of
+        case ':': // Colon (the next char is consumed either way)
+            if (i < length && source[i++] == '=')
+                addToken(becomessym, start, 2, line, column); // Definition of
             else
-                addErrorToken(":", "Error: Invalid symbol ':'"); // Not a valid symbol
+                addErrorToken(start, 1, line, column, "Error: Invalid symbol ':'"); // Not a valid symbol
             break;
-        case '<': // Less than
-            if ((c = fgetc(input)) == '=') // less than or equal to
-                addToken(leqsym, "<=");
+        case '<': // Less than (the next char is consumed either way)
+            c = i < length ? source[i++] : 0;
+            if (c == '=') // less than or equal to
+                addToken(leqsym, start, 2, line, column);
             else if (c == '>') // not equal to
-                addToken(neqsym, "<>"); 
+                addToken(neqsym, start, 2, line, column); 
             else
-                addToken(lessym, "<"); // regular less than
+                addToken(lessym, start, 1, line, column); // regular less than
             break;
-        case '>': // Greater than
-            if ((c = fgetc(input)) == '=') // greater than or equal to
-                addToken(geqsym, ">=");
+        case '>': // Greater than (the next char is consumed either way)
+            c = i < length ? source[i++] : 0;
+            if (c == '=') // greater than or equal to
+                addToken(geqsym, start, 2, line, column);
             else
-                addToken(gtrsym, ">"); // regular greater than
+                addToken(gtrsym, start, 1, line, column); // regular greater than
             break;
 
         // Invalid symbols
         default:
         {
             // Add error message
-            char lex[2] = {c, '\0'};
             char err[64];
             snprintf(err, sizeof(err), "Error: Invalid symbol '%c'", c);
 
             // Add error token to list
-            addErrorToken(lex, err); 
+            addErrorToken(start, 1, line, column, err); 
 
             // Process next char
             break;
@@ -465,6 +720,35 @@ void lexicalAnalyzer(FILE *input)
     }
 }
 
+// Function that writes the source line table of the P-code next to the elf (see pcode.h): one entry wherever the
+// line changes
+void writeLineTable(const char *elfName, const char *sourceName)
+{
+    char fileName[4096];
+    snprintf(fileName, sizeof(fileName), "%s%s", elfName, PCODE_LINES_SUFFIX);
+    int *words = packInstructions();
+    FILE *output = fopen(fileName, "w");
+    if (!output)
+    {
+        free(words);
+        fileError("Error creating line table");
+    }
+
+    fprintf(output, "%s %d %d %u\n%s\n", PCODE_LINES_MAGIC, PCODE_LINES_VERSION, instructionCount,
+            (unsigned int)pcodeHash(words, (size_t)instructionCount * 3), sourceName);
+    free(words);
+    for (int i = 0; i < instructionCount; i++)
+    {
+        if (i == 0 || instructions[i].line != instructions[i - 1].line)
+            fprintf(output, "%d %d\n", i, instructions[i].line);
+    }
+
+    if (fclose(output) != 0)
+    {
+        fileError("Error writing line table");
+    }
+}
+
 // Tiny Compiler functions -> Updated from HW3
 
 // Function that advances to the next token in the lexeme table
@@ -523,7 +807,7 @@ void block()
         
         // Store procedure name
         char procName[MAX_LEXEME_LENGTH];
-        strcpy(procName, lexemes[tokenIndex - 1].lexeme);
+        strcpy(procName, lexemeText(tokenIndex - 1));
 
         // Check for repeated identifier
         if (symbolTableCheck(procName) != -1)
@@ -542,13 +826,7 @@ void block()
         getNextToken();
 
         // Add procedure to symbol table
-        symbolTable[symbolCount].kind = 3;
-        strcpy(symbolTable[symbolCount].name, procName);
-        symbolTable[symbolCount].value = 0;
-        symbolTable[symbolCount].level = currentLevel;
-        symbolTable[symbolCount].address = instructionCount * 3 + 10;
-        symbolTable[symbolCount].mark = 0;
-        symbolCount++;
+        addSymbol(3, procName, 0, currentLevel, instructionCount * 3 + 10);
 
         currentLevel++; // Enter procedure block
         block();
@@ -561,7 +839,7 @@ void block()
         }
         getNextToken();
 
-        emit(OPR, 0, 0); // Return from procedure
+        emit(OPR, 0, RTN); // Return from procedure
     }
 
     // Fix jump
@@ -573,13 +851,7 @@ void block()
     statement();
 
     // Mark symbols from this block as unavailable
-    for (int i = 0; i < symbolCount; i++)
-    {
-        if (symbolTable[i].level == currentLevel)
-        {
-            symbolTable[i].mark = 1; // Unavailable
-        }
-    }
+    popScope(currentLevel);
 }
 
 // Function that reads constant definitions and adds them to the symbol table
@@ -600,7 +872,7 @@ void constDeclaration()
 
             // Store identifier name
             char name[MAX_LEXEME_LENGTH];
-            strcpy(name, lexemes[tokenIndex - 1].lexeme); 
+            strcpy(name, lexemeText(tokenIndex - 1)); 
 
             getNextToken();
 
@@ -616,16 +888,10 @@ void constDeclaration()
             if (currentToken != numbersym) {
                 error("Expected number after '='");
             }
-            int value = atoi(lexemes[tokenIndex - 1].lexeme);
+            int value = atoi(lexemeText(tokenIndex - 1));
 
             // Add constant to symbol table
-            strcpy(symbolTable[symbolCount].name, name);
-            symbolTable[symbolCount].kind = 1;
-            symbolTable[symbolCount].value = value;
-            symbolTable[symbolCount].level = currentLevel;
-            symbolTable[symbolCount].address = 0;
-            symbolTable[symbolCount].mark = 0;
-            symbolCount++;
+            addSymbol(1, name, value, currentLevel, 0);
             
             getNextToken(); // Get next token
         } while (currentToken == commasym);
@@ -666,16 +932,10 @@ int varDeclaration()
 
             // Store identifier name
             char name[MAX_LEXEME_LENGTH];
-            strcpy(name, lexemes[tokenIndex - 1].lexeme);
+            strcpy(name, lexemeText(tokenIndex - 1));
             
             // Add variable to symbol table
-            strcpy(symbolTable[symbolCount].name, name);
-            symbolTable[symbolCount].kind = 2;
-            symbolTable[symbolCount].value = 0;
-            symbolTable[symbolCount].level = currentLevel;
-            symbolTable[symbolCount].address = numVars + 2;
-            symbolTable[symbolCount].mark = 0;
-            symbolCount++;
+            addSymbol(2, name, 0, currentLevel, numVars + 2);
             
             // Get next token
             getNextToken();
@@ -699,6 +959,7 @@ int varDeclaration()
 void expression() 
 {
     // Process sign
+    int leftIdx = instructionCount;
     term();
 
     // Process '+' or '-' operators
@@ -707,13 +968,15 @@ void expression()
         if (currentToken == plussym) 
         {
             getNextToken();
+            int rightIdx = instructionCount;
             term();
-            emit(ADD, 0, 0);  // Emit ADD
+            emitOperation(ADD, leftIdx, rightIdx);  // Emit ADD
         } else 
         {
             getNextToken();
+            int rightIdx = instructionCount;
             term();
-            emit(SUB, 0, 0);  // Emit SUB
+            emitOperation(SUB, leftIdx, rightIdx);  // Emit SUB
         }
     }
 }
@@ -722,6 +985,7 @@ void expression()
 void term() 
 {
     // Process factor
+    int leftIdx = instructionCount;
     factor();
 
     // Process MOD, DIV, and MOD operators
@@ -731,22 +995,25 @@ void term()
         if (currentToken == multsym) 
         {
             getNextToken();
+            int rightIdx = instructionCount;
             factor();
-            emit(OPR, 0, 3);  // Emit MUL
+            emitOperation(MUL, leftIdx, rightIdx);  // Emit MUL
         } 
         // Case DIV
         else if (currentToken == slashsym) 
         {
             getNextToken();
+            int rightIdx = instructionCount;
             factor();
-            emit(DIV, 0, 0);  // Emit DIV
+            emitOperation(DIV, leftIdx, rightIdx);  // Emit DIV
         } 
         // Case MOD
         else 
         {
             getNextToken();
+            int rightIdx = instructionCount;
             factor();
-            emit(MOD, 0, 11);  // Emit MOD
+            emitOperation(MOD, leftIdx, rightIdx);  // Emit MOD
         }
     }
 }
@@ -758,12 +1025,12 @@ void factor()
     if (currentToken == identsym) 
     {
         // Get identifier
-        int symIdx = symbolTableCheck(lexemes[tokenIndex - 1].lexeme);
+        int symIdx = symbolTableCheck(lexemeText(tokenIndex - 1));
 
         // Check if identifier is declared (meaning, valid)
         if (symIdx == -1)
         {
-            undeclaredIdentifierError(lexemes[tokenIndex - 1].lexeme);
+            undeclaredIdentifierError(lexemeText(tokenIndex - 1));
         }
 
         // Load constant value
@@ -793,7 +1060,7 @@ void factor()
     else if (currentToken == numbersym) 
     {
         // Convert to int and emit LIT instruction
-        int num = atoi(lexemes[tokenIndex - 1].lexeme);
+        int num = atoi(lexemeText(tokenIndex - 1));
         emit(LIT, 0, num);
 
         // Continue
@@ -832,11 +1099,16 @@ void condition()
     {
         // Process expression
         getNextToken();
+        int leftIdx = instructionCount;
         expression();
-        emit(ODD, 0, 0);
+        // No ODD instruction: x mod 2 is nonzero exactly when x is odd
+        int rightIdx = instructionCount;
+        emit(LIT, 0, 2);
+        emitOperation(MOD, leftIdx, rightIdx);
     } 
     else 
     {
+        int leftIdx = instructionCount;
         expression();
 
         // Check that if follows with a relational operator
@@ -849,28 +1121,29 @@ void condition()
         // Save operator
         int relOp = currentToken;  
         getNextToken();
+        int rightIdx = instructionCount;
         expression();
 
         // Emit instruction based on the operator
         switch (relOp)
         {
             case eqlsym:  // = EQL
-                emit(2, 0, 5);
+                emitOperation(EQL, leftIdx, rightIdx);
                 break;
             case neqsym:  // <> NEQ
-                emit(2, 0, 6); 
+                emitOperation(NEQ, leftIdx, rightIdx);
                 break;
             case lessym:  // < LSS
-                emit(2, 0, 7);
+                emitOperation(LSS, leftIdx, rightIdx);
                 break;
             case leqsym:  // <= LEQ
-                emit(2, 0, 8);
+                emitOperation(LEQ, leftIdx, rightIdx);
                 break;
             case gtrsym:  // > GTR
-                emit(2, 0, 9);
+                emitOperation(GTR, leftIdx, rightIdx);
                 break;
             case geqsym:  // >= GEQ
-                emit(2, 0, 10);
+                emitOperation(GEQ, leftIdx, rightIdx);
                 break;
             default: // Invalid operator
                 error("Relational operator expected");
@@ -881,16 +1154,23 @@ void condition()
 // Function that processes statements based on the current token
 void statement()
 {
+    // Count simple statements (begin ... end only groups them)
+    if (currentToken == identsym || currentToken == callsym || currentToken == ifsym ||
+        currentToken == whilesym || currentToken == readsym || currentToken == writesym)
+    {
+        statementCount++;
+    }
+
     // Check for assignment, call, begin, if, while, read, or write
     if (currentToken == identsym)
     {
         // Get identifier
-        int symIdx = symbolTableCheck(lexemes[tokenIndex - 1].lexeme);
+        int symIdx = symbolTableCheck(lexemeText(tokenIndex - 1));
 
         // Check if identifier is declared
         if (symIdx == -1)
         {
-            undeclaredIdentifierError(lexemes[tokenIndex - 1].lexeme);
+            undeclaredIdentifierError(lexemeText(tokenIndex - 1));
         }
         
         // Check if identifier is a constant or procedure
@@ -929,12 +1209,12 @@ void statement()
         }
 
         // Get identifier
-        int symIdx = symbolTableCheck(lexemes[tokenIndex - 1].lexeme);
+        int symIdx = symbolTableCheck(lexemeText(tokenIndex - 1));
 
         // Check if identifier is declared
         if (symIdx == -1)
         {
-            undeclaredIdentifierError(lexemes[tokenIndex - 1].lexeme);
+            undeclaredIdentifierError(lexemeText(tokenIndex - 1));
         }
 
         // Check if identifier is a procedure
@@ -945,7 +1225,7 @@ void statement()
 
         // Emit instruction to call procedure
         int relLevel = currentLevel - symbolTable[symIdx].level;
-        emit(5, relLevel, symbolTable[symIdx].address);
+        emit(CAL, relLevel, symbolTable[symIdx].address);
 
         getNextToken();
     }
@@ -973,11 +1253,14 @@ void statement()
     // Check for if statement
     else if (currentToken == ifsym)
     {
-        // Process condition
+        // Process condition (known = 0/1 when --fold evaluated it)
         getNextToken();
+        int condIdx = instructionCount;
         condition();
+        int known = foldCondition(condIdx);
         int jpcIdx = instructionCount;
-        emit(JPC, 0, 0);
+        if (known == -1)
+            emit(JPC, 0, 0);
 
         // Check for then statement
         if (currentToken != thensym)
@@ -985,15 +1268,21 @@ void statement()
             error("then expected");
         }
 
-        // Process statement
+        // Process statement (dropped if it can never run)
         getNextToken();
+        int thenIdx = instructionCount;
         statement();
+        if (known == 0)
+            instructionCount = thenIdx;
 
         int jmpIdx = instructionCount;
-        emit(JMP, 0, 0);
+        if (known == -1)
+        {
+            emit(JMP, 0, 0);
 
-        // Fix jump
-        instructions[jpcIdx].m = instructionCount * 3 + 10;
+            // Fix jump
+            instructions[jpcIdx].m = instructionCount * 3 + 10;
+        }
 
         // Check for else statement
         if (currentToken != elsesym)
@@ -1001,12 +1290,16 @@ void statement()
             error("Missing else");
         }
 
-        // Process else statement
+        // Process else statement (dropped if it can never run)
         getNextToken();
+        int elseIdx = instructionCount;
         statement();
+        if (known == 1)
+            instructionCount = elseIdx;
 
         // Fix jump
-        instructions[jmpIdx].m = instructionCount * 3 + 10;
+        if (known == -1)
+            instructions[jmpIdx].m = instructionCount * 3 + 10;
 
         // Check for fi statement
         if (currentToken != fisym)
@@ -1025,6 +1318,7 @@ void statement()
         getNextToken();
         int loopIdx = instructionCount;
         condition();
+        int known = foldCondition(loopIdx);
 
         // Check for do statement
         if (currentToken != dosym)
@@ -1033,16 +1327,27 @@ void statement()
         }
         getNextToken();
 
-        // Emit jump instruction
+        // Emit jump instruction (not needed when the condition is known)
         int jpcIdx = instructionCount;
-        emit(JPC, 0, 0);
+        if (known == -1)
+            emit(JPC, 0, 0);
 
         // Process statement
         statement();
-        emit(JMP, 0, loopIdx);
 
-        // Fix jump
-        instructions[jpcIdx].m = instructionCount * 3 + 10;
+        // A loop that never runs leaves no code
+        if (known == 0)
+        {
+            instructionCount = loopIdx;
+        }
+        else
+        {
+            emit(JMP, 0, loopIdx * 3 + 10);
+
+            // Fix jump
+            if (known == -1)
+                instructions[jpcIdx].m = instructionCount * 3 + 10;
+        }
     }
 
     // Check for read statement
@@ -1057,12 +1362,12 @@ void statement()
         }
 
         // Get identifier
-        int symIdx = symbolTableCheck(lexemes[tokenIndex - 1].lexeme);
+        int symIdx = symbolTableCheck(lexemeText(tokenIndex - 1));
 
         // Check if identifier is declared
         if (symIdx == -1)
         {
-            undeclaredIdentifierError(lexemes[tokenIndex - 1].lexeme);
+            undeclaredIdentifierError(lexemeText(tokenIndex - 1));
         }
 
         // Check if identifier is a variable
@@ -1073,7 +1378,7 @@ void statement()
         getNextToken();
 
         // Emit instruction to read value
-        emit(SYS, 0, 14);
+        emit(SYS, 0, 2);
 
         // Store value in variable
         int relLevel = currentLevel - symbolTable[symIdx].level;
@@ -1093,138 +1398,1725 @@ void statement()
 // Function that appends an instruction to the instruction array
 void emit(int op, int l, int m) 
 {
-    // Check that instruction array is not full 
+    // Check that the code address of the instruction fits in 32 bits
     if (instructionCount >= MAX_INSTRUCTIONS) 
     {
-        printf("Error: Instruction limit exceeded\n");
-        exit(1);
+        error("Instruction limit exceeded");
+    }
+
+    // Grow the instruction array
+    if (instructionCount == instructionCapacity)
+    {
+        int capacity = instructionCapacity ? instructionCapacity * 2 : 1024;
+        if (instructionCapacity > INT_MAX / 2)
+            capacity = INT_MAX;
+        Instruction *grown = realloc(instructions, (size_t)capacity * sizeof(Instruction));
+        if (!grown)
+            error("Out of memory");
+        instructions = grown;
+        instructionCapacity = capacity;
     }
 
     // Add instruction to array
     instructions[instructionCount].op = op;
     instructions[instructionCount].l = l;
     instructions[instructionCount].m = m;
+    instructions[instructionCount].line = lexCount > 0 ? lexemes[tokenIndex >= 2 ? tokenIndex - 2 : 0].line : 0;
     instructionCount++;
 }
 
-// Function that searches the symbol table for an identifier
-int symbolTableCheck(char *name) 
+// Helper function that evaluates OPR op on constants like the VM would. Returns 0 if it would trap.
+int foldOperation(int op, int a, int b, int *result)
 {
-    // Check for empty symbol table
-    for (int i = symbolCount - 1; i >= 0; i--) 
+    // Wrap like two's complement hardware instead of overflowing
+    unsigned int ua = (unsigned int)a, ub = (unsigned int)b;
+    if ((op == DIV || op == MOD) && (b == 0 || (a == INT_MIN && b == -1)))
+        return 0;
+
+    switch (op)
     {
-        if (strcmp(symbolTable[i].name, name) == 0 && symbolTable[i].mark == 0) 
-        {
-            return i;  // Found active symbol
-        }
+        case ADD: *result = (int)(ua + ub); break;
+        case SUB: *result = (int)(ua - ub); break;
+        case MUL: *result = (int)(ua * ub); break;
+        case DIV: *result = a / b; break;
+        case MOD: *result = a % b; break;
+        case EQL: *result = a == b; break;
+        case NEQ: *result = a != b; break;
+        case LSS: *result = a < b; break;
+        case LEQ: *result = a <= b; break;
+        case GTR: *result = a > b; break;
+        case GEQ: *result = a >= b; break;
+        default: return 0;
     }
-    return -1;  // Not found
+    return 1;
 }
 
-// Helper function that prints the generated assembly code.
-void printAssemblyCode() 
+// Helper function that checks whether the code in [from, to) can trap at runtime (division or modulus)
+int canTrap(int from, int to)
 {
-    // Print header
-    printf("Assembly Code:\n\n");
-    printf("Line OP L M\n");
-
-    // Print all instructions
-    for (int i = 0; i < instructionCount; i++) 
+    for (int i = from; i < to; i++)
     {
-        // printf("%d %s %d %d\n", i, instructions[i].op, instructions[i].l, instructions[i].m);
-        printf("%2d %s %d %d\n", i, getKindName(instructions[i].op), instructions[i].l, instructions[i].m);    
+        if (instructions[i].op == OPR && (instructions[i].m == DIV || instructions[i].m == MOD))
+            return 1;
     }
+    return 0;
 }
 
-// Helper function that prints the symbol table.
-void printSymbolTable() 
+// Function that emits OPR op for the operands at [leftIdx, rightIdx) and [rightIdx, instructionCount).
+// With --fold, constant operands are evaluated at compile time and identities are simplified.
+void emitOperation(int op, int leftIdx, int rightIdx)
 {
-    // Print table header
-    printf("\n\nSymbol Table:\n");
-    printf("Kind | Name      | Value | Level | Address | Mark\n");
-    printf("-----------------------------------------------------\n");
+    if (!foldEnabled)
+    {
+        emit(OPR, 0, op);
+        return;
+    }
 
-    // Print all symbols
-    for (int i = 0; i < symbolCount; i++) 
+    // An operand is constant when its code is a single LIT
+    int leftConst = rightIdx - leftIdx == 1 && instructions[leftIdx].op == LIT;
+    int rightConst = instructionCount - rightIdx == 1 && instructions[rightIdx].op == LIT;
+    int left = instructions[leftIdx].m, right = instructions[rightIdx].m, value;
+
+    // Both constant: evaluate now
+    if (leftConst && rightConst && foldOperation(op, left, right, &value))
     {
-        symbolTable[i].mark = 1; //
-        printf("%4d | %-10s | %5d | %5d | %7d | %4d\n",
-            symbolTable[i].kind, 
-            symbolTable[i].name, 
-            symbolTable[i].value, 
-            symbolTable[i].level, 
-            symbolTable[i].address, 
-            symbolTable[i].mark);
+        instructionCount = leftIdx;
+        emit(LIT, 0, value);
+        foldedOperations++;
+        return;
+    }
+
+    if (rightConst)
+    {
+        // x + 0, x - 0, x * 1, x / 1 -> x
+        if (((op == ADD || op == SUB) && right == 0) || ((op == MUL || op == DIV) && right == 1))
+        {
+            instructionCount = rightIdx;
+            foldedOperations++;
+            return;
+        }
+
+        // x * 0, x mod 1 -> 0, unless x could trap
+        if (((op == MUL && right == 0) || (op == MOD && right == 1)) && !canTrap(leftIdx, rightIdx))
+        {
+            instructionCount = leftIdx;
+            emit(LIT, 0, 0);
+            foldedOperations++;
+            return;
+        }
+
+        // (x +- c) +- k -> x + (+-c +- k) and (x * c) * k -> x * (c * k)
+        Instruction *prev = &instructions[rightIdx - 2];
+        if (rightIdx - leftIdx >= 3 && prev[0].op == LIT && prev[1].op == OPR)
+        {
+            int addChain = (op == ADD || op == SUB) && (prev[1].m == ADD || prev[1].m == SUB);
+            if (addChain || (op == MUL && prev[1].m == MUL))
+            {
+                unsigned int c = prev[1].m == SUB ? 0u - (unsigned int)prev[0].m : (unsigned int)prev[0].m;
+                unsigned int k = op == SUB ? 0u - (unsigned int)right : (unsigned int)right;
+                prev[0].m = addChain ? (int)(c + k) : (int)((unsigned int)prev[0].m * (unsigned int)right);
+                prev[1].m = addChain ? ADD : MUL;
+                instructionCount = rightIdx;
+                foldedOperations++;
+
+                // x + 0 -> x
+                if (addChain && prev[0].m == 0)
+                    instructionCount -= 2;
+                return;
+            }
+        }
+    }
+
+    if (leftConst)
+    {
+        // 0 + x, 1 * x -> x
+        if ((op == ADD && left == 0) || (op == MUL && left == 1))
+        {
+            memmove(&instructions[leftIdx], &instructions[rightIdx], (instructionCount - rightIdx) * sizeof(Instruction));
+            instructionCount--;
+            foldedOperations++;
+            return;
+        }
+
+        // 0 * x -> 0, unless x could trap
+        if (op == MUL && left == 0 && !canTrap(rightIdx, instructionCount))
+        {
+            instructionCount = leftIdx;
+            emit(LIT, 0, 0);
+            foldedOperations++;
+            return;
+        }
     }
+
+    emit(OPR, 0, op);
 }
 
-// Helper function that returns the name of the instruction kind (based on opcode)
-const char* getKindName(int kind) 
+// Function that checks whether the condition emitted from condIdx folded to a constant (--fold).
+// If so, the LIT is removed and its truth value (0 or 1) returned; otherwise returns -1.
+int foldCondition(int condIdx)
 {
-    // Switch case to determine appropriate string
-    switch (kind) {
-        case 1: return "LIT";
-        case 2: return "OPR";
-        case 3: return "LOD";
-        case 4: return "STO";
-        case 5: return "CAL";
-        case 6: return "INC";
-        case 7: return "JMP";
-        case 8: return "JPC";
-        case 9: return "SYS";
-        default: return "OPR";
+    if (!foldEnabled || instructionCount - condIdx != 1 || instructions[condIdx].op != LIT)
+        return -1;
+
+    instructionCount = condIdx;
+    foldedBranches++;
+    return instructions[condIdx].m != 0;
+}
+
+// Helper function that hashes an identifier (FNV-1a)
+unsigned int hashName(const char *name)
+{
+    unsigned int hash = 2166136261u;
+    for (; *name; name++)
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    return hash;
+}
+
+// Helper function that finds the intern table slot for name: its entry, or the empty slot where it belongs
+int findInternSlot(const char *name, unsigned int hash)
+{
+    int slot = hash & (internCapacity - 1);
+    while (internTable[slot].text &&
+           (internTable[slot].hash != hash || strcmp(internTable[slot].text, name) != 0))
+    {
+        slot = (slot + 1) & (internCapacity - 1);
     }
+    return slot;
 }
 
-// Function that implements a PL/0 tiny compiler and generates P-code instructions
-int main(int argc, char *argv[]) 
+// Function that returns the intern table index of name, adding it if it's new
+int internName(const char *name)
 {
-    // Check for input file
-    if (argc < 2) {
-        printf("Usage: %s <input_file>\n", argv[0]);
-        return 1;
+    // Keep the table at most half full
+    if (2 * (internCount + 1) > internCapacity)
+    {
+        InternEntry *oldTable = internTable;
+        int oldCapacity = internCapacity;
+        internCapacity = internCapacity ? 2 * internCapacity : 256;
+        internTable = calloc(internCapacity, sizeof(InternEntry));
+        if (!internTable)
+            error("Out of memory");
+
+        // Rehash existing names; symbols refer to them by index, so remap those too
+        int *newSlot = malloc((oldCapacity + 1) * sizeof(int));
+        if (!newSlot)
+            error("Out of memory");
+        for (int i = 0; i < oldCapacity; i++)
+        {
+            if (oldTable[i].text)
+            {
+                newSlot[i] = findInternSlot(oldTable[i].text, oldTable[i].hash);
+                internTable[newSlot[i]] = oldTable[i];
+            }
+        }
+        for (int i = 0; i < symbolCount; i++)
+            symbolTable[i].nameId = newSlot[symbolTable[i].nameId];
+        free(newSlot);
+        free(oldTable);
     }
-    
-    // Open input file
-    FILE *input = fopen(argv[1], "r");
-    if (!input) {
-        perror("Error opening file"); // Error opening file
-        return 1;
+
+    unsigned int hash = hashName(name);
+    int slot = findInternSlot(name, hash);
+    if (!internTable[slot].text)
+    {
+        // New name: store one copy of it
+        size_t length = strlen(name) + 1;
+        char *text = malloc(length);
+        if (!text)
+            error("Out of memory");
+        memcpy(text, name, length);
+
+        internTable[slot].text = text;
+        internTable[slot].hash = hash;
+        internTable[slot].symbol = -1;
+        internCount++;
     }
-    
-    // Initialize instructions array
-    for (int i = 0; i < MAX_INSTRUCTIONS; i++) 
+    return slot;
+}
+
+// Function that adds a symbol to the current scope. It hides any active symbol with the same name.
+void addSymbol(int kind, const char *name, int value, int level, int address)
+{
+    // Grow the symbol table and scope list as needed
+    if (symbolCount == symbolCapacity)
     {
-        instructions[i].op = 0;
-        instructions[i].l = 0;
-        instructions[i].m = 0;
+        symbolCapacity = symbolCapacity ? 2 * symbolCapacity : 256;
+        symbolTable = realloc(symbolTable, symbolCapacity * sizeof(SymbolEntry));
+        if (!symbolTable)
+            error("Out of memory");
+    }
+    if (level >= scopeCapacity)
+    {
+        int oldCapacity = scopeCapacity;
+        scopeCapacity = 2 * level + 8;
+        scopeHeads = realloc(scopeHeads, scopeCapacity * sizeof(int));
+        if (!scopeHeads)
+            error("Out of memory");
+        for (int i = oldCapacity; i < scopeCapacity; i++)
+            scopeHeads[i] = -1;
     }
-        
-    // Do lexical analysis on input file
-    lexicalAnalyzer(input);
-    fclose(input);
-    
-    // Parse lexemes and generate P-code instructions 
-    program();
-    
-    // Print the generated assembly code and symbol table
-    printf("No errors, program is syntactically correct.\n\n");
-    printAssemblyCode();
-    printSymbolTable();
-    
-    // Create the elf.txt file for the VM input
-    FILE *output = fopen("elf.txt", "w");
 
-    // Write the P-code instructions to the output file
-    for (int i = 0; i < instructionCount; i++) 
+    int nameId = internName(name);
+    SymbolEntry *sym = &symbolTable[symbolCount];
+    sym->kind = kind;
+    sym->name = internTable[nameId].text;
+    sym->value = value;
+    sym->level = level;
+    sym->address = address;
+    sym->mark = 0;
+    sym->nameId = nameId;
+
+    // Bind the name to this symbol and link it into its scope
+    sym->shadowed = internTable[nameId].symbol;
+    internTable[nameId].symbol = symbolCount;
+    sym->scopeNext = scopeHeads[level];
+    scopeHeads[level] = symbolCount;
+    symbolCount++;
+}
+
+// Function that marks every symbol of a scope as unavailable and restores the symbols they hid.
+// Only walks the symbols declared in that scope.
+void popScope(int level)
+{
+    if (level >= scopeCapacity)
+        return;
+
+    for (int i = scopeHeads[level]; i != -1; i = symbolTable[i].scopeNext)
     {
-        fprintf(output, "%d %d %d", instructions[i].op, instructions[i].l, instructions[i].m);
-        if(i < instructionCount - 1)
-        {
-            fprintf(output, "\n");
-        }
+        symbolTable[i].mark = 1; // Unavailable
+        internTable[symbolTable[i].nameId].symbol = symbolTable[i].shadowed;
+    }
+    scopeHeads[level] = -1;
+}
+
+// Function that searches the symbol table for an identifier
+int symbolTableCheck(char *name) 
+{
+    // Empty symbol table
+    if (internCapacity == 0)
+        return -1;
+
+    // Innermost active symbol bound to the name
+    int slot = findInternSlot(name, hashName(name));
+    return internTable[slot].text ? internTable[slot].symbol : -1;
+}
+
+// Optimization passes -> run on the instruction array after program()
+
+// Helper function that returns how many instruction slots an opcode takes (fused opcodes carry an operand word)
+int instructionLength(int op)
+{
+    return (op == FUSED_INCV || op == FUSED_LCB || op == FUSED_LLB) ? 2 : 1;
+}
+
+// Helper function that converts a code address (index * 3 + 10) back to an instruction index, or -1
+int addressToIndex(int address)
+{
+    if (address < 10 || (address - 10) % 3 != 0 || (address - 10) / 3 > instructionCount)
+        return -1;
+    return (address - 10) / 3;
+}
+
+// Function that flags every instruction that control can reach other than by falling through:
+// jump/call targets and procedure entry points. isTarget needs instructionCount + 1 entries.
+void markJumpTargets(char *isTarget)
+{
+    memset(isTarget, 0, instructionCount + 1);
+    isTarget[0] = 1;
+
+    for (int i = 0; i < instructionCount; i += instructionLength(instructions[i].op))
+    {
+        int target = -1;
+        if (instructions[i].op == JMP || instructions[i].op == JPC || instructions[i].op == CAL ||
+            instructions[i].op == TAIL_CAL)
+            target = addressToIndex(instructions[i].m);
+        else if (instructions[i].op == FUSED_LCB)
+            target = addressToIndex(instructions[i + 1].m);
+        if (target != -1)
+            isTarget[target] = 1;
+    }
+
+    for (int i = 0; i < symbolCount; i++)
+    {
+        int target = symbolTable[i].kind == 3 ? addressToIndex(symbolTable[i].address) : -1;
+        if (target != -1)
+            isTarget[target] = 1;
+    }
+}
+
+// Function that replaces the instruction array with newCode and relocates every code address
+// (JMP/JPC/CAL/TCL and fused branch targets, procedure addresses). newIndex maps each old instruction
+// index (0..instructionCount) to its new index.
+void relocateCode(Instruction *newCode, int newCount, const int *newIndex)
+{
+    // Relocate targets while the old indexes are still valid
+    for (int i = 0; i < newCount; i += instructionLength(newCode[i].op))
+    {
+        int *address = NULL;
+        if (newCode[i].op == JMP || newCode[i].op == JPC || newCode[i].op == CAL || newCode[i].op == TAIL_CAL)
+            address = &newCode[i].m;
+        else if (newCode[i].op == FUSED_LCB)
+            address = &newCode[i + 1].m;
+
+        if (address && addressToIndex(*address) != -1)
+            *address = newIndex[addressToIndex(*address)] * 3 + 10;
+    }
+
+    for (int i = 0; i < symbolCount; i++)
+    {
+        if (symbolTable[i].kind == 3 && addressToIndex(symbolTable[i].address) != -1)
+            symbolTable[i].address = newIndex[addressToIndex(symbolTable[i].address)] * 3 + 10;
+    }
+
+    // Install the new code
+    memcpy(instructions, newCode, newCount * sizeof(Instruction));
+    instructionCount = newCount;
+}
+
+// Function that rewrites common sequences into fused opcodes (see pcode.h), so the VM does one dispatch
+// instead of three or four:
+//   LOD l a; LIT k; OPR ADD/SUB; STO l a   ->  INCV l a  [0 0 +-k]
+//   LOD l a; LIT k; OPR cmp; JPC t         ->  LCB l a   [cmp k t]
+//   LOD l a; LOD l2 a2; OPR op             ->  LLB l a   [op l2 a2]
+// A sequence is only fused when no jump lands inside it.
+void fuseInstructions()
+{
+    char *isTarget = malloc(instructionCount + 1);
+    int *newIndex = malloc((instructionCount + 1) * sizeof(int));
+    Instruction *newCode = malloc((instructionCount + 1) * sizeof(Instruction));
+    if (!isTarget || !newIndex || !newCode)
+        error("Out of memory");
+    markJumpTargets(isTarget);
+
+    int count = 0;
+    for (int i = 0; i < instructionCount; )
+    {
+        Instruction *in = &instructions[i];
+        int available = instructionCount - i;
+        int length = 0;
+
+        // Sequence heads are always a LOD with no jump into the rest of the sequence
+        if (in[0].op == LOD && available >= 3 && !isTarget[i + 1] && !isTarget[i + 2])
+        {
+            int fourSafe = available >= 4 && !isTarget[i + 3];
+
+            // x := x + k / x := x - k
+            if (fourSafe && in[1].op == LIT && in[2].op == OPR && (in[2].m == ADD || in[2].m == SUB)
+                && in[3].op == STO && in[3].l == in[0].l && in[3].m == in[0].m && in[1].m != INT_MIN)
+            {
+                newCode[count] = (Instruction){ FUSED_INCV, in[0].l, in[0].m, in[0].line };
+                newCode[count + 1] = (Instruction){ 0, 0, in[2].m == ADD ? in[1].m : -in[1].m, in[0].line };
+                length = 4;
+            }
+            // Loop/if condition: x cmp k, then jump when false
+            else if (fourSafe && in[1].op == LIT && in[2].op == OPR && in[2].m >= EQL && in[2].m <= GEQ
+                     && in[3].op == JPC)
+            {
+                newCode[count] = (Instruction){ FUSED_LCB, in[0].l, in[0].m, in[0].line };
+                newCode[count + 1] = (Instruction){ in[2].m, in[1].m, in[3].m, in[0].line };
+                length = 4;
+            }
+            // Binary operation on two variables
+            else if (in[1].op == LOD && in[2].op == OPR && in[2].m >= ADD && in[2].m <= MOD)
+            {
+                newCode[count] = (Instruction){ FUSED_LLB, in[0].l, in[0].m, in[0].line };
+                newCode[count + 1] = (Instruction){ in[2].m, in[1].l, in[1].m, in[0].line };
+                length = 3;
+            }
+        }
+
+        if (length > 0)
+        {
+            fusedSequences++;
+            fusedDispatches += length - 1;
+            fusedRemoved += length - 2;
+            for (int j = 0; j < length; j++)
+                newIndex[i + j] = count;
+            count += 2;
+            i += length;
+        }
+        else
+        {
+            newIndex[i] = count;
+            newCode[count++] = instructions[i++];
+        }
+    }
+    newIndex[instructionCount] = count;
+
+    relocateCode(newCode, count, newIndex);
+    free(isTarget);
+    free(newIndex);
+    free(newCode);
+}
+
+// Helper function that follows a chain of JMPs starting at instruction index, and returns the index of the
+// first instruction that isn't a JMP (or the end of the code). A JMP cycle returns the index it started at.
+int jumpDestination(int index)
+{
+    for (int hops = 0; hops < instructionCount && index < instructionCount && instructions[index].op == JMP; hops++)
+    {
+        int next = addressToIndex(instructions[index].m);
+        if (next == -1)
+            break;
+        index = next;
+    }
+    return index < instructionCount && instructions[index].op == JMP ? -1 : index;
+}
+
+// Function that makes one peephole pass over the code, with a window of two instructions:
+//   JMP/JPC/CAL/TCL t, t is JMP u           ->  jump straight to the end of the chain
+//   JMP t, t is RTN or HALT                 ->  the RTN/HALT itself
+//   JMP t, t is the next instruction        ->  removed (e.g. no nested procedures, an empty else)
+//   LOD l a; STO l a                        ->  removed (x := x)
+// Nothing is removed when a jump lands in the middle of a window. Returns the number of changes.
+int peepholePass(char *isTarget, int *newIndex, Instruction *newCode)
+{
+    int changes = 0;
+
+    // Jumps into JMP chains
+    for (int i = 0; i < instructionCount; i++)
+    {
+        Instruction *in = &instructions[i];
+        if (in->op != JMP && in->op != JPC && in->op != CAL && in->op != TAIL_CAL)
+            continue;
+        int target = addressToIndex(in->m);
+        if (target == -1 || target >= instructionCount || instructions[target].op != JMP)
+            continue;
+
+        // A JMP cycle (an empty infinite loop) is left as it is
+        int destination = jumpDestination(target);
+        if (destination != -1)
+        {
+            in->m = destination * 3 + 10;
+            peepholeRetargeted++;
+            changes++;
+        }
+    }
+
+    for (int i = 0; i < instructionCount; i++)
+    {
+        Instruction *in = &instructions[i];
+        int target = in->op == JMP ? addressToIndex(in->m) : -1;
+        if (target == -1 || target >= instructionCount || target == i + 1)
+            continue;
+
+        // JMPs to a RTN or HALT (a JMP to the next instruction is removed below instead)
+        Instruction *to = &instructions[target];
+        if ((to->op == OPR && to->m == RTN) || (to->op == SYS && to->m == 3))
+        {
+            *in = *to;
+            peepholeReturns++;
+            changes++;
+        }
+    }
+
+    markJumpTargets(isTarget);
+    int count = 0;
+    for (int i = 0; i < instructionCount; )
+    {
+        Instruction *in = &instructions[i];
+        int length = 0;
+
+        if (in[0].op == JMP && in[0].m == (i + 1) * 3 + 10)
+            length = 1;
+        else if (i + 1 < instructionCount && in[0].op == LOD && in[1].op == STO && in[0].l == in[1].l
+                 && in[0].m == in[1].m && !isTarget[i + 1])
+            length = 2;
+
+        if (length > 0)
+        {
+            // Jumps to a removed instruction continue with whatever follows it
+            for (int j = 0; j < length; j++)
+                newIndex[i + j] = count;
+            peepholeRemoved += length;
+            changes++;
+            i += length;
+        }
+        else
+        {
+            newIndex[i] = count;
+            newCode[count++] = instructions[i++];
+        }
+    }
+    newIndex[instructionCount] = count;
+
+    relocateCode(newCode, count, newIndex);
+    return changes;
+}
+
+// Function that repeats the peephole pass until the code stops changing (removing a JMP can make another
+// one jump to the next instruction). Runs before fusion, on plain P-code.
+void peepholeInstructions()
+{
+    char *isTarget = malloc(instructionCount + 1);
+    int *newIndex = malloc((instructionCount + 1) * sizeof(int));
+    Instruction *newCode = malloc((instructionCount + 1) * sizeof(Instruction));
+    if (!isTarget || !newIndex || !newCode)
+        error("Out of memory");
+
+    while (peepholePass(isTarget, newIndex, newCode) > 0)
+        ;
+
+    free(isTarget);
+    free(newIndex);
+    free(newCode);
+}
+
+// Helper function that finds the body of the procedure whose entry (CAL target) is instruction entry: the
+// entry JMPs over the nested procedures to the body's INC, and the body ends at its RTN (or at the HALT of
+// the main block, entry 0). Returns 1 and the indexes of the INC and the RTN/HALT, or 0.
+int procedureBody(int entry, int *bodyStart, int *bodyEnd)
+{
+    if (entry < 0 || entry >= instructionCount || instructions[entry].op != JMP)
+        return 0;
+    int start = addressToIndex(instructions[entry].m);
+    if (start == -1 || start >= instructionCount || instructions[start].op != INC || instructions[start].l != 0)
+        return 0;
+
+    for (int i = start + 1; i < instructionCount; i++)
+    {
+        if ((entry != 0 && instructions[i].op == OPR && instructions[i].m == RTN) ||
+            (entry == 0 && instructions[i].op == SYS && instructions[i].m == 3))
+        {
+            *bodyStart = start;
+            *bodyEnd = i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Helper function that checks whether a procedure can call itself, directly or through other procedures.
+// procedureAt maps an entry index to its symbol, bodyStart/bodyEnd give each symbol's body (-1 if none).
+int callsItself(int symbol, const int *procedureAt, const int *bodyStart, const int *bodyEnd)
+{
+    char *visited = calloc(symbolCount, 1);
+    int *pending = malloc((symbolCount + 1) * sizeof(int));
+    if (!visited || !pending)
+        error("Out of memory");
+
+    int count = 0, found = 0;
+    pending[count++] = symbol;
+    while (count > 0 && !found)
+    {
+        int current = pending[--count];
+        for (int i = bodyStart[current]; bodyStart[current] != -1 && i < bodyEnd[current]; i++)
+        {
+            int callee = instructions[i].op == CAL && addressToIndex(instructions[i].m) != -1
+                         && addressToIndex(instructions[i].m) < instructionCount
+                         ? procedureAt[addressToIndex(instructions[i].m)] : -1;
+            if (callee == symbol)
+                found = 1;
+            else if (callee != -1 && !visited[callee])
+            {
+                visited[callee] = 1;
+                pending[count++] = callee;
+            }
+        }
+    }
+
+    free(visited);
+    free(pending);
+    return found;
+}
+
+// Function that replaces every CAL of a small non-recursive procedure with a copy of its body (without the
+// INC and the RTN). In the copy, the procedure's locals move to fresh slots at the end of the caller's frame
+// (the caller's INC grows), a LOD/STO/CAL that went l >= 1 levels up from the procedure goes L + l - 1 levels
+// up from the caller (L = the CAL's level difference), and jumps stay inside the copy. Procedures that call
+// their own nested procedures (CAL 0) are not inlined: those need the procedure's frame. Stops adding code
+// once the program reaches budget instructions. Returns the number of call sites inlined.
+int inlinePass(int budget)
+{
+    int *procedureAt = malloc((instructionCount + 1) * sizeof(int));
+    int *owner = malloc((instructionCount + 1) * sizeof(int));
+    int *bodyStart = malloc((symbolCount + 1) * sizeof(int));
+    int *bodyEnd = malloc((symbolCount + 1) * sizeof(int));
+    char *inlinable = calloc(symbolCount + 1, 1);
+    if (!procedureAt || !owner || !bodyStart || !bodyEnd || !inlinable)
+        error("Out of memory");
+
+    // Bodies of the procedures and of the main block, and the body (INC index) each instruction belongs to
+    for (int i = 0; i < instructionCount; i++)
+    {
+        procedureAt[i] = -1;
+        owner[i] = -1;
+    }
+    int mainStart, mainEnd;
+    if (procedureBody(0, &mainStart, &mainEnd))
+    {
+        for (int i = mainStart; i <= mainEnd; i++)
+            owner[i] = mainStart;
+    }
+    for (int k = 0; k < symbolCount; k++)
+    {
+        int entry = symbolTable[k].kind == 3 ? addressToIndex(symbolTable[k].address) : -1;
+        bodyStart[k] = bodyEnd[k] = -1;
+        if (entry != -1 && procedureBody(entry, &bodyStart[k], &bodyEnd[k]))
+        {
+            procedureAt[entry] = k;
+            for (int i = bodyStart[k]; i <= bodyEnd[k]; i++)
+                owner[i] = bodyStart[k];
+        }
+    }
+
+    // Small enough, jumps stay in the body, no CAL 0, not recursive
+    for (int k = 0; k < symbolCount; k++)
+    {
+        if (bodyStart[k] == -1 || bodyEnd[k] - bodyStart[k] - 1 > inlineLimit)
+            continue;
+        int ok = 1;
+        for (int i = bodyStart[k] + 1; i < bodyEnd[k] && ok; i++)
+        {
+            Instruction *in = &instructions[i];
+            int target = addressToIndex(in->m);
+            if (in->op == CAL && in->l == 0)
+                ok = 0;
+            else if ((in->op == JMP || in->op == JPC) && (target <= bodyStart[k] || target > bodyEnd[k]))
+                ok = 0;
+            else if (in->op == INC || (in->op == OPR && in->m == RTN) || instructionLength(in->op) == 2)
+                ok = 0;
+        }
+        inlinable[k] = ok && !callsItself(k, procedureAt, bodyStart, bodyEnd);
+    }
+
+    // Copy the code, expanding the inlined calls. isCopy marks jumps that are already final.
+    int capacity = instructionCount + 1024;
+    Instruction *newCode = malloc(capacity * sizeof(Instruction));
+    char *isCopy = malloc(capacity);
+    int *newIndex = malloc((instructionCount + 1) * sizeof(int));
+    if (!newCode || !isCopy || !newIndex)
+        error("Out of memory");
+
+    int count = 0, sites = 0;
+    for (int i = 0; i < instructionCount; i++)
+    {
+        Instruction call = instructions[i];
+        int target = call.op == CAL ? addressToIndex(call.m) : -1;
+        int callee = target != -1 && target < instructionCount ? procedureAt[target] : -1;
+        int length = callee != -1 ? bodyEnd[callee] - bodyStart[callee] - 1 : 0;
+        newIndex[i] = count;
+
+        if (callee == -1 || !inlinable[callee] || owner[i] == -1 || owner[i] == bodyStart[callee] ||
+            count + (instructionCount - i) + length > budget)
+        {
+            isCopy[count] = 0;
+            newCode[count++] = call;
+            continue;
+        }
+
+        // Room for the copy and the rest of the code
+        if (count + length + (instructionCount - i) >= capacity)
+        {
+            capacity = (count + length + (instructionCount - i)) * 2;
+            newCode = realloc(newCode, capacity * sizeof(Instruction));
+            isCopy = realloc(isCopy, capacity);
+            if (!newCode || !isCopy)
+                error("Out of memory");
+        }
+
+        // The callee's locals go after the caller's current frame
+        Instruction *callerInc = &newCode[newIndex[owner[i]]];
+        int locals = instructions[bodyStart[callee]].m - 3;
+        int frameEnd = callerInc->m;
+        callerInc->m += locals;
+
+        int copyStart = count;
+        for (int j = bodyStart[callee] + 1; j < bodyEnd[callee]; j++)
+        {
+            Instruction in = instructions[j];
+            isCopy[count] = 0;
+            if ((in.op == LOD || in.op == STO) && in.l == 0)
+                in.m = frameEnd + in.m - 3;
+            else if (in.op == LOD || in.op == STO || in.op == CAL)
+                in.l = call.l + in.l - 1;
+            else if (in.op == JMP || in.op == JPC)
+            {
+                in.m = (copyStart + addressToIndex(in.m) - (bodyStart[callee] + 1)) * 3 + 10;
+                isCopy[count] = 1;
+            }
+            newCode[count++] = in;
+        }
+
+        inlinedCalls[callee]++;
+        inlinedLocals += locals;
+        sites++;
+    }
+    newIndex[instructionCount] = count;
+
+    // Relocate the jumps of the original code and every CAL (copied CALs still hold old addresses)
+    for (int i = 0; i < count; i++)
+    {
+        Instruction *in = &newCode[i];
+        if ((in->op == CAL || ((in->op == JMP || in->op == JPC) && !isCopy[i])) && addressToIndex(in->m) != -1)
+            in->m = newIndex[addressToIndex(in->m)] * 3 + 10;
+    }
+    for (int k = 0; k < symbolCount; k++)
+    {
+        if (symbolTable[k].kind == 3 && addressToIndex(symbolTable[k].address) != -1)
+            symbolTable[k].address = newIndex[addressToIndex(symbolTable[k].address)] * 3 + 10;
+    }
+
+    // Install the new code
+    free(instructions);
+    instructions = newCode;
+    instructionCount = count;
+    instructionCapacity = capacity;
+
+    free(procedureAt);
+    free(owner);
+    free(bodyStart);
+    free(bodyEnd);
+    free(inlinable);
+    free(isCopy);
+    free(newIndex);
+    return sites;
+}
+
+// Function that inlines small procedures until no call site is left to inline (the copies of one round can
+// call procedures that are inlined in the next). The code may at most double, plus 1024 instructions.
+void inlineProcedures()
+{
+    inlinedCalls = calloc(symbolCount + 1, sizeof(int));
+    if (!inlinedCalls)
+        error("Out of memory");
+
+    int budget = instructionCount * 2 + 1024;
+    int sites;
+    while ((sites = inlinePass(budget)) > 0)
+        inlinedSites += sites;
+}
+
+// Function that turns calls in tail position into tail calls (TCL, see pcode.h): a CAL whose next instruction,
+// after any JMPs, is a RTN. The called procedure takes over the caller's frame, so tail recursion runs in constant
+// stack space and returns straight to the caller's caller. A CAL 0 stays: the procedure it calls is nested in the
+// caller and uses its frame. The RTN stays too (--prune removes it when nothing else reaches it).
+void tailCallInstructions()
+{
+    for (int i = 0; i < instructionCount; i += instructionLength(instructions[i].op))
+    {
+        Instruction *in = &instructions[i];
+        if (in->op != CAL || in->l < 1 || i + 1 >= instructionCount)
+            continue;
+        int next = jumpDestination(i + 1);
+        if (next != -1 && next < instructionCount && instructions[next].op == OPR && instructions[next].m == RTN)
+        {
+            in->op = TAIL_CAL;
+            tailCalls++;
+        }
+    }
+}
+
+// Function that removes the code no execution can reach: procedures that no reachable CAL calls, and
+// instructions after an unconditional transfer that no jump lands on. Reachability is a worklist walk from
+// the first instruction over JMP/JPC/CAL/TCL targets and fall-through (none after JMP, TCL, RTN and HALT).
+// Symbols of removed procedures get address -1.
+void pruneInstructions()
+{
+    char *reachable = calloc(instructionCount + 1, 1);
+    int *worklist = malloc((instructionCount + 1) * sizeof(int));
+    int *newIndex = malloc((instructionCount + 1) * sizeof(int));
+    Instruction *newCode = malloc((instructionCount + 1) * sizeof(Instruction));
+    if (!reachable || !worklist || !newIndex || !newCode)
+        error("Out of memory");
+
+    int pending = 0;
+    if (instructionCount > 0)
+    {
+        reachable[0] = 1;
+        worklist[pending++] = 0;
+    }
+    while (pending > 0)
+    {
+        int i = worklist[--pending];
+        Instruction *in = &instructions[i];
+        int length = instructionLength(in->op);
+        int successors[2] = { i + length, -1 };
+
+        if (in->op == JMP || in->op == TAIL_CAL)
+            successors[0] = addressToIndex(in->m);
+        else if (in->op == JPC || in->op == CAL)
+            successors[1] = addressToIndex(in->m);
+        else if (in->op == FUSED_LCB && i + 1 < instructionCount)
+            successors[1] = addressToIndex(in[1].m);
+        else if ((in->op == OPR && in->m == RTN) || (in->op == SYS && in->m == 3))
+            successors[0] = -1;
+
+        // The operand word of a fused instruction is kept with it
+        if (length == 2 && i + 1 < instructionCount)
+            reachable[i + 1] = 1;
+
+        for (int k = 0; k < 2; k++)
+        {
+            int next = successors[k];
+            if (next >= 0 && next < instructionCount && !reachable[next])
+            {
+                reachable[next] = 1;
+                worklist[pending++] = next;
+            }
+        }
+    }
+
+    for (int i = 0; i < symbolCount; i++)
+    {
+        int entry = symbolTable[i].kind == 3 ? addressToIndex(symbolTable[i].address) : -1;
+        if (entry != -1 && entry < instructionCount && !reachable[entry])
+        {
+            symbolTable[i].address = -1;
+            prunedProcedures++;
+        }
+    }
+
+    // Jumps to a removed instruction (only possible from removed code) continue with whatever follows it
+    int count = 0;
+    for (int i = 0; i < instructionCount; i++)
+    {
+        newIndex[i] = count;
+        if (reachable[i])
+            newCode[count++] = instructions[i];
+    }
+    newIndex[instructionCount] = count;
+    prunedInstructions += instructionCount - count;
+
+    relocateCode(newCode, count, newIndex);
+    free(reachable);
+    free(worklist);
+    free(newIndex);
+    free(newCode);
+}
+
+// Helper function that prints what the enabled optimization passes did, and the size of the register form.
+void printOptimizationReport()
+{
+    if (registerCount >= 0)
+        printListing("\n\nRegister form: %d instructions (stack form: %d) for %d statements\n",
+            registerCount, instructionCount, statementCount);
+    if (!fuseEnabled && !foldEnabled && !peepholeEnabled && !pruneEnabled && !tailCallsEnabled && inlineLimit == 0)
+        return;
+
+    printListing("\n\nOptimizations:\n");
+    if (foldEnabled)
+        printListing("Folding: %d operations folded, %d constant conditions removed\n", foldedOperations, foldedBranches);
+    if (peepholeEnabled)
+        printListing("Peephole: %d instructions removed, %d jumps retargeted, %d jumps replaced by RTN/HALT\n",
+            peepholeRemoved, peepholeRetargeted, peepholeReturns);
+    if (tailCallsEnabled)
+        printListing("Tail calls: %d calls replaced by TCL\n", tailCalls);
+    if (pruneEnabled)
+        printListing("Pruning: %d unused procedures removed, %d unreachable instructions removed\n",
+            prunedProcedures, prunedInstructions);
+    if (inlineLimit > 0)
+    {
+        printListing("Inlining: %d call sites inlined, %d locals moved into callers' frames\n", inlinedSites, inlinedLocals);
+        for (int k = 0; k < symbolCount; k++)
+        {
+            if (inlinedCalls[k] > 0)
+                printListing("  %s: %d call sites\n", symbolTable[k].name, inlinedCalls[k]);
+        }
+    }
+    if (fuseEnabled)
+        printListing("Fusion: %d superinstructions, %d dispatches removed, %d instructions removed\n",
+            fusedSequences, fusedDispatches, fusedRemoved);
+}
+
+// Helper function that prints the generated assembly code.
+void printAssemblyCode() 
+{
+    // Print header
+    printListing("Assembly Code:\n\n");
+    printListing("Line OP L M\n");
+
+    // Print all instructions
+    for (int i = 0; i < instructionCount; i++) 
+    {
+        // printListing("%d %s %d %d\n", i, instructions[i].op, instructions[i].l, instructions[i].m);
+        printListing("%2d %s %d %d\n", i, getKindName(instructions[i].op), instructions[i].l, instructions[i].m);    
+
+        // Operand word of a fused instruction: raw fields
+        if (instructionLength(instructions[i].op) == 2 && i + 1 < instructionCount)
+        {
+            i++;
+            printListing("%2d     %d %d %d\n", i, instructions[i].op, instructions[i].l, instructions[i].m);
+        }
+    }
+}
+
+// Helper function that prints the symbol table.
+void printSymbolTable() 
+{
+    // Print table header
+    printListing("\n\nSymbol Table:\n");
+    printListing("Kind | Name      | Value | Level | Address | Mark\n");
+    printListing("-----------------------------------------------------\n");
+
+    // Print all symbols
+    for (int i = 0; i < symbolCount; i++) 
+    {
+        symbolTable[i].mark = 1; //
+        printListing("%4d | %-10s | %5d | %5d | %7d | %4d\n",
+            symbolTable[i].kind, 
+            symbolTable[i].name, 
+            symbolTable[i].value, 
+            symbolTable[i].level, 
+            symbolTable[i].address, 
+            symbolTable[i].mark);
+    }
+}
+
+// Helper function that returns the name of the instruction kind (based on opcode)
+const char* getKindName(int kind) 
+{
+    // Switch case to determine appropriate string
+    switch (kind) {
+        case 1: return "LIT";
+        case 2: return "OPR";
+        case 3: return "LOD";
+        case 4: return "STO";
+        case 5: return "CAL";
+        case 6: return "INC";
+        case 7: return "JMP";
+        case 8: return "JPC";
+        case 9: return "SYS";
+        case FUSED_INCV: return "INCV";
+        case FUSED_LCB: return "LCB";
+        case FUSED_LLB: return "LLB";
+        case TAIL_CAL: return "TCL";
+        default: return "OPR";
+    }
+}
+
+// Function that writes the P-code instructions as text ("op l m" per line), the VM's original input format
+void writeTextElf(const char *fileName)
+{
+    // Create the elf file for the VM input
+    FILE *output = fopen(fileName, "w");
+    if (!output)
+    {
+        fileError("Error creating elf file");
+    }
+
+    // Write the P-code instructions to the output file
+    for (int i = 0; i < instructionCount; i++) 
+    {
+        fprintf(output, "%d %d %d", instructions[i].op, instructions[i].l, instructions[i].m);
+        if(i < instructionCount - 1)
+        {
+            fprintf(output, "\n");
+        }
+    }
+    fclose(output);
+}
+
+// Function that writes the P-code instructions and symbol table in the binary elf format (see pcode.h)
+void writeBinaryElf(const char *fileName)
+{
+    FILE *output = fopen(fileName, "wb");
+    if (!output)
+    {
+        fileError("Error creating elf file");
+    }
+
+    // Header
+    PcodeHeader header;
+    memcpy(header.magic, PCODE_MAGIC, 4);
+    header.version = PCODE_VERSION;
+    header.instructionCount = instructionCount;
+    header.symbolCount = symbolCount;
+    fwrite(&header, sizeof(header), 1, output);
+
+    // Packed op/L/M array
+    for (int i = 0; i < instructionCount; i++)
+    {
+        PcodeInstruction instr = { instructions[i].op, instructions[i].l, instructions[i].m };
+        fwrite(&instr, sizeof(instr), 1, output);
+    }
+
+    // Symbol section
+    for (int i = 0; i < symbolCount; i++)
+    {
+        PcodeSymbol sym;
+        memset(&sym, 0, sizeof(sym));
+        sym.kind = symbolTable[i].kind;
+        sym.level = symbolTable[i].level;
+        sym.address = symbolTable[i].address;
+        sym.value = symbolTable[i].value;
+        strncpy(sym.name, symbolTable[i].name, PCODE_NAME_LENGTH - 1);
+        fwrite(&sym, sizeof(sym), 1, output);
+    }
+
+    if (fclose(output) != 0)
+    {
+        fileError("Error writing elf file");
+    }
+}
+
+// Helper function that copies the P-code into packed op/L/M words, the layout of the elf and the VM's TEXT segment.
+// The caller frees them.
+int *packInstructions()
+{
+    int *words = malloc(((size_t)instructionCount * 3 + 1) * sizeof(int));
+    if (!words)
+        error("Out of memory");
+    for (int i = 0; i < instructionCount; i++)
+    {
+        words[3 * i] = instructions[i].op;
+        words[3 * i + 1] = instructions[i].l;
+        words[3 * i + 2] = instructions[i].m;
+    }
+    return words;
+}
+
+// Function that translates the P-code instructions into register code and writes it as a register elf
+// (see regcode.h).
+void writeRegisterElf(const char *fileName)
+{
+    // The translator reads packed op/L/M words
+    int *words = packInstructions();
+    RegInstruction *code = NULL;
+    int count = 0;
+    int translated = regTranslate(words, instructionCount, 10, &code, &count);
+    free(words);
+    if (!translated)
+    {
+        error("The program can't be translated to register code");
+    }
+    registerCount = count;
+
+    FILE *output = fopen(fileName, "wb");
+    if (!output)
+    {
+        fileError("Error creating elf file");
+    }
+
+    // Header, then the instruction array
+    RegHeader header;
+    memcpy(header.magic, REGCODE_MAGIC, 4);
+    header.version = REGCODE_VERSION;
+    header.instructionCount = count;
+    header.stackCount = instructionCount;
+    fwrite(&header, sizeof(header), 1, output);
+    fwrite(code, sizeof(RegInstruction), count, output);
+    free(code);
+
+    if (fclose(output) != 0)
+    {
+        fileError("Error writing elf file");
+    }
+}
+
+// Helper function that adds bytes to a 64-bit FNV-1a hash
+uint64_t hashBytes(uint64_t hash, const void *bytes, size_t length)
+{
+    const unsigned char *p = bytes;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Helper function that builds the path of the cache entry of the loaded source: the hash of the compiler build,
+// the options that change the output, the source name (it's in the line table) and the source bytes
+void cachePath(char *path, size_t size, const char *inputName)
+{
+    char options[256];
+    snprintf(options, sizeof(options), "%s|%d|%d|%d|%d|%d|%d|%d|%d|%d", CACHE_BUILD, CACHE_VERSION, outputFormat,
+             fuseEnabled, foldEnabled, peepholeEnabled, pruneEnabled, tailCallsEnabled, inlineLimit, linesEnabled);
+    uint64_t hash = hashBytes(14695981039346656037ULL, options, strlen(options) + 1);
+    if (linesEnabled)
+        hash = hashBytes(hash, inputName, strlen(inputName) + 1);
+    hash = hashBytes(hash, source, sourceLength);
+    snprintf(path, size, "%s/%016llx.pl0c", cacheDirectory, (unsigned long long)hash);
+}
+
+// Helper function that reads a whole file into a new buffer. Returns NULL if it can't be read.
+char *readWholeFile(const char *fileName, size_t *length)
+{
+    int fd = open(fileName, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    char *bytes = malloc((size_t)info.st_size + 1);
+    size_t done = 0;
+    while (bytes && done < (size_t)info.st_size)
+    {
+        ssize_t count = read(fd, bytes + done, (size_t)info.st_size - done);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            break;
+        done += (size_t)count;
+    }
+    close(fd);
+    if (bytes && done != (size_t)info.st_size)
+    {
+        free(bytes);
+        return NULL;
+    }
+    *length = done;
+    return bytes;
+}
+
+// Helper function that writes bytes to a new file. Returns 0 on failure.
+int writeWholeFile(const char *fileName, const char *bytes, size_t length)
+{
+    FILE *output = fopen(fileName, "wb");
+    if (!output)
+        return 0;
+    int ok = fwrite(bytes, 1, length, output) == length;
+    return fclose(output) == 0 && ok;
+}
+
+// Function that compiles the loaded source from the cache: prints the cached listing and writes the cached elf and
+// line table. Returns 0 if there is no entry for it (or it can't be used).
+int readCache(const char *inputName, const char *elfName)
+{
+    char path[4096];
+    size_t length = 0;
+    cachePath(path, sizeof(path), inputName);
+    char *entry = readWholeFile(path, &length);
+    if (!entry)
+        return 0;
+
+    // The sizes must add up to the file, and the source length must match (a cheap check against collisions)
+    CacheHeader header;
+    if (length < sizeof(header))
+    {
+        free(entry);
+        return 0;
+    }
+    memcpy(&header, entry, sizeof(header));
+    if (memcmp(header.magic, CACHE_MAGIC, 4) != 0 || header.version != CACHE_VERSION ||
+        header.sourceLength != sourceLength ||
+        sizeof(header) + (size_t)header.listingLength + header.elfLength + header.linesLength != length)
+    {
+        free(entry);
+        return 0;
+    }
+    const char *listingText = entry + sizeof(header);
+    const char *elf = listingText + header.listingLength;
+    const char *lines = elf + header.elfLength;
+
+    char linesName[4096];
+    snprintf(linesName, sizeof(linesName), "%s%s", elfName, PCODE_LINES_SUFFIX);
+    if (!writeWholeFile(elfName, elf, header.elfLength))
+    {
+        free(entry);
+        fileError("Error creating elf file");
+    }
+    if (header.linesLength > 0 && !writeWholeFile(linesName, lines, header.linesLength))
+    {
+        free(entry);
+        fileError("Error creating line table");
+    }
+    printListing("%.*s", (int)header.listingLength, listingText);
+
+    // Used entries are the newest for eviction
+    utimensat(AT_FDCWD, path, NULL, 0);
+    lexCount = (int)header.lexemes;
+    instructionCount = (int)header.instructions;
+    atomic_fetch_add(&cacheHits, 1);
+    free(entry);
+    return 1;
+}
+
+// Cache entry seen by evictCache
+typedef struct {
+    char name[300];
+    long long size;
+    struct timespec used; // Last write, or last hit (see readCache)
+} CacheEntry;
+
+// Helper function that orders cache entries from the least recently used
+int compareCacheEntries(const void *a, const void *b)
+{
+    const CacheEntry *x = a, *y = b;
+    if (x->used.tv_sec != y->used.tv_sec)
+        return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    return x->used.tv_nsec < y->used.tv_nsec ? -1 : x->used.tv_nsec > y->used.tv_nsec;
+}
+
+// Function that measures the cache directory and, when it's over the limit, deletes the least recently used entries
+// until it's down to 90% of it. Temporary files of compilers that died while writing are removed after an hour.
+// Called with cacheLock held.
+void evictCache()
+{
+    DIR *directory = opendir(cacheDirectory);
+    if (!directory)
+        return;
+    CacheEntry *entries = NULL;
+    int count = 0, capacity = 0;
+    long long total = 0;
+    time_t now = time(NULL);
+    struct dirent *item;
+    while ((item = readdir(directory)))
+    {
+        char path[4096];
+        struct stat info;
+        size_t nameLength = strlen(item->d_name);
+        int isEntry = nameLength > 5 && strcmp(item->d_name + nameLength - 5, ".pl0c") == 0;
+        int isTemporary = strncmp(item->d_name, ".tmp-", 5) == 0;
+        if ((!isEntry && !isTemporary) || nameLength >= sizeof(entries->name))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", cacheDirectory, item->d_name);
+        if (stat(path, &info) != 0 || !S_ISREG(info.st_mode))
+            continue;
+        if (isTemporary)
+        {
+            if (now - info.st_mtime > 3600)
+                unlink(path);
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 256;
+            CacheEntry *grown = realloc(entries, capacity * sizeof(CacheEntry));
+            if (!grown)
+                break;
+            entries = grown;
+        }
+        snprintf(entries[count].name, sizeof(entries->name), "%s", item->d_name);
+        entries[count].size = info.st_size;
+        entries[count].used = info.st_mtim;
+        total += info.st_size;
+        count++;
+    }
+    closedir(directory);
+
+    if (total > cacheLimit && entries)
+    {
+        qsort(entries, count, sizeof(CacheEntry), compareCacheEntries);
+        for (int i = 0; i < count && total > cacheLimit / 10 * 9; i++)
+        {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s", cacheDirectory, entries[i].name);
+            if (unlink(path) == 0 || errno == ENOENT) // Another compiler may have evicted it already
+                total -= entries[i].size;
+        }
+    }
+    cacheBytes = total;
+    free(entries);
+}
+
+// Function that stores the compilation that just finished in the cache: the captured listing, and the elf and line
+// table as written. Failures only mean that it isn't cached.
+void writeCache(const char *inputName, const char *elfName)
+{
+    char path[4096], temporary[4096], linesName[4096];
+    size_t elfLength = 0, linesLength = 0;
+    cachePath(path, sizeof(path), inputName);
+    snprintf(linesName, sizeof(linesName), "%s%s", elfName, PCODE_LINES_SUFFIX);
+    char *elf = readWholeFile(elfName, &elfLength);
+    char *lines = linesEnabled && outputFormat != FORMAT_REGISTER ? readWholeFile(linesName, &linesLength) : NULL;
+    if (!elf || !capturing)
+    {
+        free(elf);
+        free(lines);
+        return;
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, 4);
+    header.version = CACHE_VERSION;
+    header.sourceLength = sourceLength;
+    header.listingLength = (uint32_t)capturedLength;
+    header.elfLength = (uint32_t)elfLength;
+    header.linesLength = (uint32_t)linesLength;
+    header.lexemes = (uint32_t)lexCount;
+    header.instructions = (uint32_t)instructionCount;
+
+    // Write a temporary file in the cache directory, then rename it over the entry (atomic on POSIX)
+    snprintf(temporary, sizeof(temporary), "%s/.tmp-XXXXXX", cacheDirectory);
+    int fd = mkstemp(temporary);
+    if (fd >= 0)
+        fchmod(fd, 0644); // mkstemp makes it private, but the cache can be shared
+    FILE *output = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    int ok = output != NULL;
+    if (ok)
+    {
+        ok = fwrite(&header, sizeof(header), 1, output) == 1 &&
+             fwrite(capturedListing ? capturedListing : "", 1, capturedLength, output) == capturedLength &&
+             fwrite(elf, 1, elfLength, output) == elfLength &&
+             fwrite(lines ? lines : "", 1, linesLength, output) == linesLength;
+        ok = fclose(output) == 0 && ok;
+    }
+    else if (fd >= 0)
+        close(fd);
+    if (fd >= 0 && (!ok || rename(temporary, path) != 0))
+        unlink(temporary);
+    free(elf);
+    free(lines);
+
+    // Keep the directory under its limit. The size is measured once, then tracked, and measured again when the
+    // tracked size goes over the limit (other processes write to the cache too).
+    if (ok)
+    {
+        pthread_mutex_lock(&cacheLock);
+        if (cacheBytes >= 0)
+            cacheBytes += (long long)(sizeof(header) + capturedLength + elfLength + linesLength);
+        if (cacheBytes < 0 || cacheBytes > cacheLimit)
+            evictCache();
+        pthread_mutex_unlock(&cacheLock);
+    }
+}
+
+// Helper function that returns the microseconds since the current stage started and starts the next one
+long long endStage()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long elapsed = (now.tv_sec - stageStart.tv_sec) * 1000000LL + (now.tv_nsec - stageStart.tv_nsec) / 1000;
+    stageStart = now;
+    return elapsed;
+}
+
+// Function that compiles one source file: lexing, parsing and code generation, the optimization passes, then the
+// listing and the elf file. Returns 0 if the source can't be read; other errors end the compilation (see
+// stopCompiling).
+int compileFile(const char *inputName, const char *elfName)
+{
+    // Load input file
+    endStage();
+    if (!loadSource(inputName))
+        return 0;
+    
+    readTime = endStage();
+
+    // A cached compilation of the same source with the same options replaces all the other stages
+    if (cacheDirectory && readCache(inputName, elfName))
+    {
+        outputTime = endStage();
+        if (timingEnabled && !errorExit)
+            fprintf(stderr, "Timing: read %lld us, cache hit, output %lld us\n", readTime, outputTime);
+        return 1;
+    }
+    capturing = cacheDirectory != NULL;
+
+    // Do lexical analysis on input file
+    lexicalAnalyzer();
+    lexTime = endStage();
+    
+    // Parse lexemes and generate P-code instructions 
+    program();
+    parseTime = endStage();
+
+    // Optimization passes
+    if (inlineLimit > 0)
+        inlineProcedures();
+    if (peepholeEnabled)
+        peepholeInstructions();
+    if (tailCallsEnabled)
+        tailCallInstructions();
+    if (pruneEnabled)
+    {
+        pruneInstructions();
+        if (peepholeEnabled)
+            peepholeInstructions(); // Removed code can leave a JMP to the next instruction
+    }
+    if (fuseEnabled)
+        fuseInstructions();
+    optimizeTime = endStage();
+
+    // The register form is translated from the final P-code
+    if (outputFormat == FORMAT_REGISTER)
+        writeRegisterElf(elfName);
+    
+    // Print the generated assembly code and symbol table
+    printListing("No errors, program is syntactically correct.\n\n");
+    printAssemblyCode();
+    printSymbolTable();
+    printOptimizationReport();
+    
+    // Create the elf file for the VM input: text or binary, with its line table
+    if (outputFormat == FORMAT_BINARY)
+        writeBinaryElf(elfName);
+    else if (outputFormat == FORMAT_TEXT)
+        writeTextElf(elfName);
+    if (linesEnabled && outputFormat != FORMAT_REGISTER)
+        writeLineTable(elfName, inputName);
+    if (cacheDirectory)
+        writeCache(inputName, elfName);
+    outputTime = endStage();
+
+    // Stage times go to stderr, so they can be read apart from the listing
+    if (timingEnabled && !errorExit)
+        fprintf(stderr, "Timing: read %lld us, lex %lld us (%d lexemes), parse %lld us (%d instructions), "
+                "optimize %lld us, output %lld us\n", readTime, lexTime, lexCount, parseTime, instructionCount,
+                optimizeTime, outputTime);
+    
+    return 1;
+}
+
+// Helper function that frees the state of the last compilation on this thread, so the next one starts clean
+void resetCompiler()
+{
+    if (source && sourceMapped)
+        munmap((void *)source, sourceLength);
+    else
+        free((void *)source);
+    for (int i = 0; i < internCapacity; i++)
+        free((void *)internTable[i].text);
+    free(lexemes);
+    free(lexErrors);
+    free(symbolTable);
+    free(internTable);
+    free(scopeHeads);
+    free(instructions);
+    free(inlinedCalls);
+
+    source = NULL;
+    sourceLength = 0;
+    lexemes = NULL;
+    lexErrors = NULL;
+    symbolTable = NULL;
+    internTable = NULL;
+    scopeHeads = NULL;
+    instructions = NULL;
+    inlinedCalls = NULL;
+    currentLevel = tokenIndex = 0;
+    lexCount = lexCapacity = errorCount = errorCapacity = 0;
+    symbolCount = symbolCapacity = internCount = internCapacity = scopeCapacity = 0;
+    instructionCount = instructionCapacity = 0;
+    fusedSequences = fusedDispatches = fusedRemoved = 0;
+    peepholeRemoved = peepholeRetargeted = peepholeReturns = 0;
+    prunedProcedures = prunedInstructions = inlinedSites = inlinedLocals = 0;
+    foldedOperations = foldedBranches = statementCount = tailCalls = 0;
+    registerCount = -1;
+    errorMessage[0] = '\0';
+    free(capturedListing);
+    capturedListing = NULL;
+    capturedLength = capturedCapacity = 0;
+    capturing = 0;
+}
+
+// Helper function that builds the path of a batch output: the input's path (or its file name in the output
+// directory) with the extension appended
+void outputPath(char *path, size_t size, const char *input, const char *extension)
+{
+    const char *name = strrchr(input, '/');
+    if (outputDirectory)
+        snprintf(path, size, "%s/%s%s", outputDirectory, name ? name + 1 : input, extension);
+    else
+        snprintf(path, size, "%s%s", input, extension);
+}
+
+// Worker thread of a batch: takes the next job until there are none left, and compiles it with this thread's
+// compiler state
+void *batchWorker(void *unused)
+{
+    (void)unused;
+    static const char *extensions[] = { ".elf.txt", ".elf.bin", ".elf.reg" };
+    jmp_buf stop;
+    char elfName[4096], listingName[4096];
+
+    for (;;)
+    {
+        int index = atomic_fetch_add(&batchNext, 1);
+        if (index >= batchCount)
+            break;
+        BatchJob *job = &batchJobs[index];
+        outputPath(elfName, sizeof(elfName), job->input, extensions[outputFormat]);
+        outputPath(listingName, sizeof(listingName), job->input, ".lst");
+
+        listing = listingEnabled ? fopen(listingName, "w") : NULL;
+        errorExit = &stop;
+        if (setjmp(stop) == 0)
+        {
+            job->ok = compileFile(job->input, elfName);
+            if (!job->ok)
+                snprintf(job->message, sizeof(job->message), "Can't open the file: %s", strerror(errno));
+        }
+        else
+            snprintf(job->message, sizeof(job->message), "%s", errorMessage);
+        job->lexemes = lexCount;
+        job->instructions = instructionCount;
+        errorExit = NULL;
+
+        if (listing)
+            fclose(listing);
+        resetCompiler();
+    }
+    return NULL;
+}
+
+// Helper function that adds an input to the batch
+void addBatchInput(const char *input)
+{
+    if (batchCount == batchCapacity)
+    {
+        batchCapacity = batchCapacity ? 2 * batchCapacity : 256;
+        batchJobs = realloc(batchJobs, batchCapacity * sizeof(BatchJob));
+        if (!batchJobs)
+        {
+            printf("Error: Out of memory\n");
+            exit(1);
+        }
+    }
+    memset(&batchJobs[batchCount], 0, sizeof(BatchJob));
+    batchJobs[batchCount++].input = input;
+}
+
+// Helper function that adds the inputs listed in a file (one path per line, "-" = stdin) to the batch.
+// Returns 0 if the file can't be read.
+int readBatchList(const char *fileName)
+{
+    FILE *input = strcmp(fileName, "-") == 0 ? stdin : fopen(fileName, "r");
+    if (!input)
+        return 0;
+
+    char line[4096];
+    while (fgets(line, sizeof(line), input))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0])
+            addBatchInput(strdup(line));
+    }
+    if (input != stdin)
+        fclose(input);
+    return 1;
+}
+
+// Function that compiles every input of the batch on a pool of worker threads, then reports the failures and
+// the throughput. Returns 1 if every input compiled.
+int runBatch(int threads)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (threads > batchCount)
+        threads = batchCount > 0 ? batchCount : 1;
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    int started = 0;
+    while (workers && started < threads && pthread_create(&workers[started], NULL, batchWorker, NULL) == 0)
+        started++;
+    if (started == 0)
+        batchWorker(NULL); // No threads: compile everything here
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+
+    stageStart = start;
+    double seconds = endStage() / 1e6;
+    long long lexemeTotal = 0, instructionTotal = 0;
+    int failed = 0;
+    for (int i = 0; i < batchCount; i++)
+    {
+        lexemeTotal += batchJobs[i].lexemes;
+        instructionTotal += batchJobs[i].instructions;
+        if (!batchJobs[i].ok)
+        {
+            failed++;
+            fprintf(stderr, "%s: Error: %s\n", batchJobs[i].input, batchJobs[i].message);
+        }
+    }
+    if (seconds <= 0)
+        seconds = 1e-6;
+    printf("Batch: %d files compiled, %d failed, on %d threads in %.1f ms: %.0f files/s, %.0f lexemes/s, "
+           "%.0f instructions/s", batchCount - failed, failed, started > 0 ? started : 1, seconds * 1000,
+           batchCount / seconds, lexemeTotal / seconds, instructionTotal / seconds);
+    if (cacheDirectory)
+        printf(", %d from the cache", atomic_load(&cacheHits));
+    printf("\n");
+    return failed == 0;
+}
+
+// Function that implements a PL/0 tiny compiler and generates P-code instructions
+int main(int argc, char *argv[]) 
+{
+    // Parse options; the last non-option argument is the input file
+    const char *inputName = NULL;
+    int badOption = 0, batchMode = 0, jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 1; i < argc; i++)
+    {
+        int limit;
+        if (strcmp(argv[i], "--format=text") == 0)
+            outputFormat = FORMAT_TEXT;
+        else if (strcmp(argv[i], "--format=binary") == 0)
+            outputFormat = FORMAT_BINARY;
+        else if (strcmp(argv[i], "--format=register") == 0)
+            outputFormat = FORMAT_REGISTER;
+        else if (strcmp(argv[i], "--fuse") == 0)
+            fuseEnabled = 1;
+        else if (strcmp(argv[i], "--fold") == 0)
+            foldEnabled = 1;
+        else if (strcmp(argv[i], "--peephole") == 0)
+            peepholeEnabled = 1;
+        else if (strcmp(argv[i], "--prune") == 0)
+            pruneEnabled = 1;
+        else if (strcmp(argv[i], "--tail-calls") == 0)
+            tailCallsEnabled = 1;
+        else if (strcmp(argv[i], "--inline") == 0)
+            inlineLimit = INLINE_LIMIT;
+        else if (sscanf(argv[i], "--inline=%d", &limit) == 1 && limit > 0)
+            inlineLimit = limit;
+        else if (strcmp(argv[i], "--timing") == 0)
+            timingEnabled = 1;
+        else if (strcmp(argv[i], "--no-lines") == 0)
+            linesEnabled = 0;
+        else if (strncmp(argv[i], "--cache=", 8) == 0 && argv[i][8])
+            cacheDirectory = argv[i] + 8;
+        else if (sscanf(argv[i], "--cache-size=%d", &limit) == 1 && limit > 0)
+            cacheLimit = (long long)limit << 20;
+        else if (strcmp(argv[i], "--batch") == 0)
+            batchMode = 1;
+        else if (strncmp(argv[i], "--batch=", 8) == 0)
+        {
+            batchMode = 1;
+            if (!readBatchList(argv[i] + 8))
+            {
+                perror("Error opening batch list");
+                return 1;
+            }
+        }
+        else if (sscanf(argv[i], "--jobs=%d", &limit) == 1 && limit > 0)
+            jobs = limit;
+        else if (strncmp(argv[i], "--out-dir=", 10) == 0 && argv[i][10])
+            outputDirectory = argv[i] + 10;
+        else if (strcmp(argv[i], "--listing") == 0)
+            listingEnabled = 1;
+        else if (argv[i][0] == '-')
+            badOption = 1; // Unknown option
+        else
+        {
+            inputName = argv[i];
+            addBatchInput(argv[i]); // Used if --batch is given
+        }
+    }
+    if (jobs < 1)
+        jobs = 1;
+
+    // Check for input file
+    if (badOption || (!inputName && !batchMode)) {
+        printf("Usage: %s [--format=text|binary|register] [--fold] [--inline[=N]] [--peephole] [--tail-calls] [--prune] [--fuse] [--timing] [--no-lines] [--cache=DIR [--cache-size=MB]] <input_file>\n", argv[0]);
+        printf("       %s [options] --batch[=LIST] [--jobs=N] [--out-dir=DIR] [--listing] [input_file...]\n", argv[0]);
+        return 1;
+    }
+    
+    // The cache directory is created on first use
+    if (cacheDirectory && mkdir(cacheDirectory, 0777) != 0 && errno != EEXIST)
+    {
+        perror("Error creating cache directory");
+        return 1;
+    }
+
+    // Batch mode: compile every input on the worker threads
+    if (batchMode)
+        return runBatch(jobs) ? 0 : 1;
+
+    // Compile the one input into elf.txt, elf.bin or elf.reg, with the listing on stdout
+    listing = stdout;
+    static const char *elfNames[] = { "elf.txt", "elf.bin", "elf.reg" };
+    if (!compileFile(inputName, elfNames[outputFormat]))
+    {
+        perror("Error opening file"); // Error opening file
+        return 1;
     }
-    fclose(output);
     
     // End program successfully
     return 0;
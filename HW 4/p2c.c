@@ -0,0 +1,476 @@
+/*
+ * COP 3402 Systems Software
+ * Homework 4: P-code to C translator
+ * Author: Esteban Ramirez
+ * Description: Translates an elf program (text or binary, as written by hw4compiler.c) into a standalone C
+ *              program that runs it natively. Same output as "vm --quiet" on the same input.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "pcode.h"
+
+#define STACK_SIZE 500 // Default stack size of vm.c (--stack=N)
+#define TEXT_START 10  // Address of the first instruction
+
+// Loaded program
+int *text = NULL;   // op, l, m words
+int textWords = 0;  // Words in text (3 per instruction)
+int stackSize = STACK_SIZE; // Words in the translated program's stack
+
+// Per-instruction flags
+char *isLabel = NULL;       // Instruction is a jump/call target or a return site
+char *isOperandWord = NULL; // Slot is the operand word of a fused opcode (never executed)
+int needsBase = 0;          // Some instruction goes 2 or more static links down
+int hasReturn = 0;          // Some instruction is a RTN
+int jumpsToInvalid = 0;     // Some goto leaves the program
+
+// Helper function that returns the C operator of an arithmetic/comparison OPR code, or NULL if invalid
+const char *operatorName(int op)
+{
+    switch (op)
+    {
+    case 1: return "+";
+    case 2: return "-";
+    case 3: return "*";
+    case 4: return "/";
+    case 5: return "==";
+    case 6: return "!=";
+    case 7: return "<";
+    case 8: return "<=";
+    case 9: return ">";
+    case 10: return ">=";
+    case 11: return "%";
+    default: return NULL;
+    }
+}
+
+// Helper function that returns 1 if address is the start of an instruction of the program
+int isInstruction(int address)
+{
+    int offset = address - TEXT_START;
+    return offset >= 0 && offset % 3 == 0 && offset < textWords && !isOperandWord[offset / 3];
+}
+
+// Helper function that prints the C expression for base(BP, l) (a static link chain)
+void printBase(FILE *out, int l)
+{
+    if (l == 0)
+        fprintf(out, "BP");
+    else if (l == 1)
+        fprintf(out, "PAS[BP]");
+    else
+        fprintf(out, "base(BP, %d)", l);
+}
+
+// Helper function that writes the C expression for the variable at (l, m) into buffer
+void variableText(char *buffer, size_t size, int l, int m)
+{
+    if (l == 0)
+        snprintf(buffer, size, "PAS[BP - %d]", m);
+    else if (l == 1)
+        snprintf(buffer, size, "PAS[PAS[BP] - %d]", m);
+    else
+        snprintf(buffer, size, "PAS[base(BP, %d) - %d]", l, m);
+}
+
+// Helper function that prints the C expression for "a op b". +, - and * wrap around like the VM does
+// on two's complement hardware (signed overflow is undefined in C).
+void printOperation(FILE *out, int op, const char *a, const char *b)
+{
+    if (op >= 1 && op <= 3)
+        fprintf(out, "(int)((unsigned)%s %s (unsigned)%s)", a, operatorName(op), b);
+    else if (operatorName(op))
+        fprintf(out, "(%s %s %s)", a, operatorName(op), b);
+    else
+        fprintf(out, "0"); // Invalid code: the VM evaluates it to 0
+}
+
+// Helper function that prints a goto to a code address (jumps outside the program stop it like the VM does)
+void printGoto(FILE *out, int address)
+{
+    if (isInstruction(address))
+        fprintf(out, "goto L%d;", address);
+    else
+    {
+        fprintf(out, "goto invalid;");
+        jumpsToInvalid = 1;
+    }
+}
+
+// Function that loads an elf program. Binary elf files (PCODE_MAGIC) are read whole, anything else is read
+// as "op l m" triples until the end of the file. Returns 1 on success, 0 otherwise.
+int loadProgram(const char *fileName)
+{
+    FILE *input = fopen(fileName, "rb");
+    if (!input)
+    {
+        printf("Error: File was not found or can't be opened\n");
+        return 0;
+    }
+
+    // Binary format: header, instruction array (symbols are not needed)
+    PcodeHeader header;
+    if (fread(&header, sizeof(header), 1, input) == 1 && memcmp(header.magic, PCODE_MAGIC, 4) == 0)
+    {
+        if (header.version != PCODE_VERSION || header.instructionCount > INT_MAX / 3 - 1)
+        {
+            printf("Error: Unsupported or truncated binary elf file\n");
+            fclose(input);
+            return 0;
+        }
+        textWords = 3 * (int)header.instructionCount;
+        text = malloc((textWords + 3) * sizeof(int));
+        if (!text || fread(text, sizeof(PcodeInstruction), header.instructionCount, input) != header.instructionCount)
+        {
+            printf("Error: Unsupported or truncated binary elf file\n");
+            fclose(input);
+            return 0;
+        }
+        fclose(input);
+        return 1;
+    }
+    rewind(input);
+
+    // Text format: same loop as vm.c (a short last line is padded with zeros)
+    int capacity = 0, fields;
+    int word[3];
+    while ((fields = fscanf(input, "%d %d %d", &word[0], &word[1], &word[2])) != EOF && fields > 0)
+    {
+        if (textWords + 3 > capacity)
+        {
+            capacity = capacity ? capacity * 2 : 3 * 1024;
+            int *grown = realloc(text, (capacity + 3) * sizeof(int));
+            if (!grown)
+            {
+                printf("Error: Out of memory\n");
+                fclose(input);
+                return 0;
+            }
+            text = grown;
+        }
+        for (int i = 0; i < 3; i++)
+            text[textWords + i] = i < fields ? word[i] : 0;
+        textWords += 3;
+        if (fields < 3)
+            break;
+    }
+    if (!text)
+        text = calloc(3, sizeof(int));
+    fclose(input);
+    return text != NULL;
+}
+
+// Function that finds the fused operand words and every address that needs a label
+void markLabels()
+{
+    int count = textWords / 3;
+    isLabel = calloc(count + 1, 1);
+    isOperandWord = calloc(count + 1, 1);
+    if (!isLabel || !isOperandWord)
+    {
+        printf("Error: Out of memory\n");
+        exit(1);
+    }
+
+    // Operand words first, so targets can be checked against them
+    for (int i = 0; i < count; i++)
+    {
+        int op = text[3 * i];
+        if (op >= FUSED_INCV && op <= FUSED_LLB && i + 1 < count)
+            isOperandWord[++i] = 1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (isOperandWord[i])
+            continue;
+        int op = text[3 * i], l = text[3 * i + 1], m = text[3 * i + 2];
+        int target = -1;
+        if ((op >= 3 && op <= 5) || (op >= FUSED_INCV && op <= FUSED_LLB) || op == TAIL_CAL)
+            needsBase |= l >= 2;
+        if (op == FUSED_LLB && i + 1 < count)
+            needsBase |= text[3 * i + 4] >= 2;
+        if (op == 2 && m == 0)
+            hasReturn = 1;
+        if (op == 5 || op == 7 || op == 8 || (op == TAIL_CAL && l >= 1))
+            target = m;
+        else if (op == FUSED_LCB && i + 1 < count)
+            target = text[3 * i + 5];
+        if (target != -1 && isInstruction(target))
+            isLabel[(target - TEXT_START) / 3] |= 1;
+
+        // The instruction after a call is where its RTN comes back
+        if (op == 5 && i + 1 < count)
+            isLabel[i + 1] |= 2;
+    }
+
+    // Without a RTN nothing comes back to a call site
+    for (int i = 0; i < count && !hasReturn; i++)
+        isLabel[i] &= 1;
+}
+
+// Function that writes the instruction at index i as C code
+void translateInstruction(FILE *out, int i)
+{
+    int count = textWords / 3;
+    int address = TEXT_START + 3 * i;
+    int op = text[3 * i], l = text[3 * i + 1], m = text[3 * i + 2];
+    int x = 0, y = 0, z = 0;
+    char var[64], var2[64];
+
+    // Fused opcodes read their operand word; a truncated one is invalid
+    if (op >= FUSED_INCV && op <= FUSED_LLB)
+    {
+        if (i + 1 >= count)
+            op = 0;
+        else
+        {
+            x = text[3 * i + 3];
+            y = text[3 * i + 4];
+            z = text[3 * i + 5];
+        }
+    }
+
+    if (isLabel[i])
+        fprintf(out, "L%d:\n", address);
+    fprintf(out, "    /* %d: %d %d %d */ ", address, op, l, m);
+
+    switch (op)
+    {
+    case 1: // LIT
+        fprintf(out, "SP--; PAS[SP] = %d;\n", m);
+        break;
+    case 2: // OPR
+        if (m == 0) // RTN: back to the return address stored in the frame
+            fprintf(out, "SP = BP + 1; BP = PAS[SP - 2]; ra = PAS[SP - 3]; goto ret;\n");
+        else if (operatorName(m))
+        {
+            fprintf(out, "PAS[SP + 1] = ");
+            printOperation(out, m, "PAS[SP + 1]", "PAS[SP]");
+            fprintf(out, "; SP++;\n");
+        }
+        else
+            fprintf(out, "printf(\"Invalid OPR instruction.\\n\"); return 0;\n");
+        break;
+    case 3: // LOD
+        variableText(var, sizeof(var), l, m);
+        fprintf(out, "SP--; PAS[SP] = %s;\n", var);
+        break;
+    case 4: // STO
+        variableText(var, sizeof(var), l, m);
+        fprintf(out, "%s = PAS[SP]; SP++;\n", var);
+        break;
+    case 5: // CAL: same frame layout as the VM (static link, dynamic link, return address)
+        fprintf(out, "PAS[SP - 1] = ");
+        printBase(out, l);
+        fprintf(out, "; PAS[SP - 2] = BP; PAS[SP - 3] = %d; BP = SP - 1; ", address + 3);
+        printGoto(out, m);
+        fprintf(out, "\n");
+        break;
+    case TAIL_CAL: // TCL: new static link in the current frame, which the called procedure takes over
+        if (l < 1)
+        {
+            fprintf(out, "goto invalid;\n");
+            jumpsToInvalid = 1;
+            break;
+        }
+        fprintf(out, "PAS[BP] = ");
+        printBase(out, l);
+        fprintf(out, "; SP = BP + 1; ");
+        printGoto(out, m);
+        fprintf(out, "\n");
+        break;
+    case 6: // INC: the one instruction whose SP is checked, as in the VM (it can move SP past a guard region)
+        fprintf(out, "if ((unsigned long long)((long long)SP - %d) > STACK_WORDS) stackOverflow(); SP -= %d;\n", m, m);
+        break;
+    case 7: // JMP
+        printGoto(out, m);
+        fprintf(out, "\n");
+        break;
+    case 8: // JPC
+        fprintf(out, "if (PAS[SP++] == 0) ");
+        printGoto(out, m);
+        fprintf(out, "\n");
+        break;
+    case 9: // SYS
+        if (m == 1)
+            fprintf(out, "printf(\"Output result is: %%d\\n\", PAS[SP]); SP++;\n");
+        else if (m == 2)
+            fprintf(out, "SP--; scanf(\"%%d\", &PAS[SP]);\n");
+        else if (m == 3)
+            fprintf(out, "return 0;\n");
+        else
+            fprintf(out, "; /* no-op */\n");
+        break;
+    case FUSED_INCV: // INCV: var += z
+        variableText(var, sizeof(var), l, m);
+        snprintf(var2, sizeof(var2), "%d", z);
+        fprintf(out, "%s = ", var);
+        printOperation(out, 1, var, var2);
+        fprintf(out, ";\n");
+        break;
+    case FUSED_LCB: // LCB: jump to z unless (var x y)
+        variableText(var, sizeof(var), l, m);
+        snprintf(var2, sizeof(var2), "%d", y);
+        fprintf(out, "if (!");
+        printOperation(out, x, var, var2);
+        fprintf(out, ") ");
+        printGoto(out, z);
+        fprintf(out, "\n");
+        break;
+    case FUSED_LLB: // LLB: push var x var(y, z)
+        variableText(var, sizeof(var), l, m);
+        variableText(var2, sizeof(var2), y, z);
+        fprintf(out, "SP--; PAS[SP] = ");
+        printOperation(out, x, var, var2);
+        fprintf(out, ";\n");
+        break;
+    default:
+        fprintf(out, "goto invalid;\n");
+        jumpsToInvalid = 1;
+        break;
+    }
+}
+
+// Stack of every translated program (after "#define STACK_WORDS N"). Its words sit in one static array between two
+// guard regions that are made inaccessible at startup, as in vm.c, so a program that runs out of stack stops with the
+// VM's error, and only INC checks SP. One array keeps every access at a fixed place for the C compiler to optimize.
+static const char stackSupport[] =
+    "#define STACK_GUARD (64 * 1024) // Bytes of inaccessible memory on both sides of the stack (whole pages)\n"
+    "_Alignas(STACK_GUARD) int stackMemory[(2 * STACK_GUARD + (STACK_WORDS * 4 + STACK_GUARD - 1) / STACK_GUARD\n"
+    "                                       * STACK_GUARD) / 4];\n"
+    "#define PAS (stackMemory + STACK_GUARD / 4)\n"
+    "char *guardLow, *guardHigh;\n"
+    "\n"
+    "// Prints the VM's stack overflow error and stops\n"
+    "_Noreturn static void stackOverflow(void)\n"
+    "{\n"
+    "    static const char message[] = \"Error: Stack overflow (use a larger --stack=N)\\n\";\n"
+    "    fflush(stdout);\n"
+    "    if (write(STDOUT_FILENO, message, sizeof(message) - 1) < 0)\n"
+    "        _exit(2);\n"
+    "    _exit(1);\n"
+    "}\n"
+    "\n"
+    "// Reports an access to the guard regions as a stack overflow. Anything else is a real crash.\n"
+    "static void stackFault(int sig, siginfo_t *info, void *context)\n"
+    "{\n"
+    "    (void)context;\n"
+    "    char *address = info->si_addr;\n"
+    "    if ((address >= guardLow && address < guardLow + STACK_GUARD) ||\n"
+    "        (address >= guardHigh && address < guardHigh + STACK_GUARD))\n"
+    "        stackOverflow();\n"
+    "    signal(sig, SIG_DFL);\n"
+    "}\n"
+    "\n"
+    "// Makes the guard regions inaccessible: the one below the stack, and the one above its last page. Returns 0 on\n"
+    "// failure.\n"
+    "static int protectStack(void)\n"
+    "{\n"
+    "    size_t page = (size_t)sysconf(_SC_PAGESIZE);\n"
+    "    guardLow = (char *)stackMemory;\n"
+    "    guardHigh = (char *)PAS + (STACK_WORDS * sizeof(int) + page - 1) / page * page;\n"
+    "    if (page > STACK_GUARD || mprotect(guardLow, STACK_GUARD, PROT_NONE) != 0 ||\n"
+    "        mprotect(guardHigh, STACK_GUARD, PROT_NONE) != 0)\n"
+    "        return 0;\n"
+    "\n"
+    "    struct sigaction action;\n"
+    "    memset(&action, 0, sizeof(action));\n"
+    "    action.sa_sigaction = stackFault;\n"
+    "    action.sa_flags = SA_SIGINFO;\n"
+    "    sigaction(SIGSEGV, &action, NULL);\n"
+    "    sigaction(SIGBUS, &action, NULL);\n"
+    "    return 1;\n"
+    "}\n"
+    "\n";
+
+// Function that writes the C translation of the loaded program
+void translateProgram(FILE *out, const char *fileName)
+{
+    int count = textWords / 3;
+
+    fprintf(out, "/* Translated from %s by p2c. Build: gcc -O2 -o program <this file> */\n\n", fileName);
+    fprintf(out, "#define _DEFAULT_SOURCE // POSIX mmap with -std=c17\n\n");
+    fprintf(out, "#include <signal.h>\n#include <stdio.h>\n#include <string.h>\n#include <sys/mman.h>\n#include <unistd.h>\n\n");
+
+    // Memory: the stack only, the code is not addressable (as in the VM)
+    fprintf(out, "#define STACK_WORDS %d\n", stackSize);
+    fputs(stackSupport, out);
+
+    if (needsBase)
+    {
+        fprintf(out, "// Follows static links l levels down\n");
+        fprintf(out, "static int base(int bp, int l)\n{\n    while (l-- > 0)\n        bp = PAS[bp];\n    return bp;\n}\n\n");
+    }
+
+    fprintf(out, "int main(void)\n{\n");
+    fprintf(out, "    int BP = %d, SP = %d;\n", stackSize - 1, stackSize);
+    fprintf(out, "    if (!protectStack())\n    {\n");
+    fprintf(out, "        printf(\"Error: Can't allocate a stack of %%d words\\n\", STACK_WORDS);\n        return 1;\n    }\n");
+    if (hasReturn)
+        fprintf(out, "    int ra; // Return address of the current RTN\n");
+    fprintf(out, "\n");
+
+    for (int i = 0; i < count; i++)
+    {
+        if (!isOperandWord[i])
+            translateInstruction(out, i);
+    }
+
+    // RTN: continue at the saved return address (a call site), anything else stops the VM
+    if (hasReturn)
+    {
+        fprintf(out, "    goto invalid;\n\nret:\n    switch (ra)\n    {\n");
+        for (int i = 0; i < count; i++)
+        {
+            if (isLabel[i] && !isOperandWord[i])
+                fprintf(out, "    case %d: goto L%d;\n", TEXT_START + 3 * i, TEXT_START + 3 * i);
+        }
+        fprintf(out, "    default: goto invalid;\n    }\n");
+        jumpsToInvalid = 1;
+    }
+
+    // Falling off the end, or jumping outside the program
+    fprintf(out, "\n%s    printf(\"Invalid opcode.\\n\");\n    return 0;\n}\n", jumpsToInvalid ? "invalid:\n" : "");
+}
+
+// Translates an elf program to C. Usage: p2c [--stack=N] <elf file> [output.c] (default output: elf.c)
+int main(int argc, char *argv[])
+{
+    const char *names[2] = { NULL, NULL };
+    int nameCount = 0, badOption = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        int size;
+        if (sscanf(argv[i], "--stack=%d", &size) == 1 && size > 0 && size <= INT_MAX / 2)
+            stackSize = size;
+        else if (argv[i][0] == '-' || nameCount == 2)
+            badOption = 1;
+        else
+            names[nameCount++] = argv[i];
+    }
+    if (badOption || nameCount == 0)
+    {
+        printf("Usage: %s [--stack=N] <elf file> [output.c]\n", argv[0]);
+        return 1;
+    }
+
+    if (!loadProgram(names[0]))
+        return 1;
+    markLabels();
+
+    const char *outputName = names[1] ? names[1] : "elf.c";
+    FILE *out = fopen(outputName, "w");
+    if (!out)
+    {
+        perror("Error opening output file");
+        return 1;
+    }
+    translateProgram(out, names[0]);
+    fclose(out);
+    return 0;
+}
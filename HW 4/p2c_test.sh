@@ -0,0 +1,67 @@
+#!/bin/sh
+# Differential test for p2c: every test program in HW 4 and HW 1 (plus the HW 4 inputs compiled with
+# each optimization and both elf formats) must print the same thing translated to C as on "vm --quiet", and exit
+# with the same status. Two of them run out of stack.
+# Usage (from "HW 4"): sh p2c_test.sh
+
+WORK=$(mktemp -d) || exit 1
+HERE=$(pwd)
+INPUT="3
+4
+5
+6
+7"
+
+gcc -std=c17 -Wall -O2 -o "$WORK/vm" vm.c || exit 1
+gcc -std=c17 -Wall -O2 -o "$WORK/p2c" p2c.c || exit 1
+gcc -std=c17 -Wall -O2 -o "$WORK/hw4compiler" hw4compiler.c || exit 1
+
+# Compile the PL/0 inputs in every configuration (the compiler writes elf.txt/elf.bin in the working directory)
+n=0
+for source in test*_input.txt bench/loop_input.txt
+do
+    for options in "" "--fold" "--fuse" "--fold --fuse" "--peephole" "--fold --inline --peephole --prune --fuse" \
+                   "--tail-calls" "--fold --peephole --tail-calls --prune --fuse" \
+                   "--format=binary" "--fold --fuse --format=binary"
+    do
+        n=$((n + 1))
+        (cd "$WORK" && ./hw4compiler $options "$HERE/$source" > /dev/null) || continue
+        if [ -f "$WORK/elf.bin" ]
+        then
+            mv "$WORK/elf.bin" "$WORK/compiled$n.bin"
+        else
+            mv "$WORK/elf.txt" "$WORK/compiled$n.txt"
+        fi
+    done
+done
+
+# Programs that run out of the default stack: deep recursion, and a procedure whose frame is larger than the guard
+# regions around the stack
+awk 'BEGIN { printf "procedure p;\nvar a0"; for (i = 1; i < 40000; i++) printf ", a%d", i
+             print ";\nbegin a39999 := 7; write a39999 end;\nbegin write 1; call p; write 2 end." }' > "$WORK/frame.pl0"
+for source in "$HERE/bench/tail_input.txt" "$WORK/frame.pl0"
+do
+    n=$((n + 1))
+    (cd "$WORK" && ./hw4compiler "$source" > /dev/null && mv elf.txt "compiled$n.txt")
+done
+
+pass=0
+fail=0
+for program in test*_elf.txt bench/*_elf.txt "../HW 1/test1.txt" "../HW 1/test2.txt" "$WORK"/compiled*
+do
+    echo "$INPUT" | "$WORK/vm" --quiet "$program" > "$WORK/expected.out"
+    status=$?
+    if "$WORK/p2c" "$program" "$WORK/program.c" && gcc -O2 -o "$WORK/program" "$WORK/program.c" &&
+       { echo "$INPUT" | "$WORK/program" > "$WORK/actual.out"; [ $? -eq $status ]; } &&
+       cmp -s "$WORK/expected.out" "$WORK/actual.out"
+    then
+        pass=$((pass + 1))
+    else
+        echo "FAIL: $program"
+        fail=$((fail + 1))
+    fi
+done
+
+echo "$pass passed, $fail failed"
+rm -rf "$WORK"
+[ "$fail" -eq 0 ]
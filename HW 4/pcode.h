@@ -0,0 +1,79 @@
+/*
+ * COP 3402 Systems Software
+ * Homework 4: Binary P-code object format
+ * Author: Esteban Ramirez
+ * Description: Layout of the binary elf file written by hw4compiler.c and memory-mapped by vm.c.
+ *              Header, then the packed op/L/M array, then the optional symbol section.
+ *              All fields are 32-bit integers in host byte order.
+ *              Also the source line table the compiler writes next to every P-code elf (text or binary).
+ */
+
+#ifndef PCODE_H
+#define PCODE_H
+
+#include <stdint.h>
+
+#define PCODE_MAGIC "PL0E"  // First 4 bytes of every binary elf
+#define PCODE_VERSION 1     // Bumped whenever the layout changes
+#define PCODE_NAME_LENGTH 12 // Identifier (11 chars max) + terminator
+
+// Fused opcodes (superinstructions) written by the compiler's --fuse pass. Each one is followed by an
+// operand word (raw data, never executed), so it takes two instruction slots. C and O are OPR codes.
+#define FUSED_INCV 10 // [INCV L A] [0 0 K]   var(L, A) += K                 (LOD, LIT, ADD/SUB, STO)
+#define FUSED_LCB 11  // [LCB L A] [C K T]    if !(var(L, A) C K) jump to T  (LOD, LIT, compare, JPC)
+#define FUSED_LLB 12  // [LLB L A] [O L2 A2]  push var(L, A) O var(L2, A2)   (LOD, LOD, OPR)
+
+// Tail call written by the compiler's --tail-calls pass in place of a CAL that the caller's RTN follows. One slot,
+// like CAL: the called procedure takes over the current frame (new static link, same dynamic link and return
+// address), so it returns straight to the caller's caller. L >= 1, since the caller's frame is gone during the
+// call; L < 1 is an invalid instruction.
+#define TAIL_CAL 13   // [TCL L A]            call A with the static link L levels down, in the current frame
+
+// File header
+typedef struct {
+    char magic[4];             // PCODE_MAGIC
+    uint32_t version;          // PCODE_VERSION
+    uint32_t instructionCount; // Entries in the instruction array
+    uint32_t symbolCount;      // Entries in the symbol section (0 = no symbols)
+} PcodeHeader;
+
+// One instruction. Same layout as the VM's TEXT segment, so the array runs in place.
+typedef struct {
+    int32_t op; // Opcode
+    int32_t l;  // Level
+    int32_t m;  // Modifier (address, value, etc.)
+} PcodeInstruction;
+
+// One symbol table entry
+typedef struct {
+    int32_t kind;    // 1 = const, 2 = var, 3 = procedure
+    int32_t level;   // Scope level
+    int32_t address; // Frame offset (var) or code address (procedure)
+    int32_t value;   // For constants
+    char name[PCODE_NAME_LENGTH];
+} PcodeSymbol;
+
+// Line table: the file "<elf>.lines", in text. A header line, the source file on a line of its own, then one
+// "index line" pair wherever the source line changes (instruction index, line of the instructions from there on):
+//     PL0LINES 1 <instructions> <code hash>
+//     <source file>
+//     0 1
+//     3 4
+// The hash (pcodeHash) ties the table to its elf, so a table left over from another compilation is ignored.
+#define PCODE_LINES_MAGIC "PL0LINES"
+#define PCODE_LINES_VERSION 1
+#define PCODE_LINES_SUFFIX ".lines"
+
+// Function that hashes the op/L/M words of a program (FNV-1a, one word at a time)
+static inline uint32_t pcodeHash(const int32_t *words, size_t count)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < count; i++)
+    {
+        hash ^= (uint32_t)words[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+#endif
@@ -0,0 +1,569 @@
+/*
+ * COP 3402 Systems Software
+ * Homework 4: Register bytecode
+ * Author: Esteban Ramirez
+ * Description: Three-address register form of P-code, and the translator from op/L/M code into it.
+ *              hw4compiler.c writes it directly with --format=register (elf.reg), vm.c runs it with
+ *              --engine=register (translating op/L/M programs when they are loaded).
+ *
+ *              Virtual registers are slots of the current frame: register r is PAS[BP - r], the same slot
+ *              LOD 0 r reads. Variables of the current procedure are used in place, and the expression stack
+ *              becomes the registers its entries would have occupied (the entry at depth d lives in d - 1).
+ *              Frames keep the P-machine layout (static link, dynamic link, return address).
+ */
+
+#ifndef REGCODE_H
+#define REGCODE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "pcode.h"
+
+#define REGCODE_MAGIC "PL0R" // First 4 bytes of every register elf
+#define REGCODE_VERSION 1
+#define REGCODE_MAX_DEPTH (1 << 24) // Frames deeper than this are not translated
+
+// Opcodes. r = register, k = immediate, t = instruction index, l = levels down the static links.
+// The arithmetic/comparison groups are in OPR order (ADD..MOD): REG_ADD + (code - 1).
+#define REG_INVALID 0      //                   Invalid opcode (stops)
+#define REG_INVALID_OPR 1  //                   Invalid OPR instruction (stops)
+#define REG_HALT 2         //                   SYS 3
+#define REG_LDI 3          // [r k]             r = k
+#define REG_MOV 4          // [r r2]            r = r2
+#define REG_LDU 5          // [r l m]           r = var(l, m)
+#define REG_STU 6          // [r l m]           var(l, m) = r
+#define REG_JMP 7          // [t]               jump to t
+#define REG_JZ 8           // [r t]             jump to t if r == 0
+#define REG_CAL 9          // [l t d]           call t; the new frame starts d slots below BP
+#define REG_RTN 10         //                   return
+#define REG_WRITE 11       // [r]               print r
+#define REG_WRITEI 12      // [k]               print k
+#define REG_READ 13        // [r]               read r
+#define REG_ADD 14         // [r a b]           r = a op b          (11 opcodes, ADD..MOD)
+#define REG_ADDI 25        // [r a k]           r = a op k          (11 opcodes, ADD..MOD)
+#define REG_JFEQ 36        // [a b t]           jump to t unless a cmp b (6 opcodes, EQL..GEQ)
+#define REG_JFEQI 42       // [a k t]           jump to t unless a cmp k (6 opcodes, EQL..GEQ)
+#define REG_TCL 48         // [l t]             tail call t in the current frame (TCL, see pcode.h)
+#define REG_CHK 49         // [d]               stack overflow unless a depth of d fits in the stack (INC)
+#define REG_OPCODES 50
+
+// File header (followed by the instruction array)
+typedef struct {
+    char magic[4];             // REGCODE_MAGIC
+    uint32_t version;          // REGCODE_VERSION
+    uint32_t instructionCount; // Entries in the instruction array
+    uint32_t stackCount;       // Instructions of the op/L/M program it was translated from (for reports)
+} RegHeader;
+
+// One instruction
+typedef struct {
+    int32_t op;
+    int32_t a, b, c;
+} RegInstruction;
+
+// Entry of the expression stack while translating: a value that may not be in its register yet
+#define REG_ENTRY_HOME 0  // Already in its register (depth - 1)
+#define REG_ENTRY_CONST 1 // Constant, value = the constant
+#define REG_ENTRY_VAR 2   // Current-frame variable, value = its register (read when the entry is used)
+
+typedef struct {
+    int kind;
+    int value;
+    int producer; // Instruction that wrote the register of a HOME entry (-1 = unknown)
+} RegEntry;
+
+// Translator state
+typedef struct {
+    RegInstruction *code;
+    int count, capacity;
+    RegEntry *stack; // Expression stack, stack[d - 1] is the entry at depth d
+    int depth;
+    int blockStart;  // First instruction after the last label (results can't be retargeted before it)
+    int failed;      // Out of memory
+} RegTranslator;
+
+// Helper function that appends an instruction and returns its index
+static int regEmit(RegTranslator *t, int op, int a, int b, int c)
+{
+    if (t->count == t->capacity)
+    {
+        int capacity = t->capacity ? 2 * t->capacity : 256;
+        RegInstruction *code = realloc(t->code, capacity * sizeof(RegInstruction));
+        if (!code)
+        {
+            t->failed = 1;
+            return t->count - 1;
+        }
+        t->code = code;
+        t->capacity = capacity;
+    }
+    t->code[t->count].op = op;
+    t->code[t->count].a = a;
+    t->code[t->count].b = b;
+    t->code[t->count].c = c;
+    return t->count++;
+}
+
+// Helper function that pushes an entry onto the expression stack (sized for the deepest instruction)
+static void regPush(RegTranslator *t, int kind, int value, int producer)
+{
+    t->stack[t->depth].kind = kind;
+    t->stack[t->depth].value = value;
+    t->stack[t->depth].producer = producer;
+    t->depth++;
+}
+
+// Helper function that writes the entry at depth d into its register
+static void regMaterialize(RegTranslator *t, int d)
+{
+    RegEntry *entry = &t->stack[d - 1];
+    if (entry->kind == REG_ENTRY_CONST)
+        entry->producer = regEmit(t, REG_LDI, d - 1, entry->value, 0);
+    else if (entry->kind == REG_ENTRY_VAR)
+        entry->producer = regEmit(t, REG_MOV, d - 1, entry->value, 0);
+    entry->kind = REG_ENTRY_HOME;
+}
+
+// Helper function that writes every pending entry into its register (before labels, jumps and calls)
+static void regFlush(RegTranslator *t)
+{
+    for (int d = 1; d <= t->depth; d++)
+        regMaterialize(t, d);
+}
+
+// Helper function called before register r is written: entries that still have to read r, or whose
+// own register is r, are written out first
+static void regBeforeWrite(RegTranslator *t, int r)
+{
+    for (int d = 1; d <= t->depth; d++)
+    {
+        RegEntry *entry = &t->stack[d - 1];
+        if ((entry->kind == REG_ENTRY_VAR && entry->value == r) || (entry->kind != REG_ENTRY_HOME && d - 1 == r))
+            regMaterialize(t, d);
+    }
+}
+
+// Helper function that returns the register holding a non-constant entry at depth d
+static int regOf(RegTranslator *t, int d)
+{
+    RegEntry *entry = &t->stack[d - 1];
+    return entry->kind == REG_ENTRY_VAR ? entry->value : d - 1;
+}
+
+// Helper function that pushes var(l, m). Current-frame variables in allocated slots are read lazily.
+static void regLoad(RegTranslator *t, int l, int m)
+{
+    int d = t->depth + 1;
+    if (l == 0 && m >= 0 && m < t->depth)
+    {
+        if (t->stack[m].kind != REG_ENTRY_HOME) // m is the register of a pending entry
+            regMaterialize(t, m + 1);
+        regPush(t, REG_ENTRY_VAR, m, -1);
+    }
+    else if (l == 0)
+    {
+        regBeforeWrite(t, d - 1);
+        regPush(t, REG_ENTRY_HOME, 0, regEmit(t, REG_MOV, d - 1, m, 0));
+    }
+    else
+    {
+        regBeforeWrite(t, d - 1);
+        regPush(t, REG_ENTRY_HOME, 0, regEmit(t, REG_LDU, d - 1, l, m));
+    }
+}
+
+// Helper function that pops the top entry into var(l, m)
+static void regStore(RegTranslator *t, int l, int m)
+{
+    int d = t->depth;
+    RegEntry entry = t->stack[d - 1];
+    if (l != 0)
+    {
+        if (entry.kind == REG_ENTRY_CONST)
+            regMaterialize(t, d);
+        regEmit(t, REG_STU, regOf(t, d), l, m);
+        t->depth--;
+        return;
+    }
+
+    t->depth--;
+    int before = t->count;
+    regBeforeWrite(t, m);
+    if (entry.kind == REG_ENTRY_CONST)
+        regEmit(t, REG_LDI, m, entry.value, 0);
+    else if (entry.kind == REG_ENTRY_VAR)
+    {
+        if (entry.value != m)
+            regEmit(t, REG_MOV, m, entry.value, 0);
+    }
+    else if (entry.producer >= t->blockStart && entry.producer == before - 1 && t->count == before && !t->failed)
+        t->code[entry.producer].a = m; // The result goes straight into the variable
+    else
+        regEmit(t, REG_MOV, m, d - 1, 0);
+}
+
+// Helper function that returns the comparison code with its operands swapped (a < b is b > a), or 0
+static int regSwapped(int op)
+{
+    switch (op)
+    {
+    case 1: case 3: case 5: case 6: return op; // ADD, MUL, EQL, NEQ
+    case 7: return 9;   // LSS -> GTR
+    case 8: return 10;  // LEQ -> GEQ
+    case 9: return 7;   // GTR -> LSS
+    case 10: return 8;  // GEQ -> LEQ
+    default: return 0;  // SUB, DIV, MOD
+    }
+}
+
+// Helper function that prepares the two top entries as operands: *a is a register, *b a register or (if
+// *isConstant) a constant. A constant on the left is swapped to the right when op allows it.
+// Returns the (possibly swapped) OPR code.
+static int regOperands(RegTranslator *t, int op, int *a, int *b, int *isConstant)
+{
+    int d = t->depth;
+    RegEntry left = t->stack[d - 2], right = t->stack[d - 1];
+    if (left.kind == REG_ENTRY_CONST && right.kind != REG_ENTRY_CONST && regSwapped(op))
+    {
+        *a = regOf(t, d);
+        *b = left.value;
+        *isConstant = 1;
+        return regSwapped(op);
+    }
+    if (left.kind == REG_ENTRY_CONST)
+        regMaterialize(t, d - 1);
+    *a = regOf(t, d - 1);
+    *isConstant = right.kind == REG_ENTRY_CONST;
+    *b = *isConstant ? right.value : regOf(t, d);
+    return op;
+}
+
+// Helper function that pops two entries and pushes "left op right" (op = OPR code 1..11)
+static void regOperation(RegTranslator *t, int op)
+{
+    int a, b, isConstant;
+    op = regOperands(t, op, &a, &b, &isConstant);
+    int producer = regEmit(t, (isConstant ? REG_ADDI : REG_ADD) + op - 1, t->depth - 2, a, b);
+    t->depth -= 2;
+    regPush(t, REG_ENTRY_HOME, 0, producer);
+}
+
+// Helper function that pops two entries and jumps to the code address target unless "left cmp right"
+// (cmp = OPR code 5..10)
+static void regBranch(RegTranslator *t, int op, int target)
+{
+    int a, b, isConstant;
+    op = regOperands(t, op, &a, &b, &isConstant);
+    t->depth -= 2;
+    regFlush(t);
+    regEmit(t, (isConstant ? REG_JFEQI : REG_JFEQ) + op - 5, a, b, target);
+}
+
+// Helper function that computes the expression stack depth before every instruction (count = invalid).
+// Returns 0 if the depth is not the same on every path, or an instruction pops more than there is.
+static int regDepths(const int *text, int count, const char *isOperand, int *depthAt, int textStart)
+{
+    int *work = malloc((count + 1) * sizeof(int));
+    int top = 0;
+    if (!work)
+        return 0;
+    for (int i = 0; i <= count; i++)
+        depthAt[i] = -1;
+
+    // Helper macro that records the depth at an address (jump/call targets and fall-through)
+#define REG_REACH(index, depth) do { \
+        int at = (index); \
+        long long dd = (depth); \
+        if (at < 0 || at >= count || isOperand[at]) break; \
+        if (dd < 0 || dd > REGCODE_MAX_DEPTH || (depthAt[at] >= 0 && depthAt[at] != dd)) { free(work); return 0; } \
+        if (depthAt[at] < 0) { depthAt[at] = (int)dd; work[top++] = at; } \
+    } while (0)
+#define REG_ADDRESS(address) (((address) - textStart) % 3 == 0 && (address) >= textStart ? ((address) - textStart) / 3 : -1)
+
+    REG_REACH(0, 0);
+    while (top > 0)
+    {
+        int i = work[--top], d = depthAt[i];
+        int op = text[3 * i], m = text[3 * i + 2];
+        int fused = op >= FUSED_INCV && op <= FUSED_LLB;
+        if (fused && i + 1 >= count)
+            continue; // Truncated: invalid
+        int x = fused ? text[3 * i + 3] : 0, z = fused ? text[3 * i + 5] : 0;
+        switch (op)
+        {
+        case 1: case 3: REG_REACH(i + 1, d + 1); break;           // LIT, LOD
+        case 2: if (m >= 1 && m <= 11) REG_REACH(i + 1, d - 1); break; // OPR (RTN and invalid codes stop)
+        case 4: REG_REACH(i + 1, d - 1); break;                    // STO
+        case 5: REG_REACH(i + 1, d); REG_REACH(REG_ADDRESS(m), 0); break; // CAL: RTN restores the depth
+        case TAIL_CAL: if (text[3 * i + 1] >= 1) REG_REACH(REG_ADDRESS(m), 0); break; // TCL (never comes back)
+        case 6: REG_REACH(i + 1, (long long)d + m); break;                   // INC
+        case 7: REG_REACH(REG_ADDRESS(m), d); break;               // JMP
+        case 8: REG_REACH(i + 1, d - 1); REG_REACH(REG_ADDRESS(m), d - 1); break; // JPC
+        case 9:                                                    // SYS
+            if (m == 1) REG_REACH(i + 1, d - 1);
+            else if (m == 2) REG_REACH(i + 1, d + 1);
+            else if (m != 3) REG_REACH(i + 1, d);
+            break;
+        case FUSED_INCV: REG_REACH(i + 2, d); break;
+        case FUSED_LCB: if (x >= 5 && x <= 10) { REG_REACH(i + 2, d); REG_REACH(REG_ADDRESS(z), d); } break;
+        case FUSED_LLB: if (x >= 1 && x <= 11) REG_REACH(i + 2, d + 1); break;
+        default: break;
+        }
+        if (d < ((op == 2 && m >= 1 && m <= 11) ? 2 : (op == 4 || op == 8 || (op == 9 && m == 1)) ? 1 : 0))
+        {
+            free(work); // Pops below the frame
+            return 0;
+        }
+    }
+#undef REG_REACH
+#undef REG_ADDRESS
+    free(work);
+    return 1;
+}
+
+// Function that translates count op/L/M instructions (the first one at code address textStart) into register
+// form. Returns 1 and the new code, or 0 if the program can't be translated (the caller keeps the op/L/M form).
+static int regTranslate(const int *text, int count, int textStart, RegInstruction **codeOut, int *countOut)
+{
+    RegTranslator t = {0};
+    char *isOperand = calloc(count + 1, 1);
+    char *isLabel = calloc(count + 1, 1);
+    int *depthAt = malloc((count + 1) * sizeof(int));
+    int *newIndex = malloc((count + 1) * sizeof(int));
+    int ok = isOperand && isLabel && depthAt && newIndex;
+
+    // Operand words of fused opcodes are data; jump/call targets and return sites start blocks
+    for (int i = 0; ok && i < count; i++)
+    {
+        int op = text[3 * i], m = text[3 * i + 2];
+        int target = -1;
+        if (op >= FUSED_INCV && op <= FUSED_LLB && i + 1 < count)
+        {
+            isOperand[i + 1] = 1;
+            if (op == FUSED_LCB)
+                target = text[3 * i + 5];
+        }
+        else if (op == 5 || op == 7 || op == 8 || op == TAIL_CAL)
+            target = m;
+        if (op == 5)
+            isLabel[i + 1] = 1;
+        if (target >= textStart && (target - textStart) % 3 == 0 && (target - textStart) / 3 < count)
+            isLabel[(target - textStart) / 3] = 1;
+        if (op >= FUSED_INCV && op <= FUSED_LLB && i + 1 < count)
+            i++;
+    }
+    ok = ok && regDepths(text, count, isOperand, depthAt, textStart);
+
+    // The expression stack never grows past the deepest instruction plus two pushes (LLB)
+    int maxDepth = 0;
+    for (int i = 0; ok && i < count; i++)
+        if (depthAt[i] > maxDepth)
+            maxDepth = depthAt[i];
+    t.stack = ok ? malloc((maxDepth + 3) * sizeof(RegEntry)) : NULL;
+    ok = ok && t.stack;
+
+    int live = 0; // The previous instruction falls through
+    for (int i = 0; ok && i < count; i++)
+    {
+        int op = text[3 * i], l = text[3 * i + 1], m = text[3 * i + 2];
+        if (isOperand[i])
+        {
+            newIndex[i] = t.count; // Data
+            continue;
+        }
+        if (depthAt[i] < 0)
+        {
+            newIndex[i] = t.count; // Never executed
+            live = 0;
+            continue;
+        }
+
+        // Blocks start with every entry in its register
+        if (isLabel[i] || !live)
+        {
+            if (live)
+                regFlush(&t);
+            t.depth = 0;
+            for (int d = 0; d < depthAt[i]; d++)
+                regPush(&t, REG_ENTRY_HOME, 0, -1);
+            t.blockStart = t.count;
+        }
+        newIndex[i] = t.count;
+        live = 1;
+
+        int x = 0, y = 0, z = 0;
+        if (op >= FUSED_INCV && op <= FUSED_LLB)
+        {
+            if (i + 1 >= count)
+                op = 0; // Truncated program: invalid
+            else
+            {
+                x = text[3 * i + 3];
+                y = text[3 * i + 4];
+                z = text[3 * i + 5];
+            }
+        }
+
+        switch (op)
+        {
+        case 1: // LIT
+            regPush(&t, REG_ENTRY_CONST, m, -1);
+            break;
+        case 2: // OPR
+            if (m == 0)
+            {
+                regEmit(&t, REG_RTN, 0, 0, 0);
+                live = 0;
+            }
+            else if (m >= 5 && m <= 10 && i + 1 < count && text[3 * i + 3] == 8 && !isLabel[i + 1])
+            {
+                // Comparison followed by JPC: one compare-and-branch
+                newIndex[i + 1] = t.count;
+                regBranch(&t, m, text[3 * i + 5]);
+                i++;
+            }
+            else if (m >= 1 && m <= 11)
+                regOperation(&t, m);
+            else
+            {
+                regEmit(&t, REG_INVALID_OPR, 0, 0, 0);
+                live = 0;
+            }
+            break;
+        case 3: // LOD
+            regLoad(&t, l, m);
+            break;
+        case 4: // STO
+            regStore(&t, l, m);
+            break;
+        case 5: // CAL
+            regFlush(&t);
+            regEmit(&t, REG_CAL, l, m, t.depth);
+            break;
+        case TAIL_CAL: // TCL: the current frame's registers are dead, nothing is flushed
+            regEmit(&t, l >= 1 ? REG_TCL : REG_INVALID, l, m, 0);
+            live = 0;
+            break;
+        case 6: // INC
+            regFlush(&t);
+            if (m < 0)
+                t.depth += m;
+            for (int d = 0; d < m; d++)
+                regPush(&t, REG_ENTRY_HOME, 0, -1);
+            regEmit(&t, REG_CHK, t.depth, 0, 0); // The frame's registers are used in place, so INC's check stays
+            break;
+        case 7: // JMP
+            regFlush(&t);
+            regEmit(&t, REG_JMP, m, 0, 0);
+            live = 0;
+            break;
+        case 8: // JPC
+        {
+            RegEntry condition = t.stack[t.depth - 1];
+            int r = regOf(&t, t.depth);
+            t.depth--;
+            regFlush(&t);
+            if (condition.kind == REG_ENTRY_CONST)
+            {
+                if (condition.value == 0)
+                    regEmit(&t, REG_JMP, m, 0, 0);
+            }
+            else
+                regEmit(&t, REG_JZ, r, m, 0);
+            break;
+        }
+        case 9: // SYS
+            if (m == 1)
+            {
+                RegEntry value = t.stack[t.depth - 1];
+                if (value.kind == REG_ENTRY_CONST)
+                    regEmit(&t, REG_WRITEI, value.value, 0, 0);
+                else
+                    regEmit(&t, REG_WRITE, regOf(&t, t.depth), 0, 0);
+                t.depth--;
+            }
+            else if (m == 2)
+            {
+                regBeforeWrite(&t, t.depth);
+                regPush(&t, REG_ENTRY_HOME, 0, regEmit(&t, REG_READ, t.depth, 0, 0));
+            }
+            else if (m == 3)
+            {
+                regEmit(&t, REG_HALT, 0, 0, 0);
+                live = 0;
+            }
+            break;
+        case FUSED_INCV: // var(l, m) += z
+            regLoad(&t, l, m);
+            regPush(&t, REG_ENTRY_CONST, z, -1);
+            regOperation(&t, 1);
+            regStore(&t, l, m);
+            break;
+        case FUSED_LCB: // jump to z unless var(l, m) x y
+            if (x < 5 || x > 10)
+            {
+                regEmit(&t, REG_INVALID, 0, 0, 0);
+                live = 0;
+                break;
+            }
+            regLoad(&t, l, m);
+            regPush(&t, REG_ENTRY_CONST, y, -1);
+            regBranch(&t, x, z);
+            break;
+        case FUSED_LLB: // push var(l, m) x var(y, z)
+            if (x < 1 || x > 11)
+            {
+                regEmit(&t, REG_INVALID, 0, 0, 0);
+                live = 0;
+                break;
+            }
+            regLoad(&t, l, m);
+            regLoad(&t, y, z);
+            regOperation(&t, x);
+            break;
+        default:
+            regEmit(&t, REG_INVALID, 0, 0, 0);
+            live = 0;
+            break;
+        }
+    }
+
+    // Falling off the end is an invalid opcode
+    if (ok)
+    {
+        newIndex[count] = t.count;
+        regEmit(&t, REG_INVALID, 0, 0, 0);
+    }
+    ok = ok && !t.failed;
+
+    // Jump targets: code address -> register instruction (anything else goes to the final invalid)
+    for (int j = 0; ok && j < t.count; j++)
+    {
+        RegInstruction *instr = &t.code[j];
+        int *field = instr->op == REG_JMP ? &instr->a
+                   : instr->op == REG_JZ || instr->op == REG_CAL || instr->op == REG_TCL ? &instr->b
+                   : instr->op >= REG_JFEQ && instr->op < REG_TCL ? &instr->c : NULL;
+        if (!field)
+            continue;
+        int offset = *field - textStart;
+        *field = offset >= 0 && offset % 3 == 0 && offset / 3 < count && !isOperand[offset / 3]
+               ? newIndex[offset / 3] : newIndex[count];
+    }
+
+    free(isOperand);
+    free(isLabel);
+    free(depthAt);
+    free(newIndex);
+    free(t.stack);
+    if (!ok)
+    {
+        free(t.code);
+        return 0;
+    }
+    *codeOut = t.code;
+    *countOut = t.count;
+    return 1;
+}
+
+#endif
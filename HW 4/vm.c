@@ -6,20 +6,313 @@
  * Description: Implements a virtual machine that simulates the execution of a P-Machine. Updated support for MOD
  */
 
+#define _DEFAULT_SOURCE // POSIX mmap with -std=c17
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "pcode.h"
+#include "regcode.h"
+
+#define STACK_SIZE 500        // Default stack size in words (--stack=N)
+#define STACK_GUARD (64 * 1024) // Bytes of inaccessible memory on both sides of the stack
+#define TEXT_START 10           // Code address of the first instruction
+#define PROFILE_INTERVAL 1000   // Microseconds of CPU time between profiler samples (rounded up to the kernel tick)
+#define PROFILE_MAX_DEPTH 256   // Call paths deeper than this are cut (deeper calls count in the frame at this depth)
+#define PROFILE_TOP_PATHS 50    // Call paths listed in the profile
+#define PROFILE_TOP_LINES 50    // Source lines listed in the profile
+
+// Execution engines
+#define ENGINE_SWITCH 0   // Fetch/decode every step with a switch
+#define ENGINE_THREADED 1 // Pre-decoded, direct-threaded dispatch
+#define ENGINE_JIT 2      // Native code from per-opcode templates (x86-64 Linux, --quiet only)
+#define ENGINE_REGISTER 3 // Three-address register code (regcode.h, --quiet only)
+
+// Trace modes
+#define TRACE_NONE 0    // Production: print only SYS 1 output
+#define TRACE_ALL 1     // Print the stack after every instruction (default)
+#define TRACE_SAMPLED 2 // Print every Nth instruction and/or only a PC range
+
+// VM Registers and Memory. PAS is the stack only (stackSize words, see allocateStack); code lives in TEXT.
+// The machine and its program are thread-local: every worker thread of a batch (--batch) is a VM instance of its own.
+_Thread_local int *PAS = NULL;
+_Thread_local int *ACT_BARS = NULL;
+_Thread_local int *DISPLAY_SAVE = NULL; // Display entry that the CAL creating the frame at this BP replaced
+_Thread_local int stackSize = STACK_SIZE;
+_Thread_local int BP = STACK_SIZE - 1, SP = STACK_SIZE, PC = TEXT_START;
+_Thread_local int EOP = 1; // End Of Program flag
+_Thread_local char *stackGuardLow = NULL, *stackGuardHigh = NULL; // Guard regions around PAS
+
+// Loaded program. TEXT points at the loaded text elf, or into the mapped file for binary ones.
+// Code address a is the instruction at TEXT[a - TEXT_START].
+_Thread_local const int *TEXT = NULL;
+_Thread_local int textWords = 0;                 // Words in the TEXT segment (3 per instruction)
+_Thread_local const PcodeSymbol *symbols = NULL; // Symbol section of a binary elf (if any)
+_Thread_local int symbolCount = 0;
+_Thread_local const RegInstruction *regCode = NULL; // Register code of a register elf (if any), see regcode.h
+_Thread_local int regCount = 0;
+
+// Source line table of the program (the "<elf>.lines" file the compiler writes, see pcode.h), if it has one
+typedef struct {
+    char *source; // Source file
+    int count;    // Entries
+    int *index;   // Instruction where each entry starts (ascending)
+    int *line;    // Source line of the instructions from there on
+} LineTable;
+_Thread_local const LineTable *lineTable = NULL;
+
+// Trace settings
+int traceMode = TRACE_ALL;
+int traceEvery = 1;                       // Trace every Nth candidate instruction
+int traceLow = 0, traceHigh = INT_MAX;    // Only trace instructions in this address range
+_Thread_local long long traceCount = 0;                 // Candidates seen so far
+int traceLines = 0;                       // Print file:line above the traced instructions of each line (--trace-lines)
+int tracedLine = 0;                       // Source line of the last traced instruction
+
+// Profiler (--profile): executions of every instruction, and SIGPROF samples of the instruction running
+const char *profileName = NULL;    // Annotated listing written on exit, NULL = not profiling
+long long *profileCounts = NULL;   // Executions, indexed by instruction
+int *profileSamples = NULL;        // Samples, indexed by instruction
+volatile sig_atomic_t profileAt = 0; // First instruction of the basic block running now
+clock_t profileStart = 0;          // CPU time when the program started
+
+// Call-graph profile (--profile and --flamegraph): a shadow call stack kept as a tree of call paths. Each node is a
+// procedure (CAL target) reached through the path of its ancestors; the root is the main block.
+typedef struct {
+    int entry;             // Instruction index of the procedure's entry
+    int parent;            // Calling path, -1 for the root
+    int firstChild, nextSibling;
+    int depth;             // Calls from the main block
+    long long calls;       // Times this path was entered
+    long long exclusive;   // Instructions executed in the procedure's own code on this path
+    long long inclusive;   // Exclusive plus everything called from it (computed when writing)
+} CallNode;
+const char *flameName = NULL;   // Folded stacks written on exit (flame-graph input), NULL = none
+void profileTransfer(int from, int to, long long executed);
+CallNode *callNodes = NULL;
+int callNodeCount = 0, callNodeCapacity = 0;
+int callCurrent = 0;            // Node of the running procedure
+int callOverflow = 0;           // Calls made past PROFILE_MAX_DEPTH that haven't returned
+long long callMark = 0;         // Instructions executed when callCurrent last changed
+
+// Statistics (builds with -DVM_STATS): dispatches and PAS words read/written by the switch and register engines
+#ifdef VM_STATS
+_Thread_local long long statDispatches = 0, statReads = 0, statWrites = 0;
+#define COUNT(reads, writes) (statDispatches++, statReads += (reads), statWrites += (writes))
+#else
+#define COUNT(reads, writes) ((void)0)
+#endif
+
+// Output of the running program (SYS 1 and error messages): stdout, or the job's buffer in a batch
+typedef struct {
+    char *text;
+    size_t length, capacity;
+} OutputBuffer;
+_Thread_local OutputBuffer *jobOutput = NULL;
+_Thread_local const char *jobInput = NULL; // Input values of the job (SYS 2), NULL = read stdin
+
+// Instructions executed, counted by the switch and threaded engines when countInstructions is set (batch runs)
+_Thread_local long long executedCount = 0;
+int countInstructions = 0;
+
+// Memory an engine holds while it runs. The engine releases it, or the batch runner does when a job stops on a
+// stack overflow (see releaseEngineMemory).
+_Thread_local void *engineMemory[3];
+
+// Stack overflows jump back to the batch job when set, instead of ending the process
+_Thread_local sigjmp_buf *faultExit = NULL;
+
+// Non-interactive I/O (--io): SYS 1 and SYS 2 values go through large buffers, read and written with few system
+// calls. Only used outside batches, so there is one set for the process.
+#define IO_STDIO 0   // printf per output value and scanf per input value, with prompts when tracing (default)
+#define IO_STREAM 1  // The same "Output result is" lines and whitespace-separated input values, buffered
+#define IO_RAW 2     // Native 32-bit integers in both directions, buffered. Messages go to stderr.
+#define IO_BUFFER_SIZE (1 << 20)
+int ioMode = IO_STDIO;
+int inputFd = STDIN_FILENO, outputFd = STDOUT_FILENO;
+char *ioOut = NULL, *ioIn = NULL;
+size_t ioOutLength = 0, ioInStart = 0, ioInEnd = 0;
+int inputEnded = 0;
+
+// Helper function that writes the buffered output values
+void flushValues()
+{
+    size_t done = 0;
+    while (done < ioOutLength)
+    {
+        ssize_t written = write(outputFd, ioOut + done, ioOutLength - done);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            break;
+        done += (size_t)written;
+    }
+    ioOutLength = 0;
+}
+
+// Helper function that reads more input after the unread bytes. Returns 0 at the end of the input.
+int fillInput()
+{
+    memmove(ioIn, ioIn + ioInStart, ioInEnd - ioInStart);
+    ioInEnd -= ioInStart;
+    ioInStart = 0;
+    ssize_t count;
+    do
+        count = read(inputFd, ioIn + ioInEnd, IO_BUFFER_SIZE - ioInEnd);
+    while (count < 0 && errno == EINTR);
+    if (count > 0)
+        ioInEnd += (size_t)count;
+    ioIn[ioInEnd] = '\0'; // Stops strtol at the end of the data
+    return count > 0;
+}
+
+// Helper function that prints program output: to stdout, or into the job's buffer in a batch
+void printOutput(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    if (!jobOutput)
+    {
+        // Messages come after the values written so far, and stay out of a raw value stream
+        if (ioOut)
+            flushValues();
+        vfprintf(ioMode == IO_RAW ? stderr : stdout, format, args);
+        if (ioOut)
+            fflush(stdout);
+        va_end(args);
+        return;
+    }
+
+    // Append to the buffer, growing it as needed
+    OutputBuffer *out = jobOutput;
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(out->text ? out->text + out->length : NULL,
+                           out->text ? out->capacity - out->length : 0, format, args);
+    if (length >= 0 && out->length + length >= out->capacity)
+    {
+        size_t capacity = out->capacity ? out->capacity : 256;
+        while (out->length + length >= capacity)
+            capacity *= 2;
+        char *grown = realloc(out->text, capacity);
+        if (grown)
+        {
+            out->text = grown;
+            out->capacity = capacity;
+            vsnprintf(out->text + out->length, out->capacity - out->length, format, copy);
+        }
+        else
+            length = -1;
+    }
+    if (length > 0)
+        out->length += length;
+    va_end(copy);
+    va_end(args);
+}
+
+// Helper function that prints a SYS 1 output value
+void writeValue(int value)
+{
+    if (!ioOut || jobOutput)
+    {
+        printOutput("Output result is: %d\n", value);
+        return;
+    }
+
+    if (ioOutLength + 32 > IO_BUFFER_SIZE)
+        flushValues();
+    if (ioMode == IO_RAW)
+    {
+        memcpy(ioOut + ioOutLength, &value, sizeof(int));
+        ioOutLength += sizeof(int);
+        return;
+    }
+
+    // "Output result is: " and the digits, written backwards into a scratch buffer
+    char digits[12];
+    int length = 0;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    do
+    {
+        digits[length++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0)
+        digits[length++] = '-';
+    memcpy(ioOut + ioOutLength, "Output result is: ", 18);
+    ioOutLength += 18;
+    while (length)
+        ioOut[ioOutLength++] = digits[--length];
+    ioOut[ioOutLength++] = '\n';
+}
+
+// Helper function that takes the next input value from the --io buffer. Gives 0 at the end of the input.
+int readBufferedValue()
+{
+    if (ioMode == IO_RAW)
+    {
+        while (ioInEnd - ioInStart < sizeof(int) && !inputEnded)
+            inputEnded = !fillInput();
+        if (ioInEnd - ioInStart < sizeof(int))
+            return 0;
+        int value;
+        memcpy(&value, ioIn + ioInStart, sizeof(int));
+        ioInStart += sizeof(int);
+        return value;
+    }
+
+    // Text: refill until the buffer holds a whole number (one not cut off by the end of the buffer)
+    for (;;)
+    {
+        while (ioInStart < ioInEnd && isspace((unsigned char)ioIn[ioInStart]))
+            ioInStart++;
+        size_t end = ioInStart;
+        while (end < ioInEnd && !isspace((unsigned char)ioIn[end]))
+            end++;
+        if (end < ioInEnd || inputEnded)
+            break;
+        inputEnded = !fillInput();
+    }
+    char *start = ioIn + ioInStart, *stop;
+    long value = strtol(start, &stop, 10);
+    ioInStart += (size_t)(stop - start);
+    return (int)value;
+}
 
-#define ARRAY_SIZE 500
-#define UNUSED 10
-#define TEXT_START 10
-#define STACK_START 500
+// Helper function that reads a SYS 2 input value into slot: from stdin, the --io buffer, or the job's input values
+// in a batch. Buffered and batch reads give 0 when there is no more input.
+void readValue(int *slot)
+{
+    if (!jobInput)
+    {
+        if (ioIn)
+            *slot = readBufferedValue();
+        else
+            scanf("%d", slot);
+        return;
+    }
 
-// VM Registers and Memory
-int PAS[ARRAY_SIZE] = {0};
-int ACT_BARS[ARRAY_SIZE] = {0};
-int BP = 499, SP = 500, PC = 10;
-int EOP = 1; // End Of Program flag
+    char *end;
+    long value = strtol(jobInput, &end, 10);
+    *slot = end != jobInput ? (int)value : 0;
+    jobInput = end;
+}
 
 // Helper function that folows static links l levels down. Given in assignment file.
 int base(int bp, int l)
@@ -33,14 +326,95 @@ int base(int bp, int l)
     return arb;
 }
 
-// Prints the instruction, L and M fields, PC and the stack contents.
-void printStack(const char instr[], int l, int m, int pc, int bp, int sp)
+// Helper function that gives the source line of the instruction at address, 0 if it isn't known
+int sourceLine(int address)
+{
+    int index = (address - TEXT_START) / 3;
+    if (!lineTable || address < TEXT_START || index >= textWords / 3 || lineTable->count == 0 ||
+        index < lineTable->index[0])
+        return 0;
+
+    // Last entry starting at or before the instruction
+    int low = 0, high = lineTable->count - 1;
+    while (low < high)
+    {
+        int middle = (low + high + 1) / 2;
+        if (lineTable->index[middle] <= index)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return lineTable->line[low];
+}
+
+// Helper function that formats the source position ("file:line") of the instruction at address. Returns NULL if
+// it isn't known. The text is overwritten by the next call.
+const char *sourcePosition(int address)
+{
+    static _Thread_local char position[4096 + 16];
+    int line = sourceLine(address);
+    if (!line)
+        return NULL;
+    snprintf(position, sizeof(position), "%s:%d", lineTable->source, line);
+    return position;
+}
+
+// Helper function that reports an invalid instruction, with its source position when the program has a line table
+void invalidInstruction(const char *message, int address)
+{
+    const char *position = sourcePosition(address);
+    if (position)
+        printOutput("%s (%s)\n", message, position);
+    else
+        printOutput("%s\n", message);
+}
+
+const char stackOverflowMessage[] = "Error: Stack overflow (use a larger --stack=N)\n";
+
+// Function that stops the program on a stack overflow. A batch job jumps back to its runner (which prints the error);
+// otherwise the VM prints it and exits. Called by the guard regions' signal handler and by INC.
+void stackOverflow()
+{
+    if (faultExit)
+        siglongjmp(*faultExit, 1);
+    fflush(stdout); // The engines only stop on PAS accesses and INC, never inside stdio or the --io buffers
+    if (ioOut)
+        flushValues();
+    if (write(ioMode == IO_RAW ? STDERR_FILENO : STDOUT_FILENO, stackOverflowMessage,
+              strlen(stackOverflowMessage)) < 0)
+        _exit(2);
+    _exit(1);
+}
+
+// Helper function that tells whether INC m leaves SP outside the stack. One INC can move SP further than the guard
+// regions reach, so it is the one instruction whose SP the engines check.
+static inline int incOverflows(int sp, int m)
+{
+    return (unsigned long long)((long long)sp - m) > (unsigned long long)stackSize; // Below 0 is above unsigned
+}
+
+// Helper function that prints the source position of the instruction at address in a trace (--trace-lines), when it
+// is on another line than the last one traced
+void traceSource(int address)
+{
+    if (!traceLines)
+        return;
+    int line = sourceLine(address);
+    if (line && line != tracedLine)
+        printf("%s:%d\n", lineTable->source, line);
+    tracedLine = line;
+}
+
+// Prints the instruction, L and M fields, PC and the stack contents (after the instruction at address).
+void printStack(int address, const char instr[], int l, int m, int pc, int bp, int sp)
 {
+    traceSource(address);
+
     // Print instruction, L, M fields, and PC
     printf("    %-4s %-3d %-3d %-3d %-3d %-3d ", instr, l, m, pc, bp, sp);
 
     // Iterate through stack and print elements
-    for (int i = STACK_START - 1; i >= sp; i--)
+    for (int i = stackSize - 1; i >= sp; i--)
     {
         if (ACT_BARS[i] == 1) // Print activation bars
             printf("| ");
@@ -51,57 +425,79 @@ void printStack(const char instr[], int l, int m, int pc, int bp, int sp)
     printf("\n");
 }
 
-// Implements a virtual machine that simulates the execution of a P-Machine. Requires a file to be passed as an argument.
-int main(int argc, char *argv[])
+// Helper function that decides whether the instruction at address gets traced in sampled mode.
+int sampleTrace(int address)
 {
-    // Input validation to prevent running the program incorrectly by not passing an input file
-    if (argc != 2)
-    {
-        printf("Usage: %s <input file>\n", argv[0]);
-        return 1;
-    }
+    if (address < traceLow || address > traceHigh)
+        return 0;
+    return traceCount++ % traceEvery == 0;
+}
 
-    // Open file
-    FILE *input_file = fopen(argv[1], "r");
-    if (!input_file) // File not found / can't be opened
-    {
-        printf("Error: File was not found or can't be opened\n");
-        return 1;
-    }
-    
-    // Load program into the TEXT segment (starting at TEXT_START)
-    int textIndex = TEXT_START;
-    while (fscanf(input_file, "%d %d %d", &PAS[textIndex], &PAS[textIndex + 1], &PAS[textIndex + 2]) != EOF)
+// Helper function that applies the arithmetic/comparison OPR code op to a and b (used by fused opcodes).
+int applyOperation(int op, int a, int b)
+{
+    switch (op)
     {
-        textIndex += 3;
+    case 1: return a + b;
+    case 2: return a - b;
+    case 3: return a * b;
+    case 4: return a / b;
+    case 5: return a == b;
+    case 6: return a != b;
+    case 7: return a < b;
+    case 8: return a <= b;
+    case 9: return a > b;
+    case 10: return a >= b;
+    case 11: return a % b;
+    default: return 0;
     }
+}
 
-    // Close file
-    fclose(input_file);
-
-    // Print initial register values
-    printf("                 PC  BP  SP  Stack\n");
-    printf("Initial values:  %-3d %-3d %-3d\n\n", PC, BP, SP);
+// Switch engine: fetches and decodes every instruction from the TEXT segment on each step.
+void runSwitchEngine()
+{
+    long long executed = 0;
 
     // Main execution loop. Implements the P-Machine.
     while (EOP)
     {
-        // Fetch the next instruction (3 ints)
-        int IR_OP = PAS[PC];
-        int IR_L = PAS[PC + 1];
-        int IR_M = PAS[PC + 2];
+        // Fetch the next instruction (3 ints). Outside the program there is nothing to run.
+        int address = PC;
+        int offset = PC - TEXT_START;
+        int inText = offset >= 0 && offset <= textWords - 3;
+        int IR_OP = inText ? TEXT[offset] : 0;
+        int IR_L = inText ? TEXT[offset + 1] : 0;
+        int IR_M = inText ? TEXT[offset + 2] : 0;
         PC += 3;
-        char instruction[4] = "";
+        char instruction[5] = "";
+        executed++;
+
+        // Fused opcodes carry an operand word (X, Y, Z) right after them
+        int X = 0, Y = 0, Z = 0;
+        if (IR_OP >= FUSED_INCV && IR_OP <= FUSED_LLB)
+        {
+            if (offset + 6 > textWords)
+                IR_OP = 0; // Truncated program: invalid
+            else
+            {
+                X = TEXT[offset + 3];
+                Y = TEXT[offset + 4];
+                Z = TEXT[offset + 5];
+                PC += 3;
+            }
+        }
 
         switch (IR_OP)
         {
         case 1: // LIT" push IR_M onto the stack.
+            COUNT(0, 1);
             SP--;
             PAS[SP] = IR_M;
             strcpy(instruction, "LIT");
             break;
 
         case 2: // OPR: execute operation specified by IR_M.
+            COUNT(2, IR_M != 0); // RTN reads the dynamic link and return address
             switch (IR_M)
             {
             case 0: // RTN: return from subroutine
@@ -167,24 +563,27 @@ int main(int argc, char *argv[])
                 strcpy(instruction, "MOD");
                 break;
             default: // Error: Invalid instruction
-                printf("Invalid OPR instruction.\n");
+                invalidInstruction("Invalid OPR instruction.", address);
                 EOP = 0;
                 break;
             }
             break;
 
         case 3: // LOD: load value from earlier location in stack.
+            COUNT(1 + IR_L, 1); // base() reads one static link per level
             SP--;
             PAS[SP] = PAS[base(BP, IR_L) - IR_M];
             strcpy(instruction, "LOD");
             break;
 
         case 4: // STO: store top-of-stack value into a var slot
+            COUNT(1 + IR_L, 1);
             PAS[base(BP, IR_L) - IR_M] = PAS[SP];
             SP++;
             strcpy(instruction, "STO");
             break;
         case 5: // CAL: call a procedure.
+            COUNT(IR_L, 3);
             PAS[SP - 1] = base(BP, IR_L); // Static link
             PAS[SP - 2] = BP; // Dynamic link
             PAS[SP - 3] = PC; // Return address
@@ -193,15 +592,33 @@ int main(int argc, char *argv[])
             PC = IR_M; // Jump to procedure code
             strcpy(instruction, "CAL"); 
             break;
+        case TAIL_CAL: // TCL: call a procedure in the current frame (the caller returns right after the call)
+            if (IR_L < 1)
+            {
+                invalidInstruction("Invalid opcode.", address);
+                EOP = 0;
+                break;
+            }
+            COUNT(IR_L, 1);
+            PAS[BP] = base(BP, IR_L); // New static link; the dynamic link and return address stay
+            SP = BP + 1; // The caller's locals are gone
+            PC = IR_M;
+            strcpy(instruction, "TCL");
+            break;
         case 6: // INC: allocate memory on the stack
+            COUNT(0, 0);
+            if (incOverflows(SP, IR_M))
+                stackOverflow();
             SP -= IR_M;
             strcpy(instruction, "INC");
             break;
         case 7: // JMP: unconditional jump.
+            COUNT(0, 0);
             PC = IR_M;
             strcpy(instruction, "JMP");
             break;
         case 8: // JPC: jump if top-of-stack is zero.
+            COUNT(1, 0);
             if (PAS[SP] == 0)
             {
                 PC = IR_M;
@@ -210,17 +627,22 @@ int main(int argc, char *argv[])
             strcpy(instruction, "JPC");
             break;
         case 9: // SYS: system call -> input/output/halt.
+            COUNT(IR_M == 1, IR_M == 2);
             if (IR_M == 1) // Output
             {
-                printf("Output result is: %d\n", PAS[SP]);
+                writeValue(PAS[SP]);
                 SP++;
                 strcpy(instruction, "SYS");
             }
             else if (IR_M == 2) // Input
             {
-                printf("Please Enter an Integer: ");
+                if (traceMode != TRACE_NONE)
+                {
+                    traceSource(address);
+                    printf("Please Enter an Integer: ");
+                }
                 SP--;
-                scanf("%d", &PAS[SP]);
+                readValue(&PAS[SP]);
                 strcpy(instruction, "SYS");
             }
             else if (IR_M == 3) // Halt
@@ -229,13 +651,2282 @@ int main(int argc, char *argv[])
                 strcpy(instruction, "SYS");
             }
             break;
+        case FUSED_INCV: // INCV (fused LOD, LIT, ADD/SUB, STO): var += Z
+            COUNT(1 + IR_L, 1);
+            PAS[base(BP, IR_L) - IR_M] += Z;
+            strcpy(instruction, "INCV");
+            break;
+        case FUSED_LCB: // LCB (fused LOD, LIT, compare, JPC): jump to Z unless (var X Y)
+            COUNT(1 + IR_L, 0);
+            if (!applyOperation(X, PAS[base(BP, IR_L) - IR_M], Y))
+            {
+                PC = Z;
+            }
+            strcpy(instruction, "LCB");
+            break;
+        case FUSED_LLB: // LLB (fused LOD, LOD, OPR): push var X var(Y, Z)
+            COUNT(2 + IR_L + Y, 1);
+            SP--;
+            PAS[SP] = applyOperation(X, PAS[base(BP, IR_L) - IR_M], PAS[base(BP, Y) - Z]);
+            strcpy(instruction, "LLB");
+            break;
         default: // Error: Invalid instruction
-            printf("Invalid opcode.\n");
+            invalidInstruction("Invalid opcode.", address);
             EOP = 0;
         }
 
         // Print the stack's state after executing the current instruction
-        printStack(instruction, IR_L, IR_M, PC, BP, SP);
+        if (traceMode == TRACE_ALL || (traceMode == TRACE_SAMPLED && sampleTrace(address)))
+            printStack(address, instruction, IR_L, IR_M, PC, BP, SP);
+    }
+    if (countInstructions)
+        executedCount += executed;
+}
+
+#if defined(__GNUC__)
+// Pre-decoded instruction used by the threaded engine
+typedef struct DecodedInstruction {
+    const void *handler;               // Address of the handler that executes it
+    int l;                             // L field
+    int m;                             // M field (kept for the trace)
+    int l2, m2;                        // Second operand of fused opcodes
+    int d, d2;                         // Display entry (lexical level) of the frame of L and L2, -1 = follow static links.
+                                       // CAL/TCL: level of the called procedure, RTN: level of the returning one.
+                                       // TCL: d2 is the level of the caller, whose frame it takes over
+    struct DecodedInstruction *target; // Decoded jump/call target (JMP, JPC, CAL, LCB)
+} DecodedInstruction;
+
+// Helper function that maps a PAS code address to its decoded instruction.
+// Addresses outside the loaded program map to the trailing invalid instruction.
+DecodedInstruction *decodeAddress(DecodedInstruction *code, int count, int address)
+{
+    int offset = address - TEXT_START;
+    if (offset < 0 || offset % 3 != 0 || offset / 3 >= count)
+        return &code[count];
+    return &code[offset / 3];
+}
+
+// Helper function that computes the lexical level of every instruction (-1 = never reached): the main block is
+// level 0, and CAL L t runs t at the caller's level - L + 1. Returns 0 if an instruction is reached at two
+// levels or an L goes past the main block, in which case frames are found by following static links.
+int computeLevels(int count, int *levelAt)
+{
+    int *work = malloc((count + 1) * sizeof(int));
+    int top = 0, ok = work != NULL;
+    for (int i = 0; i < count; i++)
+        levelAt[i] = -1;
+
+    // Helper macro that records the level of an instruction index (out of range = invalid, never runs)
+#define REACH(index, level) do { \
+        int at = (index), lv = (level); \
+        if (at < 0 || at >= count) break; \
+        if (levelAt[at] >= 0 && levelAt[at] != lv) ok = 0; \
+        else if (levelAt[at] < 0) { levelAt[at] = lv; work[top++] = at; } \
+    } while (0)
+#define INDEX(address) (((address) - TEXT_START) % 3 == 0 && (address) >= TEXT_START ? ((address) - TEXT_START) / 3 : -1)
+
+    if (ok)
+        REACH(0, 0);
+    while (ok && top > 0)
+    {
+        int i = work[--top], level = levelAt[i];
+        int op = TEXT[3 * i], l = TEXT[3 * i + 1], m = TEXT[3 * i + 2];
+        int fused = op >= FUSED_INCV && op <= FUSED_LLB;
+        if (fused && i + 1 >= count)
+            continue; // Truncated: invalid
+        int y = fused ? TEXT[3 * i + 4] : 0, z = fused ? TEXT[3 * i + 5] : 0;
+
+        // Every static link walk must stay inside the chain of the current procedure
+        if ((op == 3 || op == 4 || op == 5 || fused) && (l < 0 || l > level))
+            ok = 0;
+        if (op == TAIL_CAL && l > level)
+            ok = 0;
+        if (op == FUSED_LLB && (y < 0 || y > level))
+            ok = 0;
+
+        switch (op)
+        {
+        case 2: if (m != 0) REACH(i + 1, level); break;      // OPR (RTN leaves)
+        case 5: REACH(i + 1, level); REACH(INDEX(m), level - l + 1); break; // CAL
+        case TAIL_CAL: if (l >= 1) REACH(INDEX(m), level - l + 1); break; // TCL (L < 1 is invalid)
+        case 7: REACH(INDEX(m), level); break;               // JMP
+        case 8: REACH(i + 1, level); REACH(INDEX(m), level); break; // JPC
+        case 9: if (m != 3) REACH(i + 1, level); break;      // SYS (halt leaves)
+        case FUSED_INCV: case FUSED_LLB: REACH(i + 2, level); break;
+        case FUSED_LCB: REACH(i + 2, level); REACH(INDEX(z), level); break;
+        default: REACH(i + 1, level); break;                 // LIT, LOD, STO, INC (invalid opcodes stop anyway)
+        }
+    }
+#undef REACH
+#undef INDEX
+    free(work);
+    return ok;
+}
+
+// Threaded engine: decodes the TEXT segment once into handler addresses plus operands,
+// then jumps straight from handler to handler (computed goto). Same results as the switch engine.
+void runThreadedEngine()
+{
+    // Handlers for OPR, indexed by M
+    const void *oprHandlers[12] = {
+        &&op_rtn, &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_eql,
+        &&op_neq, &&op_lss, &&op_leq, &&op_gtr, &&op_geq, &&op_mod
+    };
+
+    // Handlers for fused opcodes, indexed by the OPR code in their operand word
+    const void *lcbHandlers[11] = {
+        &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid, &&op_lcb_eql,
+        &&op_lcb_neq, &&op_lcb_lss, &&op_lcb_leq, &&op_lcb_gtr, &&op_lcb_geq
+    };
+    const void *llbHandlers[12] = {
+        &&op_invalid, &&op_llb_add, &&op_llb_sub, &&op_llb_mul, &&op_llb_div, &&op_llb_eql,
+        &&op_llb_neq, &&op_llb_lss, &&op_llb_leq, &&op_llb_gtr, &&op_llb_geq, &&op_llb_mod
+    };
+
+    // Decode every instruction, plus one trailing invalid instruction for falling off the end
+    int count = textWords / 3;
+    DecodedInstruction *code = malloc((count + 1) * sizeof(DecodedInstruction));
+    int *levelAt = malloc((count + 1) * sizeof(int));
+    int *display = malloc((count + 2) * sizeof(int)); // Frame of the innermost active procedure of each level
+    if (!code || !levelAt || !display)
+    {
+        printOutput("Error: Out of memory\n");
+        free(code);
+        free(levelAt);
+        free(display);
+        return;
+    }
+    engineMemory[0] = code;
+    engineMemory[1] = levelAt;
+    engineMemory[2] = display;
+
+    // With the level of every instruction known, frames come from the display instead of static link walks
+    int useDisplay = computeLevels(count, levelAt);
+    display[0] = BP;
+
+    for (int i = 0; i <= count; i++)
+    {
+        int op = i < count ? TEXT[3 * i] : 0;
+        int m = i < count ? TEXT[3 * i + 2] : 0;
+        code[i].l = i < count ? TEXT[3 * i + 1] : 0;
+        code[i].m = m;
+        code[i].l2 = code[i].m2 = 0;
+        code[i].target = NULL;
+        int level = useDisplay && i < count ? levelAt[i] : -1;
+        code[i].d = level >= 0 ? level - code[i].l : -1;
+        code[i].d2 = -1;
+
+        // Operand word of fused opcodes
+        int x = 0, y = 0, z = 0;
+        if (op >= FUSED_INCV && op <= FUSED_LLB)
+        {
+            if (i + 1 >= count)
+                op = 0; // Truncated program: invalid
+            else
+            {
+                x = TEXT[3 * i + 3];
+                y = TEXT[3 * i + 4];
+                z = TEXT[3 * i + 5];
+            }
+        }
+
+        switch (op)
+        {
+        case 1: code[i].handler = &&op_lit; break;
+        case 2:
+            code[i].handler = (m >= 0 && m <= 11) ? oprHandlers[m] : &&op_invalid_opr;
+            if (m == 0 && level >= 0)
+            {
+                code[i].handler = &&op_rtn_display;
+                code[i].d = level;
+            }
+            break;
+        case 3: // LOD/STO: L == 0 is the current frame, no walk at all
+            code[i].handler = code[i].l == 0 ? &&op_lod0 : code[i].d >= 0 ? &&op_lod_display : &&op_lod;
+            break;
+        case 4:
+            code[i].handler = code[i].l == 0 ? &&op_sto0 : code[i].d >= 0 ? &&op_sto_display : &&op_sto;
+            break;
+        case 5:
+            code[i].handler = level >= 0 ? &&op_cal_display : &&op_cal;
+            code[i].d = level - code[i].l + 1;
+            break;
+        case TAIL_CAL:
+            code[i].handler = code[i].l < 1 ? &&op_invalid : level >= 0 ? &&op_tcl_display : &&op_tcl;
+            code[i].d = level - code[i].l + 1;
+            code[i].d2 = level;
+            break;
+        case 6: code[i].handler = &&op_inc; break;
+        case 7: code[i].handler = &&op_jmp; break;
+        case 8: code[i].handler = &&op_jpc; break;
+        case 9: // SYS is split by M so the handler never checks it
+            if (m == 1)
+                code[i].handler = &&op_write;
+            else if (m == 2)
+                code[i].handler = &&op_read;
+            else if (m == 3)
+                code[i].handler = &&op_halt;
+            else
+                code[i].handler = &&op_sys_nop;
+            break;
+        case FUSED_INCV:
+            code[i].handler = &&op_incv;
+            code[i].m2 = z;
+            break;
+        case FUSED_LCB:
+            code[i].handler = (x >= 5 && x <= 10) ? lcbHandlers[x] : &&op_invalid;
+            code[i].m2 = y;
+            code[i].target = decodeAddress(code, count, z);
+            break;
+        case FUSED_LLB:
+            code[i].handler = (x >= 1 && x <= 11) ? llbHandlers[x] : &&op_invalid;
+            code[i].l2 = y;
+            code[i].m2 = z;
+            code[i].d2 = level >= 0 ? level - y : -1;
+            break;
+        default: code[i].handler = &&op_invalid; break;
+        }
+
+        // Resolve jump/call targets once, so handlers never translate addresses
+        if (op == 5 || op == 7 || op == 8 || op == TAIL_CAL)
+            code[i].target = decodeAddress(code, count, m);
+    }
+
+    // Registers, trace mode and profile counters live in locals while the engine runs
+    int bp = BP, sp = SP;
+    const int trace = traceMode;
+    long long *const counts = profileCounts;
+    const int hooks = trace || counts || countInstructions;
+    long long executed = 0; // Instructions run, while profiling or counting
+    DecodedInstruction *ip = code, *cur;
+
+    // Run the next handler / trace and profile the current one (PC is the address of the next instruction).
+    // CAL, TCL and RTN are told apart by the handler's name, which the compiler folds away in every other handler.
+#define CALL(name) (((name)[0] == 'C' && (name)[1] == 'A') || (name)[0] == 'T')
+#define RETURN(name) ((name)[0] == 'R' && (name)[1] == 'T')
+#define DISPATCH() do { cur = ip++; goto *cur->handler; } while (0)
+#define TRACE(name) do { \
+        if (hooks) { \
+            executed++; \
+            if (counts) { \
+                counts[cur - code]++; \
+                if (ip != cur + 1 || CALL(name)) { \
+                    profileAt = (int)(ip - code); \
+                    if (CALL(name) || RETURN(name)) \
+                        profileTransfer((int)(cur - code), (int)(ip - code), executed); \
+                } \
+            } \
+            if (trace && (trace == TRACE_ALL || sampleTrace(TEXT_START + 3 * (int)(cur - code)))) \
+                printStack(TEXT_START + 3 * (int)(cur - code), name, cur->l, cur->m, TEXT_START + 3 * (int)(ip - code), \
+                           bp, sp); \
+        } \
+    } while (0)
+#define NEXT(name) do { TRACE(name); DISPATCH(); } while (0)
+#define BINARY(name, expr) do { PAS[sp + 1] = (expr); sp++; NEXT(name); } while (0)
+#define FRAME(l, d) ((d) >= 0 ? display[d] : base(bp, l))
+#define VAR() PAS[FRAME(cur->l, cur->d) - cur->m]
+#define LCB(condition) do { ip = (condition) ? ip + 1 : cur->target; NEXT("LCB"); } while (0)
+#define LLB(expr) do { int b = PAS[FRAME(cur->l2, cur->d2) - cur->m2]; sp--; PAS[sp] = (expr); ip++; NEXT("LLB"); } while (0)
+
+    DISPATCH();
+
+op_lit: // LIT: push M onto the stack
+    sp--;
+    PAS[sp] = cur->m;
+    NEXT("LIT");
+
+op_rtn: // RTN: return from subroutine
+    ACT_BARS[bp] = 0;
+    sp = bp + 1;
+    bp = PAS[sp - 2];
+    ip = decodeAddress(code, count, PAS[sp - 3]);
+    NEXT("RTN");
+
+op_rtn_display: // RTN: also gives the returning procedure's level its previous frame back
+    display[cur->d] = DISPLAY_SAVE[bp];
+    goto op_rtn;
+
+op_add: BINARY("ADD", PAS[sp + 1] + PAS[sp]);
+op_sub: BINARY("SUB", PAS[sp + 1] - PAS[sp]);
+op_mul: BINARY("MUL", PAS[sp + 1] * PAS[sp]);
+op_div: BINARY("DIV", PAS[sp + 1] / PAS[sp]);
+op_eql: BINARY("EQL", PAS[sp + 1] == PAS[sp]);
+op_neq: BINARY("NEQ", PAS[sp + 1] != PAS[sp]);
+op_lss: BINARY("LSS", PAS[sp + 1] < PAS[sp]);
+op_leq: BINARY("LEQ", PAS[sp + 1] <= PAS[sp]);
+op_gtr: BINARY("GTR", PAS[sp + 1] > PAS[sp]);
+op_geq: BINARY("GEQ", PAS[sp + 1] >= PAS[sp]);
+op_mod: BINARY("MOD", PAS[sp + 1] % PAS[sp]);
+
+op_lod: // LOD: load value from earlier location in stack
+    sp--;
+    PAS[sp] = PAS[base(bp, cur->l) - cur->m];
+    NEXT("LOD");
+
+op_sto: // STO: store top-of-stack value into a var slot
+    PAS[base(bp, cur->l) - cur->m] = PAS[sp];
+    sp++;
+    NEXT("STO");
+
+op_lod0: // LOD/STO in the current frame
+    sp--;
+    PAS[sp] = PAS[bp - cur->m];
+    NEXT("LOD");
+
+op_sto0:
+    PAS[bp - cur->m] = PAS[sp];
+    sp++;
+    NEXT("STO");
+
+op_lod_display: // LOD/STO in an enclosing procedure's frame, found in the display
+    sp--;
+    PAS[sp] = PAS[display[cur->d] - cur->m];
+    NEXT("LOD");
+
+op_sto_display:
+    PAS[display[cur->d] - cur->m] = PAS[sp];
+    sp++;
+    NEXT("STO");
+
+op_cal: // CAL: call a procedure
+    PAS[sp - 1] = base(bp, cur->l);                   // Static link
+    PAS[sp - 2] = bp;                                 // Dynamic link
+    PAS[sp - 3] = TEXT_START + 3 * (int)(ip - code);  // Return address
+    bp = sp - 1;
+    ACT_BARS[bp] = 1;
+    ip = cur->target;
+    NEXT("CAL");
+
+op_cal_display: // CAL: the static link is the display entry one level out; the new frame takes over its level
+    PAS[sp - 1] = display[cur->d - 1];
+    PAS[sp - 2] = bp;
+    PAS[sp - 3] = TEXT_START + 3 * (int)(ip - code);
+    bp = sp - 1;
+    ACT_BARS[bp] = 1;
+    DISPLAY_SAVE[bp] = display[cur->d];
+    display[cur->d] = bp;
+    ip = cur->target;
+    NEXT("CAL");
+
+op_tcl: // TCL: the called procedure takes over the frame: new static link, same dynamic link and return address
+    PAS[bp] = base(bp, cur->l);
+    sp = bp + 1;
+    ip = cur->target;
+    NEXT("TCL");
+
+op_tcl_display: // TCL: the caller's level gets its previous frame back (as in RTN), then the callee's level the frame
+    display[cur->d2] = DISPLAY_SAVE[bp];
+    PAS[bp] = display[cur->d - 1];
+    DISPLAY_SAVE[bp] = display[cur->d];
+    display[cur->d] = bp;
+    sp = bp + 1;
+    ip = cur->target;
+    NEXT("TCL");
+
+op_inc: // INC: allocate memory on the stack
+    if (incOverflows(sp, cur->m))
+        stackOverflow();
+    sp -= cur->m;
+    NEXT("INC");
+
+op_jmp: // JMP: unconditional jump
+    ip = cur->target;
+    NEXT("JMP");
+
+op_jpc: // JPC: jump if top-of-stack is zero
+    if (PAS[sp] == 0)
+        ip = cur->target;
+    sp++;
+    NEXT("JPC");
+
+op_incv: // INCV (fused LOD, LIT, ADD/SUB, STO)
+    VAR() += cur->m2;
+    ip++; // Skip the operand word
+    NEXT("INCV");
+
+    // LCB (fused LOD, LIT, compare, JPC): fall through past the operand word, or jump when false
+op_lcb_eql: LCB(VAR() == cur->m2);
+op_lcb_neq: LCB(VAR() != cur->m2);
+op_lcb_lss: LCB(VAR() < cur->m2);
+op_lcb_leq: LCB(VAR() <= cur->m2);
+op_lcb_gtr: LCB(VAR() > cur->m2);
+op_lcb_geq: LCB(VAR() >= cur->m2);
+
+    // LLB (fused LOD, LOD, OPR): push the result
+op_llb_add: LLB(VAR() + b);
+op_llb_sub: LLB(VAR() - b);
+op_llb_mul: LLB(VAR() * b);
+op_llb_div: LLB(VAR() / b);
+op_llb_eql: LLB(VAR() == b);
+op_llb_neq: LLB(VAR() != b);
+op_llb_lss: LLB(VAR() < b);
+op_llb_leq: LLB(VAR() <= b);
+op_llb_gtr: LLB(VAR() > b);
+op_llb_geq: LLB(VAR() >= b);
+op_llb_mod: LLB(VAR() % b);
+
+op_write: // SYS 1: output
+    writeValue(PAS[sp]);
+    sp++;
+    NEXT("SYS");
+
+op_read: // SYS 2: input
+    if (trace)
+    {
+        traceSource(TEXT_START + 3 * (int)(cur - code));
+        printf("Please Enter an Integer: ");
+    }
+    sp--;
+    readValue(&PAS[sp]);
+    NEXT("SYS");
+
+op_sys_nop: // SYS with an unknown M does nothing
+    NEXT("");
+
+op_halt: // SYS 3: halt
+    TRACE("SYS");
+    goto done;
+
+op_invalid_opr: // Error: Invalid OPR instruction
+    invalidInstruction("Invalid OPR instruction.", TEXT_START + 3 * (int)(cur - code));
+    TRACE("");
+    goto done;
+
+op_invalid: // Error: Invalid instruction
+    invalidInstruction("Invalid opcode.", TEXT_START + 3 * (int)(cur - code));
+    TRACE("");
+
+done:
+    if (counts)
+        callNodes[callCurrent].exclusive += executed - callMark;
+    executedCount += executed;
+#undef CALL
+#undef RETURN
+#undef DISPATCH
+#undef TRACE
+#undef NEXT
+#undef BINARY
+#undef FRAME
+#undef VAR
+#undef LCB
+#undef LLB
+    BP = bp;
+    SP = sp;
+    PC = TEXT_START + 3 * (int)(ip - code);
+    EOP = 0;
+    free(code);
+    free(levelAt);
+    free(display);
+    engineMemory[0] = engineMemory[1] = engineMemory[2] = NULL;
+}
+#else
+// Computed goto is a GNU extension; other compilers run the switch engine instead.
+void runThreadedEngine()
+{
+    runSwitchEngine();
+}
+#endif
+
+void releaseEngineMemory();
+
+#if defined(__x86_64__) && defined(__linux__)
+// JIT engine (x86-64 Linux): every instruction becomes a fixed machine-code template in an executable buffer.
+// Register use inside the generated code (all callee-saved, so helper calls keep them):
+//   rbx = PAS, r12 = BP, r13 = SP (64-bit copies), r14 = table mapping a text word offset to native code (RTN),
+//   r15 = scratch that must survive a helper call
+// Jumps are rel32 to the target's template. SYS, base() for L >= 2 and errors are calls to the helpers below.
+#define JIT_MAX_TEMPLATE 128 // Upper bound on the bytes emitted for one instruction
+
+// Register numbers (x86-64 encoding)
+#define RAX 0
+#define RCX 1
+#define RDI 7
+#define R12 12
+#define R13 13
+#define R15 15
+
+// Code being generated
+_Thread_local unsigned char *jitCode = NULL;
+_Thread_local size_t jitSize = 0, jitCapacity = 0;
+_Thread_local int *jitOffsets = NULL;                   // Native offset of each instruction, then the invalid/invalid OPR/exit/overflow stubs
+_Thread_local int *jitFixupAt = NULL, *jitFixupTo = NULL; // rel32 fields to patch, and the instruction/stub they jump to
+_Thread_local int jitFixupCount = 0;
+
+// Helpers called from generated code
+void jitWrite(int value)
+{
+    writeValue(value);
+}
+
+void jitRead(int *slot)
+{
+    readValue(slot);
+}
+
+int jitBase(int bp, int l)
+{
+    return base(bp, l);
+}
+
+void jitInvalid(int opr, int address)
+{
+    invalidInstruction(opr ? "Invalid OPR instruction." : "Invalid opcode.", address);
+}
+
+// Helper functions that append raw bytes to the code buffer
+void emit8(int byte)
+{
+    jitCode[jitSize++] = (unsigned char)byte;
+}
+
+void emit32(int value)
+{
+    memcpy(jitCode + jitSize, &value, 4);
+    jitSize += 4;
+}
+
+void emit64(const void *pointer)
+{
+    memcpy(jitCode + jitSize, &pointer, 8);
+    jitSize += 8;
+}
+
+// Helper function that emits "opcode reg, [rbx + index * 4 + disp]" (w = 64-bit operand)
+void emitMemory(int w, int opcode, int reg, int index, int disp)
+{
+    emit8(0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1));
+    if (opcode > 0xFF)
+        emit8(opcode >> 8);
+    emit8(opcode & 0xFF);
+    emit8(0x84 | ((reg & 7) << 3));
+    emit8(0x80 | ((index & 7) << 3) | 3);
+    emit32(disp);
+}
+
+// Helper function that emits a call to a C function (rsp stays 16-byte aligned between templates)
+void emitCall(const void *function)
+{
+    emit8(0x48); emit8(0xB8); emit64(function); // mov rax, function
+    emit8(0xFF); emit8(0xD0);                   // call rax
+}
+
+// Helper function that emits a jump (opcode bytes given) whose rel32 is patched to instruction/stub target later
+void emitJump(int opcode, int target)
+{
+    if (opcode > 0xFF)
+        emit8(opcode >> 8);
+    emit8(opcode & 0xFF);
+    jitFixupAt[jitFixupCount] = (int)jitSize;
+    jitFixupTo[jitFixupCount++] = target;
+    emit32(0);
+}
+
+// Helper function that emits the error of an invalid instruction at address (opr: invalid OPR), then leaves
+void emitInvalid(int opr, int address, int count)
+{
+    emit8(0xBF); emit32(opr);     // mov edi, opr
+    emit8(0xBE); emit32(address); // mov esi, address
+    emitCall((const void *)jitInvalid);
+    emitJump(0xE9, count + 2);
+}
+
+// Helper function that maps a code address to an instruction index, or to the invalid stub (count)
+int jitTarget(int address, int count, const char *isOperand)
+{
+    int offset = address - TEXT_START;
+    if (offset < 0 || offset % 3 != 0 || offset / 3 >= count || isOperand[offset / 3])
+        return count;
+    return offset / 3;
+}
+
+// Helper function that puts the base of variable (l, m) in an index register and returns it:
+// r12 for the current frame, rax after following the static links
+int emitFrame(int l)
+{
+    if (l == 0)
+        return R12;
+    if (l == 1)
+    {
+        emitMemory(1, 0x63, RAX, R12, 0); // movsxd rax, [PAS + bp * 4]
+        return RAX;
+    }
+    emit8(0x44); emit8(0x89); emit8(0xE7); // mov edi, r12d
+    emit8(0xBE); emit32(l);                // mov esi, l
+    emitCall((const void *)jitBase);
+    emit8(0x48); emit8(0x63); emit8(0xC0); // movsxd rax, eax
+    return RAX;
+}
+
+// Helper function that emits "eax = eax op ecx" for an arithmetic/comparison OPR code.
+// Returns 0 if op is not one of them.
+int emitOperation(int op)
+{
+    static const int setcc[] = {0, 0, 0, 0, 0, 0x94, 0x95, 0x9C, 0x9E, 0x9F, 0x9D}; // EQL..GEQ
+    switch (op)
+    {
+    case 1: emit8(0x01); emit8(0xC8); return 1;                           // add eax, ecx
+    case 2: emit8(0x29); emit8(0xC8); return 1;                           // sub eax, ecx
+    case 3: emit8(0x0F); emit8(0xAF); emit8(0xC1); return 1;              // imul eax, ecx
+    case 4: emit8(0x99); emit8(0xF7); emit8(0xF9); return 1;              // cdq; idiv ecx
+    case 11: emit8(0x99); emit8(0xF7); emit8(0xF9); emit8(0x89); emit8(0xD0); return 1; // ... mov eax, edx
+    case 5: case 6: case 7: case 8: case 9: case 10:
+        emit8(0x39); emit8(0xC8);                                         // cmp eax, ecx
+        emit8(0x0F); emit8(setcc[op]); emit8(0xC0);                       // setcc al
+        emit8(0x0F); emit8(0xB6); emit8(0xC0);                            // movzx eax, al
+        return 1;
+    default:
+        return 0;
     }
+}
+
+// Function that translates the TEXT segment into native code. Returns the entry point, or NULL if the
+// program uses something the templates don't cover (the caller then interprets it).
+typedef void (*JitEntry)(int *pas, void **table);
+JitEntry jitCompile(void ***tableOut)
+{
+    int count = textWords / 3;
+    char *isOperand = calloc(count + 1, 1);
+    jitCapacity = (size_t)(count + 4) * JIT_MAX_TEMPLATE;
+    jitOffsets = malloc((count + 4) * sizeof(int));
+    jitFixupAt = malloc((count + 3) * sizeof(int));
+    jitFixupTo = malloc((count + 3) * sizeof(int));
+    void **table = malloc((textWords + 1) * sizeof(void *));
+    jitCode = mmap(NULL, jitCapacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (!isOperand || !jitOffsets || !jitFixupAt || !jitFixupTo || !table || jitCode == MAP_FAILED)
+        goto fail;
+    jitSize = 0;
+    jitFixupCount = 0;
+
+    // Operand words of fused opcodes are data
+    for (int i = 0; i + 1 < count; i++)
+    {
+        int op = TEXT[3 * i];
+        if (op >= FUSED_INCV && op <= FUSED_LLB)
+            isOperand[++i] = 1;
+    }
+
+    // Prologue: save callee-saved registers (5 pushes keep rsp 16-byte aligned), load PAS, BP, SP, table
+    emit8(0x53); emit8(0x41); emit8(0x54); emit8(0x41); emit8(0x55); // push rbx, r12, r13
+    emit8(0x41); emit8(0x56); emit8(0x41); emit8(0x57);             // push r14, r15
+    emit8(0x48); emit8(0x89); emit8(0xFB);                         // mov rbx, rdi
+    emit8(0x49); emit8(0x89); emit8(0xF6);                         // mov r14, rsi
+    emit8(0x49); emit8(0xC7); emit8(0xC4); emit32(BP);             // mov r12, BP
+    emit8(0x49); emit8(0xC7); emit8(0xC5); emit32(SP);             // mov r13, SP
+    emitJump(0xE9, jitTarget(PC, count, isOperand));               // jmp to the first instruction
+
+    for (int i = 0; i < count; i++)
+    {
+        jitOffsets[i] = (int)jitSize;
+        if (isOperand[i])
+            continue;
+
+        int op = TEXT[3 * i], l = TEXT[3 * i + 1], m = TEXT[3 * i + 2];
+        int x = 0, y = 0, z = 0;
+        if (op >= FUSED_INCV && op <= FUSED_LLB)
+        {
+            if (i + 1 >= count)
+                op = 0; // Truncated program: invalid
+            else
+            {
+                x = TEXT[3 * i + 3];
+                y = TEXT[3 * i + 4];
+                z = TEXT[3 * i + 5];
+            }
+        }
+
+        // Frame offsets become 32-bit displacements
+        if (m < -(1 << 28) || m > (1 << 28) || z < -(1 << 28) || z > (1 << 28))
+            goto fail;
+
+        int frame;
+        switch (op)
+        {
+        case 1: // LIT: dec r13; mov [sp], m
+            emit8(0x49); emit8(0xFF); emit8(0xCD);
+            emitMemory(0, 0xC7, 0, R13, 0);
+            emit32(m);
+            break;
+        case 2: // OPR
+            if (m == 0) // RTN: sp = bp + 1; bp = PAS[sp - 2]; jump through the table to PAS[sp - 3]
+            {
+                emit8(0x4D); emit8(0x8D); emit8(0x6C); emit8(0x24); emit8(0x01); // lea r13, [r12 + 1]
+                emitMemory(1, 0x63, R12, R13, -8);                             // movsxd r12, [sp - 2]
+                emitMemory(1, 0x63, RAX, R13, -12);                            // movsxd rax, [sp - 3]
+                emit8(0x48); emit8(0x83); emit8(0xE8); emit8(TEXT_START);      // sub rax, TEXT_START
+                emit8(0x48); emit8(0x3D); emit32(textWords);                   // cmp rax, textWords
+                emitJump(0x0F83, count);                                       // jae invalid
+                emit8(0x41); emit8(0xFF); emit8(0x24); emit8(0xC6);            // jmp [r14 + rax * 8]
+                break;
+            }
+            emitMemory(0, 0x8B, RCX, R13, 0); // mov ecx, [sp]
+            emitMemory(0, 0x8B, RAX, R13, 4); // mov eax, [sp + 1]
+            if (!emitOperation(m))
+            {
+                emitInvalid(1, TEXT_START + 3 * i, count);
+                break;
+            }
+            emitMemory(0, 0x89, RAX, R13, 4);          // mov [sp + 1], eax
+            emit8(0x49); emit8(0xFF); emit8(0xC5);     // inc r13
+            break;
+        case 3: // LOD
+            frame = emitFrame(l);
+            emitMemory(0, 0x8B, RCX, frame, -4 * m);   // mov ecx, [base - m]
+            emit8(0x49); emit8(0xFF); emit8(0xCD);     // dec r13
+            emitMemory(0, 0x89, RCX, R13, 0);          // mov [sp], ecx
+            break;
+        case 4: // STO
+            frame = emitFrame(l);
+            emitMemory(0, 0x8B, RCX, R13, 0);          // mov ecx, [sp]
+            emitMemory(0, 0x89, RCX, frame, -4 * m);   // mov [base - m], ecx
+            emit8(0x49); emit8(0xFF); emit8(0xC5);     // inc r13
+            break;
+        case 5: // CAL: static link, dynamic link, return address, bp = sp - 1
+            if (l == 0)
+            {
+                emit8(0x44); emit8(0x89); emit8(0xE0); // mov eax, r12d
+            }
+            else
+                emitFrame(l); // rax = base(bp, l)
+            emitMemory(0, 0x89, RAX, R13, -4);                 // mov [sp - 1], eax
+            emitMemory(0, 0x89, R12, R13, -8);                 // mov [sp - 2], r12d
+            emitMemory(0, 0xC7, 0, R13, -12);                  // mov [sp - 3], return address
+            emit32(TEXT_START + 3 * (i + 1));
+            emit8(0x4D); emit8(0x8D); emit8(0x65); emit8(0xFF); // lea r12, [r13 - 1]
+            emitJump(0xE9, jitTarget(m, count, isOperand));
+            break;
+        case TAIL_CAL: // TCL: new static link in the current frame, sp = bp + 1
+            if (l < 1)
+            {
+                emitInvalid(0, TEXT_START + 3 * i, count); // As in the threaded engine
+                break;
+            }
+            emitFrame(l);                                                    // rax = base(bp, l)
+            emitMemory(0, 0x89, RAX, R12, 0);                                // mov [bp], eax
+            emit8(0x4D); emit8(0x8D); emit8(0x6C); emit8(0x24); emit8(0x01); // lea r13, [r12 + 1]
+            emitJump(0xE9, jitTarget(m, count, isOperand));
+            break;
+        case 6: // INC: sub r13, m, then the stack check (see incOverflows)
+            emit8(0x49); emit8(0x81); emit8(0xED); emit32(m);         // sub r13, m
+            emit8(0x49); emit8(0x81); emit8(0xFD); emit32(stackSize); // cmp r13, stackSize
+            emitJump(0x0F87, count + 3);                              // ja overflow (below 0 is above unsigned)
+            break;
+        case 7: // JMP
+            emitJump(0xE9, jitTarget(m, count, isOperand));
+            break;
+        case 8: // JPC: pop, jump if zero
+            emitMemory(0, 0x8B, RAX, R13, 0);      // mov eax, [sp]
+            emit8(0x49); emit8(0xFF); emit8(0xC5); // inc r13
+            emit8(0x85); emit8(0xC0);              // test eax, eax
+            emitJump(0x0F84, jitTarget(m, count, isOperand));
+            break;
+        case 9: // SYS
+            if (m == 1) // Output
+            {
+                emitMemory(0, 0x8B, RDI, R13, 0);      // mov edi, [sp]
+                emitCall((const void *)jitWrite);
+                emit8(0x49); emit8(0xFF); emit8(0xC5); // inc r13
+            }
+            else if (m == 2) // Input
+            {
+                emit8(0x49); emit8(0xFF); emit8(0xCD); // dec r13
+                emitMemory(1, 0x8D, RDI, R13, 0);      // lea rdi, [sp]
+                emitCall((const void *)jitRead);
+            }
+            else if (m == 3) // Halt
+                emitJump(0xE9, count + 2);
+            break;
+        case FUSED_INCV: // INCV: add [var], z
+            frame = emitFrame(l);
+            emitMemory(0, 0x81, 0, frame, -4 * m);
+            emit32(z);
+            break;
+        case FUSED_LCB: // LCB: cmp [var], y; jump to z when the comparison is false
+        {
+            static const int jumpIfFalse[] = {0, 0, 0, 0, 0, 0x0F85, 0x0F84, 0x0F8D, 0x0F8F, 0x0F8E, 0x0F8C};
+            if (x < 5 || x > 10)
+            {
+                emitInvalid(0, TEXT_START + 3 * i, count); // As in the threaded engine
+                break;
+            }
+            frame = emitFrame(l);
+            emitMemory(0, 0x8B, RAX, frame, -4 * m); // mov eax, [var]
+            emit8(0x3D); emit32(y);                  // cmp eax, y
+            emitJump(jumpIfFalse[x], jitTarget(z, count, isOperand));
+            break;
+        }
+        case FUSED_LLB: // LLB: push var x var(y, z). var2 waits in r15, which survives a jitBase call.
+            if (x < 1 || x > 11)
+            {
+                emitInvalid(0, TEXT_START + 3 * i, count); // As in the threaded engine
+                break;
+            }
+            frame = emitFrame(y);
+            emitMemory(0, 0x8B, R15, frame, -4 * z); // mov r15d, [var2]
+            frame = emitFrame(l);
+            emitMemory(0, 0x8B, RAX, frame, -4 * m); // mov eax, [var]
+            emit8(0x44); emit8(0x89); emit8(0xF9);   // mov ecx, r15d
+            emitOperation(x);
+            emit8(0x49); emit8(0xFF); emit8(0xCD);   // dec r13
+            emitMemory(0, 0x89, RAX, R13, 0);        // mov [sp], eax
+            break;
+        default: // Invalid opcode
+            emitInvalid(0, TEXT_START + 3 * i, count);
+            break;
+        }
+    }
+
+    // Falling off the end is an invalid opcode too (at no source position). Stubs: invalid, invalid OPR, exit,
+    // stack overflow (which doesn't come back).
+    for (int stub = 0; stub < 2; stub++)
+    {
+        jitOffsets[count + stub] = (int)jitSize;
+        emit8(0xBF); emit32(stub); // mov edi, stub
+        emit8(0xBE); emit32(0);    // mov esi, 0
+        emitCall((const void *)jitInvalid);
+        emitJump(0xE9, count + 2);
+    }
+    jitOffsets[count + 2] = (int)jitSize;
+    emit8(0x41); emit8(0x5F); emit8(0x41); emit8(0x5E); emit8(0x41); emit8(0x5D); // pop r15, r14, r13
+    emit8(0x41); emit8(0x5C); emit8(0x5B);                                       // pop r12, rbx
+    emit8(0xC3);                                                                 // ret
+    jitOffsets[count + 3] = (int)jitSize;
+    emitCall((const void *)stackOverflow);
+
+    // Resolve jumps, and the return address table (word offset -> native code)
+    for (int f = 0; f < jitFixupCount; f++)
+    {
+        int rel = jitOffsets[jitFixupTo[f]] - (jitFixupAt[f] + 4);
+        memcpy(jitCode + jitFixupAt[f], &rel, 4);
+    }
+    for (int w = 0; w < textWords; w++)
+        table[w] = jitCode + jitOffsets[jitTarget(TEXT_START + w, count, isOperand)];
+
+    // W^X: the buffer becomes executable only after it's written
+    if (mprotect(jitCode, jitCapacity, PROT_READ | PROT_EXEC) != 0)
+        goto fail;
+    free(isOperand);
+    free(jitOffsets);
+    free(jitFixupAt);
+    free(jitFixupTo);
+    *tableOut = table;
+    return (JitEntry)(void *)jitCode;
+
+fail: // Release everything; the caller interprets the program instead
+    free(isOperand);
+    free(jitOffsets);
+    free(jitFixupAt);
+    free(jitFixupTo);
+    free(table);
+    if (jitCode != MAP_FAILED)
+        munmap(jitCode, jitCapacity);
+    jitCode = NULL;
+    return NULL;
+}
+
+// JIT engine: compiles the program to native code and runs it. Programs the templates can't handle,
+// and traced runs, use the threaded engine instead.
+void runJitEngine()
+{
+    void **table = NULL;
+    JitEntry entry = traceMode == TRACE_NONE ? jitCompile(&table) : NULL;
+    if (!entry)
+    {
+        runThreadedEngine();
+        return;
+    }
+    engineMemory[0] = table;
+    entry(PAS, table);
+    EOP = 0;
+    releaseEngineMemory();
+}
+#else
+// The JIT only targets x86-64 Linux; elsewhere the threaded engine runs instead.
+void runJitEngine()
+{
+    runThreadedEngine();
+}
+#endif
+
+// Helper function that frees what an engine holds while it runs (see engineMemory) and the JIT's code
+void releaseEngineMemory()
+{
+    for (int i = 0; i < 3; i++)
+    {
+        free(engineMemory[i]);
+        engineMemory[i] = NULL;
+    }
+#if defined(__x86_64__) && defined(__linux__)
+    if (jitCode)
+        munmap(jitCode, jitCapacity);
+    jitCode = NULL;
+#endif
+}
+
+#if defined(__GNUC__)
+// Register engine: runs three-address register code (see regcode.h) with computed goto. Register r is
+// PAS[bp - r], so variables and expression temporaries are read and written in place, without SP.
+void runRegisterEngine(const RegInstruction *code, int count)
+{
+    // Handlers indexed by opcode (ADD..MOD and the compare-and-branch groups in OPR order)
+    static const void *handlers[REG_OPCODES] = {
+        &&reg_invalid, &&reg_invalid_opr, &&reg_halt, &&reg_ldi, &&reg_mov, &&reg_ldu, &&reg_stu,
+        &&reg_jmp, &&reg_jz, &&reg_cal, &&reg_rtn, &&reg_write, &&reg_writei, &&reg_read,
+        &&reg_add, &&reg_sub, &&reg_mul, &&reg_div, &&reg_eql, &&reg_neq,
+        &&reg_lss, &&reg_leq, &&reg_gtr, &&reg_geq, &&reg_mod,
+        &&reg_addi, &&reg_subi, &&reg_muli, &&reg_divi, &&reg_eqli, &&reg_neqi,
+        &&reg_lssi, &&reg_leqi, &&reg_gtri, &&reg_geqi, &&reg_modi,
+        &&reg_jfeq, &&reg_jfne, &&reg_jflt, &&reg_jfle, &&reg_jfgt, &&reg_jfge,
+        &&reg_jfeqi, &&reg_jfnei, &&reg_jflti, &&reg_jflei, &&reg_jfgti, &&reg_jfgei, &&reg_tcl,
+        &&reg_chk
+    };
+
+    int bp = BP;
+    const RegInstruction *ip = code, *cur;
+
+#define R(r) PAS[bp - (r)]
+#define DISPATCH() do { cur = ip++; goto *handlers[cur->op]; } while (0)
+#define BINARY(expr) do { COUNT(2, 1); R(cur->a) = (expr); DISPATCH(); } while (0)
+#define IMMEDIATE(expr) do { COUNT(1, 1); R(cur->a) = (expr); DISPATCH(); } while (0)
+#define BRANCH(condition, reads) do { COUNT(reads, 0); if (!(condition)) ip = code + cur->c; DISPATCH(); } while (0)
+
+    DISPATCH();
+
+reg_ldi: COUNT(0, 1); R(cur->a) = cur->b; DISPATCH();
+reg_mov: COUNT(1, 1); R(cur->a) = R(cur->b); DISPATCH();
+reg_ldu: COUNT(1 + cur->b, 1); R(cur->a) = PAS[base(bp, cur->b) - cur->c]; DISPATCH();
+reg_stu: COUNT(1 + cur->b, 1); PAS[base(bp, cur->b) - cur->c] = R(cur->a); DISPATCH();
+reg_jmp: COUNT(0, 0); ip = code + cur->a; DISPATCH();
+reg_jz: COUNT(1, 0); if (R(cur->a) == 0) ip = code + cur->b; DISPATCH();
+
+reg_cal: // CAL: same frame layout as the P-machine, the return address is an instruction index
+    {
+        COUNT(cur->a, 3);
+        int frame = bp - cur->c;
+        PAS[frame] = base(bp, cur->a);     // Static link
+        PAS[frame - 1] = bp;               // Dynamic link
+        PAS[frame - 2] = (int)(ip - code); // Return address
+        bp = frame;
+        ip = code + cur->b;
+        DISPATCH();
+    }
+
+reg_tcl: // TCL: the called procedure takes over the frame (new static link, same dynamic link and return address)
+    COUNT(cur->a, 1);
+    PAS[bp] = base(bp, cur->a);
+    ip = code + cur->b;
+    DISPATCH();
+
+reg_chk: // INC's stack check: the entry at depth d is at PAS[bp + 1 - d]
+    COUNT(0, 0);
+    if (incOverflows(bp + 1, cur->a))
+        stackOverflow();
+    DISPATCH();
+
+reg_rtn: // RTN
+    {
+        COUNT(2, 0);
+        int ra = PAS[bp - 2];
+        bp = PAS[bp - 1];
+        if (ra < 0 || ra >= count)
+            goto reg_invalid;
+        ip = code + ra;
+        DISPATCH();
+    }
+
+reg_write: COUNT(1, 0); writeValue(R(cur->a)); DISPATCH();
+reg_writei: COUNT(0, 0); writeValue(cur->a); DISPATCH();
+reg_read: COUNT(0, 1); readValue(&R(cur->a)); DISPATCH();
+
+reg_add: BINARY(R(cur->b) + R(cur->c));
+reg_sub: BINARY(R(cur->b) - R(cur->c));
+reg_mul: BINARY(R(cur->b) * R(cur->c));
+reg_div: BINARY(R(cur->b) / R(cur->c));
+reg_eql: BINARY(R(cur->b) == R(cur->c));
+reg_neq: BINARY(R(cur->b) != R(cur->c));
+reg_lss: BINARY(R(cur->b) < R(cur->c));
+reg_leq: BINARY(R(cur->b) <= R(cur->c));
+reg_gtr: BINARY(R(cur->b) > R(cur->c));
+reg_geq: BINARY(R(cur->b) >= R(cur->c));
+reg_mod: BINARY(R(cur->b) % R(cur->c));
+
+reg_addi: IMMEDIATE(R(cur->b) + cur->c);
+reg_subi: IMMEDIATE(R(cur->b) - cur->c);
+reg_muli: IMMEDIATE(R(cur->b) * cur->c);
+reg_divi: IMMEDIATE(R(cur->b) / cur->c);
+reg_eqli: IMMEDIATE(R(cur->b) == cur->c);
+reg_neqi: IMMEDIATE(R(cur->b) != cur->c);
+reg_lssi: IMMEDIATE(R(cur->b) < cur->c);
+reg_leqi: IMMEDIATE(R(cur->b) <= cur->c);
+reg_gtri: IMMEDIATE(R(cur->b) > cur->c);
+reg_geqi: IMMEDIATE(R(cur->b) >= cur->c);
+reg_modi: IMMEDIATE(R(cur->b) % cur->c);
+
+reg_jfeq: BRANCH(R(cur->a) == R(cur->b), 2);
+reg_jfne: BRANCH(R(cur->a) != R(cur->b), 2);
+reg_jflt: BRANCH(R(cur->a) < R(cur->b), 2);
+reg_jfle: BRANCH(R(cur->a) <= R(cur->b), 2);
+reg_jfgt: BRANCH(R(cur->a) > R(cur->b), 2);
+reg_jfge: BRANCH(R(cur->a) >= R(cur->b), 2);
+reg_jfeqi: BRANCH(R(cur->a) == cur->b, 1);
+reg_jfnei: BRANCH(R(cur->a) != cur->b, 1);
+reg_jflti: BRANCH(R(cur->a) < cur->b, 1);
+reg_jflei: BRANCH(R(cur->a) <= cur->b, 1);
+reg_jfgti: BRANCH(R(cur->a) > cur->b, 1);
+reg_jfgei: BRANCH(R(cur->a) >= cur->b, 1);
+
+reg_invalid_opr: // Error: Invalid OPR instruction
+    printOutput("Invalid OPR instruction.\n");
+    goto reg_halt;
+
+reg_invalid: // Error: Invalid instruction
+    printOutput("Invalid opcode.\n");
+
+reg_halt:
+#undef R
+#undef DISPATCH
+#undef BINARY
+#undef IMMEDIATE
+#undef BRANCH
+    BP = bp;
+    EOP = 0;
+}
+#else
+// Computed goto is a GNU extension; other compilers can't run register code.
+void runRegisterEngine(const RegInstruction *code, int count)
+{
+    (void)code;
+    (void)count;
+    printOutput("Error: The register engine needs gcc or clang\n");
+}
+#endif
+
+// Helper function that runs the loaded program on the register engine. op/L/M programs are translated first;
+// traced runs and programs the translator can't handle use the threaded engine instead.
+void runRegisterProgram()
+{
+    if (regCode)
+    {
+        runRegisterEngine(regCode, regCount);
+        return;
+    }
+
+    RegInstruction *code = NULL;
+    int count = 0;
+    if (traceMode != TRACE_NONE || !regTranslate(TEXT, textWords / 3, TEXT_START, &code, &count))
+    {
+        runThreadedEngine();
+        return;
+    }
+    engineMemory[0] = code;
+    runRegisterEngine(code, count);
+    releaseEngineMemory();
+}
+
+// Helper function that maps a binary elf file and runs its instruction array in place.
+// Returns 1 on success, 0 (after printing an error) if the file is not a valid binary elf.
+int mapBinaryProgram(int fd)
+{
+    // Map the whole file read-only
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(PcodeHeader))
+    {
+        printOutput("Error: Invalid binary elf file\n");
+        return 0;
+    }
+    void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        printOutput("Error: File can't be mapped\n");
+        return 0;
+    }
+
+    // Validate header and section sizes
+    const PcodeHeader *header = map;
+    size_t expected = sizeof(PcodeHeader) + (size_t)header->instructionCount * sizeof(PcodeInstruction)
+                      + (size_t)header->symbolCount * sizeof(PcodeSymbol);
+    if (header->version != PCODE_VERSION || expected > (size_t)info.st_size
+        || header->instructionCount > INT_MAX / 3)
+    {
+        printOutput("Error: Unsupported or truncated binary elf file\n");
+        munmap(map, info.st_size);
+        return 0;
+    }
+
+    // No parsing: the instruction array is the TEXT segment. The mapping lives until exit.
+    TEXT = (const int *)(header + 1);
+    textWords = 3 * (int)header->instructionCount;
+    symbols = (const PcodeSymbol *)(TEXT + textWords);
+    symbolCount = (int)header->symbolCount;
+    return 1;
+}
+
+// Helper function that maps a register elf file (see regcode.h) and runs its instruction array in place.
+// Returns 1 on success, 0 (after printing an error) if the file is not a valid register elf.
+int mapRegisterProgram(int fd)
+{
+    // Map the whole file read-only
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(RegHeader))
+    {
+        printOutput("Error: Invalid register elf file\n");
+        return 0;
+    }
+    void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        printOutput("Error: File can't be mapped\n");
+        return 0;
+    }
+
+    // Validate header, opcodes and jump targets, so the engine never checks them
+    const RegHeader *header = map;
+    const RegInstruction *code = (const RegInstruction *)(header + 1);
+    int count = (int)header->instructionCount;
+    int valid = header->version == REGCODE_VERSION && header->instructionCount <= INT_MAX / sizeof(RegInstruction)
+                && sizeof(RegHeader) + (size_t)count * sizeof(RegInstruction) <= (size_t)info.st_size;
+    for (int i = 0; valid && i < count; i++)
+    {
+        int op = code[i].op;
+        int target = op == REG_JMP ? code[i].a : (op == REG_JZ || op == REG_CAL || op == REG_TCL) ? code[i].b
+                   : op >= REG_JFEQ && op < REG_TCL ? code[i].c : 0;
+        valid = op >= 0 && op < REG_OPCODES && target >= 0 && target < count;
+    }
+    if (!valid || count == 0)
+    {
+        printOutput("Error: Unsupported or truncated register elf file\n");
+        munmap(map, info.st_size);
+        return 0;
+    }
+
+    // The mapping lives until exit
+    regCode = code;
+    regCount = count;
+    return 1;
+}
+
+// Function that loads the line table written next to the P-code elf fileName, if there is one and it belongs to
+// the loaded program. Without a table, positions are just not reported.
+void loadLineTable(const char *fileName)
+{
+    lineTable = NULL;
+    char tableName[4096], header[64], source[4096];
+    snprintf(tableName, sizeof(tableName), "%s%s", fileName, PCODE_LINES_SUFFIX);
+    FILE *input = fopen(tableName, "r");
+    if (!input)
+        return;
+
+    // Header: version, and the size and hash of the program it was written for
+    int version = 0, count = -1;
+    unsigned int hash = 0;
+    size_t length = 0;
+    if (fscanf(input, "%63s %d %d %u", header, &version, &count, &hash) != 4 || strcmp(header, PCODE_LINES_MAGIC) != 0 ||
+        version != PCODE_LINES_VERSION || count != textWords / 3 || hash != pcodeHash(TEXT, (size_t)textWords) ||
+        fgetc(input) != '\n' || !fgets(source, sizeof(source), input) || (length = strcspn(source, "\n")) == 0)
+    {
+        fclose(input);
+        return;
+    }
+    source[length] = '\0';
+
+    // Entries
+    LineTable *table = calloc(1, sizeof(LineTable));
+    int capacity = 0, index, line;
+    while (table && fscanf(input, "%d %d", &index, &line) == 2)
+    {
+        if (table->count == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 256;
+            int *indexes = realloc(table->index, capacity * sizeof(int));
+            if (indexes)
+                table->index = indexes;
+            int *lines = realloc(table->line, capacity * sizeof(int));
+            if (lines)
+                table->line = lines;
+            if (!indexes || !lines)
+                break;
+        }
+        table->index[table->count] = index;
+        table->line[table->count] = line;
+        table->count++;
+    }
+    fclose(input);
+    if (table && (table->source = strdup(source)))
+    {
+        lineTable = table;
+        return;
+    }
+    if (table)
+    {
+        free(table->index);
+        free(table->line);
+        free(table);
+    }
+}
+
+// Helper function that loads a program. Binary elf files (PCODE_MAGIC) are mapped,
+// anything else is read as the text format ("op l m" triples) into the TEXT segment of PAS.
+// Returns 1 on success, 0 (after printing an error) otherwise.
+int loadProgram(const char *fileName)
+{
+    lineTable = NULL;
+
+    // Open file
+    FILE *input_file = fopen(fileName, "r");
+    if (!input_file) // File not found / can't be opened
+    {
+        printOutput("Error: File was not found or can't be opened\n");
+        return 0;
+    }
+
+    // Check for the binary format
+    char magic[4] = "";
+    if (fread(magic, 1, 4, input_file) == 4 && memcmp(magic, PCODE_MAGIC, 4) == 0)
+    {
+        int loaded = mapBinaryProgram(fileno(input_file));
+        fclose(input_file);
+        if (loaded)
+            loadLineTable(fileName);
+        return loaded;
+    }
+    if (memcmp(magic, REGCODE_MAGIC, 4) == 0)
+    {
+        int loaded = mapRegisterProgram(fileno(input_file));
+        fclose(input_file);
+        return loaded;
+    }
+    rewind(input_file);
+
+    // Load the program into a code segment of its own, which grows as needed
+    int *code = NULL;
+    int words = 0, capacity = 0;
+    int op = 0, l = 0, m = 0, fields;
+    while ((fields = fscanf(input_file, "%d %d %d", &op, &l, &m)) != EOF && fields > 0)
+    {
+        if (words + 3 > capacity)
+        {
+            int *grown = capacity <= INT_MAX / 2 - 3 ? realloc(code, (size_t)(capacity ? 2 * capacity : 3 * 256) * sizeof(int)) : NULL;
+            if (!grown)
+            {
+                printOutput("Error: Out of memory\n");
+                fclose(input_file);
+                return 0;
+            }
+            code = grown;
+            capacity = capacity ? 2 * capacity : 3 * 256;
+        }
+        code[words] = op;
+        code[words + 1] = l;
+        code[words + 2] = m;
+        words += 3;
+        op = l = m = 0; // A short last line is padded with zeros
+    }
+    TEXT = code;
+    textWords = words;
+
+    // Close file
+    fclose(input_file);
+    loadLineTable(fileName);
+    return 1;
+}
+
+// Signal handler that reports an access to the guard regions around PAS as a stack overflow.
+// Anything else is a real crash: the default action runs when the access is retried.
+void stackFault(int sig, siginfo_t *info, void *context)
+{
+    (void)context;
+    char *address = info->si_addr;
+    if ((address >= stackGuardLow && address < stackGuardLow + STACK_GUARD) ||
+        (address >= stackGuardHigh && address < stackGuardHigh + STACK_GUARD))
+        stackOverflow();
+    signal(sig, SIG_DFL);
+}
+
+// Helper function that allocates a stack of words words. PAS is mapped between two inaccessible guard
+// regions, so running off either end stops the program with an error instead of corrupting memory, and
+// the engines only check SP in INC (see incOverflows). Pages are only committed when they're used.
+// Returns 0 on failure.
+int allocateStack(int words)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t bytes = ((size_t)words * sizeof(int) + page - 1) / page * page;
+    char *region = mmap(NULL, bytes + 2 * STACK_GUARD, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED || mprotect(region + STACK_GUARD, bytes, PROT_READ | PROT_WRITE) != 0)
+        return 0;
+    stackGuardLow = region;
+    stackGuardHigh = region + STACK_GUARD + bytes;
+
+    // PAS[0] touches the lower guard, so an overflowing CAL faults on PAS before it writes ACT_BARS or DISPLAY_SAVE
+    PAS = (int *)(region + STACK_GUARD);
+    free(ACT_BARS);
+    free(DISPLAY_SAVE);
+    ACT_BARS = calloc(words, sizeof(int));
+    DISPLAY_SAVE = calloc(words, sizeof(int));
+    if (!ACT_BARS || !DISPLAY_SAVE)
+        return 0;
+    stackSize = words;
+    BP = words - 1;
+    SP = words;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = stackFault;
+    action.sa_flags = SA_SIGINFO;
+    sigaction(SIGSEGV, &action, NULL);
+    sigaction(SIGBUS, &action, NULL);
+    return 1;
+}
+
+// Helper function that gives a batch job a clean machine on this thread's stack: registers at their initial values
+// and a stack of zeros, as in a new process (the stack's pages are dropped and come back zeroed when touched)
+void resetMachine()
+{
+    madvise(stackGuardLow + STACK_GUARD, stackGuardHigh - stackGuardLow - STACK_GUARD, MADV_DONTNEED);
+    memset(ACT_BARS, 0, stackSize * sizeof(int));
+    memset(DISPLAY_SAVE, 0, stackSize * sizeof(int));
+    BP = stackSize - 1;
+    SP = stackSize;
+    PC = TEXT_START;
+    EOP = 1;
+    traceCount = 0;
+    executedCount = 0;
+}
+
+// Helper function that frees this thread's stack
+void releaseStack()
+{
+    if (stackGuardLow)
+        munmap(stackGuardLow, stackGuardHigh + STACK_GUARD - stackGuardLow);
+    free(ACT_BARS);
+    free(DISPLAY_SAVE);
+    stackGuardLow = stackGuardHigh = NULL;
+    PAS = ACT_BARS = DISPLAY_SAVE = NULL;
+}
+
+// Helper function that returns the mnemonic of an opcode, as in the compiler's assembly listing.
+const char *opcodeName(int op)
+{
+    static const char *names[] = { "???", "LIT", "OPR", "LOD", "STO", "CAL", "INC", "JMP", "JPC", "SYS",
+                                   "INCV", "LCB", "LLB", "TCL" };
+    return op >= 1 && op <= TAIL_CAL ? names[op] : names[0];
+}
+
+// SIGPROF handler: one sample of the instruction running now
+void profileTick(int sig)
+{
+    (void)sig;
+    profileSamples[profileAt]++;
+}
+
+// Function that allocates the profile counters and starts the CPU-time sampling timer. Returns 1 on success.
+int startProfile()
+{
+    int count = textWords / 3;
+    profileCounts = calloc(count + 1, sizeof(long long));
+    profileSamples = calloc(count + 1, sizeof(int));
+    if (!profileCounts || !profileSamples)
+        return 0;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = profileTick;
+    action.sa_flags = SA_RESTART; // read/write calls interrupted by a sample just continue
+    sigaction(SIGPROF, &action, NULL);
+
+    // The call-path tree starts with the main block
+    callNodeCapacity = 64;
+    callNodes = malloc(callNodeCapacity * sizeof(CallNode));
+    if (!callNodes)
+        return 0;
+    callNodes[0] = (CallNode){ 0, -1, -1, -1, 0, 1, 0, 0 };
+    callNodeCount = 1;
+
+    struct itimerval timer = { { 0, PROFILE_INTERVAL }, { 0, PROFILE_INTERVAL } };
+    profileStart = clock();
+    return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+// Function that follows a CAL, TCL or RTN for the call-graph profile: the instructions executed since the last call
+// or return go to the current call path, then a CAL moves to the path extended by its target (created on first use)
+// and a RTN moves back to the caller's path. A TCL does both: the called procedure replaces its caller in the path.
+void profileTransfer(int from, int to, long long executed)
+{
+    callNodes[callCurrent].exclusive += executed - callMark;
+    callMark = executed;
+
+    if (TEXT[3 * from] != 5) // RTN, or the return half of a TCL
+    {
+        if (callOverflow > 0)
+            callOverflow--;
+        else if (callNodes[callCurrent].parent >= 0)
+            callCurrent = callNodes[callCurrent].parent;
+        if (TEXT[3 * from] != TAIL_CAL)
+            return;
+    }
+    if (callNodes[callCurrent].depth >= PROFILE_MAX_DEPTH)
+    {
+        callOverflow++;
+        return;
+    }
+
+    int child = callNodes[callCurrent].firstChild;
+    while (child >= 0 && callNodes[child].entry != to)
+        child = callNodes[child].nextSibling;
+    if (child < 0)
+    {
+        if (callNodeCount == callNodeCapacity)
+        {
+            CallNode *grown = realloc(callNodes, 2 * callNodeCapacity * sizeof(CallNode));
+            if (!grown)
+            {
+                callOverflow++; // Out of memory: count the call in the caller
+                return;
+            }
+            callNodes = grown;
+            callNodeCapacity *= 2;
+        }
+        child = callNodeCount++;
+        callNodes[child] = (CallNode){ to, callCurrent, -1, callNodes[callCurrent].firstChild,
+                                       callNodes[callCurrent].depth + 1, 0, 0, 0 };
+        callNodes[callCurrent].firstChild = child;
+    }
+    callNodes[child].calls++;
+    callCurrent = child;
+}
+
+// Helper function that returns the name of the procedure whose entry is the given instruction index, from the
+// symbol section of a binary elf, or NULL if it has none
+const char *procedureName(int entry)
+{
+    for (int k = 0; k < symbolCount; k++)
+    {
+        if (symbols[k].kind == 3 && symbols[k].address == TEXT_START + 3 * entry)
+            return symbols[k].name;
+    }
+    return NULL;
+}
+
+// Helper function that writes a call path as frame names separated by ';' (the folded-stack format): "main", then
+// each procedure's name, or "proc_ADDRESS" where the elf has no symbols
+void writeCallPath(FILE *output, int node)
+{
+    if (callNodes[node].parent < 0)
+    {
+        fprintf(output, "main");
+        return;
+    }
+    writeCallPath(output, callNodes[node].parent);
+    const char *name = procedureName(callNodes[node].entry);
+    if (name)
+        fprintf(output, ";%s", name);
+    else
+        fprintf(output, ";proc_%d", TEXT_START + 3 * callNodes[node].entry);
+}
+
+// Helper function that adds every call path's exclusive count, and its children's inclusive counts, into its
+// inclusive count (children are always created after their parent)
+void sumCallPaths()
+{
+    for (int i = 0; i < callNodeCount; i++)
+        callNodes[i].inclusive = callNodes[i].exclusive;
+    for (int i = callNodeCount - 1; i > 0; i--)
+        callNodes[callNodes[i].parent].inclusive += callNodes[i].inclusive;
+}
+
+// Helper function that orders call paths by inclusive count, largest first, for qsort
+int compareCallPaths(const void *a, const void *b)
+{
+    long long x = callNodes[*(const int *)a].inclusive, y = callNodes[*(const int *)b].inclusive;
+    return x < y ? 1 : x > y ? -1 : *(const int *)a - *(const int *)b;
+}
+
+// Totals of one source line in the profile
+typedef struct {
+    int line;
+    long long count;   // Instructions executed
+    long long samples; // SIGPROF samples
+} LineProfile;
+
+// Helper function that orders source lines by instructions executed (descending), then by line
+int compareLineProfiles(const void *a, const void *b)
+{
+    const LineProfile *x = a, *y = b;
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : x->line - y->line;
+}
+
+// Function that writes the call-graph profile as folded stacks, one line per call path that executed instructions
+// of its own: "main;outer;inner COUNT". flamegraph.pl, speedscope and inferno read this format directly.
+void writeFlameGraph(const char *fileName)
+{
+    FILE *output = fopen(fileName, "w");
+    if (!output)
+    {
+        printf("Error: Can't write the flame graph to %s\n", fileName);
+        return;
+    }
+    for (int i = 0; i < callNodeCount; i++)
+    {
+        if (callNodes[i].exclusive == 0)
+            continue;
+        writeCallPath(output, i);
+        fprintf(output, " %lld\n", callNodes[i].exclusive);
+    }
+    fclose(output);
+}
+
+// Helper function that assigns every instruction to the procedure it belongs to, given by the index of its entry
+// (0 for the main block, otherwise a CAL or TCL target): everything reachable from the entry through jumps and
+// fall-through, without entering calls. Instructions no entry reaches get -1.
+void computeOwners(int count, int *owner)
+{
+    int *work = malloc((count + 1) * sizeof(int));
+    char *isEntry = calloc(count + 1, 1);
+    if (!work || !isEntry)
+    {
+        for (int i = 0; i < count; i++)
+            owner[i] = 0;
+        free(work);
+        free(isEntry);
+        return;
+    }
+
+    // Entries: the main block and the targets of the CALs and TCLs
+    for (int i = 0; i < count; i++)
+    {
+        owner[i] = -1;
+        int target = (TEXT[3 * i + 2] - TEXT_START) / 3;
+        if ((TEXT[3 * i] == 5 || TEXT[3 * i] == TAIL_CAL) && TEXT[3 * i + 2] >= TEXT_START && (TEXT[3 * i + 2] - TEXT_START) % 3 == 0 &&
+            target < count)
+            isEntry[target] = 1;
+    }
+    isEntry[0] = 1;
+
+    for (int entry = 0; entry < count; entry++)
+    {
+        if (!isEntry[entry] || owner[entry] != -1)
+            continue;
+
+        int top = 0;
+        owner[entry] = entry;
+        work[top++] = entry;
+        while (top > 0)
+        {
+            int i = work[--top];
+            int op = TEXT[3 * i], m = TEXT[3 * i + 2];
+            int fused = op >= FUSED_INCV && op <= FUSED_LLB && i + 1 < count;
+            int next[2] = { i + (fused ? 2 : 1), -1 };
+            if (fused)
+                owner[i + 1] = entry;
+
+            if (op == 7)
+                next[0] = (m - TEXT_START) / 3;
+            else if (op == 8)
+                next[1] = (m - TEXT_START) / 3;
+            else if (op == FUSED_LCB && fused)
+                next[1] = (TEXT[3 * i + 5] - TEXT_START) / 3;
+            else if ((op == 2 && m == 0) || (op == 9 && m == 3) || op == TAIL_CAL)
+                next[0] = -1;
+
+            for (int k = 0; k < 2; k++)
+            {
+                if (next[k] >= 0 && next[k] < count && owner[next[k]] == -1)
+                {
+                    owner[next[k]] = entry;
+                    work[top++] = next[k];
+                }
+            }
+        }
+    }
+    free(work);
+    free(isEntry);
+}
+
+// Function that writes the profile: the program listing in the compiler's format (Line OP L M) with the
+// executions and their share for every instruction, and the share of sampled CPU time on the first instruction
+// of every basic block (the engine only records where control goes when it doesn't fall through), then totals
+// per opcode and per procedure (entry address, calls, instructions executed in its own code, CPU time split by
+// the samples).
+void writeProfile(const char *fileName, const char *programName)
+{
+    setitimer(ITIMER_PROF, &(struct itimerval){ { 0, 0 }, { 0, 0 } }, NULL);
+    double cpuMs = (double)(clock() - profileStart) * 1000.0 / CLOCKS_PER_SEC;
+    FILE *output = fopen(fileName, "w");
+    int count = textWords / 3;
+    int *owner = malloc((count + 1) * sizeof(int));
+    if (!output || !owner)
+    {
+        printf("Error: Can't write the profile to %s\n", fileName);
+        if (output)
+            fclose(output);
+        free(owner);
+        return;
+    }
+    computeOwners(count, owner);
+
+    long long total = 0, samples = 0;
+    for (int i = 0; i <= count; i++)
+    {
+        total += profileCounts[i];
+        samples += profileSamples[i];
+    }
+    double perCount = total ? 100.0 / total : 0, perSample = samples ? 100.0 / samples : 0;
+    fprintf(output, "Profile of %s: %lld instructions executed, %.0f ms of CPU time, %lld samples\n\n",
+            programName, total, cpuMs, samples);
+
+    // Listing
+    fprintf(output, "Assembly Code:\n\n");
+    fprintf(output, "%-18s %14s %7s %7s%s\n", "Line OP L M", "Count", "%", "Time %", lineTable ? "  Source" : "");
+    for (int i = 0; i < count; i++)
+    {
+        char line[64];
+        int op = TEXT[3 * i];
+        const char *position = sourcePosition(TEXT_START + 3 * i);
+        snprintf(line, sizeof(line), "%2d %s %d %d", i, opcodeName(op), TEXT[3 * i + 1], TEXT[3 * i + 2]);
+        fprintf(output, "%-18s %14lld %7.2f %7.2f%s%s\n", line, profileCounts[i], profileCounts[i] * perCount,
+                profileSamples[i] * perSample, position ? "  " : "", position ? position : "");
+
+        // Operand word of a fused instruction: raw fields
+        if (op >= FUSED_INCV && op <= FUSED_LLB && i + 1 < count)
+        {
+            i++;
+            fprintf(output, "%2d     %d %d %d\n", i, TEXT[3 * i], TEXT[3 * i + 1], TEXT[3 * i + 2]);
+        }
+    }
+
+    // Opcodes
+    long long opCounts[TAIL_CAL + 1] = { 0 };
+    for (int i = 0; i < count; i++)
+    {
+        int op = TEXT[3 * i];
+        if (op >= 1 && op <= TAIL_CAL)
+            opCounts[op] += profileCounts[i];
+        if (op >= FUSED_INCV && op <= FUSED_LLB)
+            i++;
+    }
+    fprintf(output, "\n\nOpcodes:\n\n%-6s %14s %7s\n", "OP", "Count", "%");
+    for (int op = 1; op <= TAIL_CAL; op++)
+    {
+        if (opCounts[op] > 0)
+            fprintf(output, "%-6s %14lld %7.2f\n", opcodeName(op), opCounts[op], opCounts[op] * perCount);
+    }
+
+    // Procedures, in code order: totals are kept at the entry's index
+    long long *calls = calloc(count + 1, sizeof(long long));
+    long long *executed = calloc(count + 1, sizeof(long long));
+    long long *ticks = calloc(count + 1, sizeof(long long));
+    if (!calls || !executed || !ticks)
+        count = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int target = (TEXT[3 * i + 2] - TEXT_START) / 3;
+        if (owner[i] >= 0)
+        {
+            executed[owner[i]] += profileCounts[i];
+            ticks[owner[i]] += profileSamples[i];
+        }
+        if ((TEXT[3 * i] == 5 || TEXT[3 * i] == TAIL_CAL) && target >= 0 && target < count && owner[target] == target)
+            calls[target] += profileCounts[i];
+    }
+    if (count > 0)
+        calls[0]++;
+
+    fprintf(output, "\n\nProcedures:\n\n%-8s %-12s %12s %14s %7s %9s %7s%s\n",
+            "Entry", "Name", "Calls", "Instructions", "%", "Time ms", "Time %", lineTable ? "  Source" : "");
+    for (int entry = 0; entry < count; entry++)
+    {
+        if (owner[entry] != entry)
+            continue;
+
+        // Name from the symbol section of a binary elf
+        const char *name = entry == 0 ? "(main)" : procedureName(entry);
+        if (!name)
+            name = "";
+        const char *position = sourcePosition(TEXT_START + 3 * entry);
+        fprintf(output, "%-8d %-12s %12lld %14lld %7.2f %9.1f %7.2f%s%s\n", TEXT_START + 3 * entry, name, calls[entry],
+                executed[entry], executed[entry] * perCount, ticks[entry] * perSample * cpuMs / 100,
+                ticks[entry] * perSample, position ? "  " : "", position ? position : "");
+    }
+
+    // Call paths: the busiest by inclusive count
+    int *order = malloc(callNodeCount * sizeof(int));
+    if (order)
+    {
+        sumCallPaths();
+        for (int i = 0; i < callNodeCount; i++)
+            order[i] = i;
+        qsort(order, callNodeCount, sizeof(int), compareCallPaths);
+        fprintf(output, "\n\nCall paths:\n\n%14s %7s %14s %7s %12s  %s\n",
+                "Inclusive", "%", "Exclusive", "%", "Calls", "Path");
+        for (int k = 0; k < callNodeCount && k < PROFILE_TOP_PATHS; k++)
+        {
+            CallNode *node = &callNodes[order[k]];
+            fprintf(output, "%14lld %7.2f %14lld %7.2f %12lld  ", node->inclusive, node->inclusive * perCount,
+                    node->exclusive, node->exclusive * perCount, node->calls);
+            writeCallPath(output, order[k]);
+            fprintf(output, "\n");
+        }
+        if (callNodeCount > PROFILE_TOP_PATHS)
+            fprintf(output, "(%d more)\n", callNodeCount - PROFILE_TOP_PATHS);
+        free(order);
+    }
+
+    // Source lines (with a line table): the hot spots by instructions executed
+    int lastLine = 0;
+    for (int k = 0; lineTable && k < lineTable->count; k++)
+    {
+        if (lineTable->line[k] > lastLine)
+            lastLine = lineTable->line[k];
+    }
+    LineProfile *lines = lastLine > 0 ? calloc(lastLine + 1, sizeof(LineProfile)) : NULL;
+    if (lines)
+    {
+        for (int line = 0; line <= lastLine; line++)
+            lines[line].line = line;
+        for (int i = 0; i < count; i++)
+        {
+            int line = sourceLine(TEXT_START + 3 * i);
+            lines[line].count += profileCounts[i];
+            lines[line].samples += profileSamples[i];
+        }
+        qsort(lines + 1, lastLine, sizeof(LineProfile), compareLineProfiles);
+        fprintf(output, "\n\nSource lines (%s):\n\n%14s %7s %7s  %s\n", lineTable->source, "Count", "%", "Time %",
+                "Line");
+        for (int k = 1; k <= lastLine && k <= PROFILE_TOP_LINES && lines[k].count > 0; k++)
+            fprintf(output, "%14lld %7.2f %7.2f  %s:%d\n", lines[k].count, lines[k].count * perCount,
+                    lines[k].samples * perSample, lineTable->source, lines[k].line);
+        free(lines);
+    }
+
+    fclose(output);
+    free(owner);
+    free(calls);
+    free(executed);
+    free(ticks);
+}
+
+// Helper function that runs the loaded program on an engine (register elf files only run on the register engine)
+void runProgram(int engine)
+{
+    if (engine == ENGINE_REGISTER || regCode)
+        runRegisterProgram();
+    else if (engine == ENGINE_JIT)
+        runJitEngine();
+    else if (engine == ENGINE_THREADED)
+        runThreadedEngine();
+    else
+        runSwitchEngine();
+}
+
+// Batch mode (--batch=JOBS): each job runs a program on a file of input values. Every distinct program is loaded
+// once and shared (read-only) by the workers; each worker thread is a machine with its own stack.
+typedef struct {
+    const char *name;
+    int loaded;                    // 0 if the file couldn't be loaded
+    OutputBuffer error;            // Why, as loadProgram printed it
+    const int *text;               // Program, as loadProgram left it
+    int textWords;
+    const PcodeSymbol *symbols;
+    int symbolCount;
+    const LineTable *lineTable;
+    const RegInstruction *regCode;
+    int regCount;
+} BatchProgram;
+
+typedef struct {
+    int program;           // Index in batchPrograms
+    const char *input;     // File of input values for SYS 2, NULL = none
+    OutputBuffer output;   // Everything the job printed
+    long long executed;    // Instructions executed (switch and threaded engines)
+} BatchJob;
+
+// Jobs of a worker that haven't started: the worker takes them from the front, idle workers steal from the back
+typedef struct {
+    pthread_mutex_t lock;
+    atomic_int begin, end;
+} WorkQueue;
+
+BatchProgram *batchPrograms = NULL;
+int batchProgramCount = 0, batchProgramCapacity = 0;
+int *programSlots = NULL; // Hash table of program names (indexes in batchPrograms, -1 = empty)
+int programSlotCount = 0;
+BatchJob *batchJobs = NULL;
+int batchCount = 0, batchCapacity = 0;
+WorkQueue *workQueues = NULL;
+int workerCount = 0;
+int batchEngine = ENGINE_SWITCH, batchStack = STACK_SIZE;
+
+// Helper function that returns the index of the program with the given file name, adding it if it's new
+int findProgram(const char *name)
+{
+    // Keep the hash table at most half full
+    if (2 * (batchProgramCount + 1) > programSlotCount)
+    {
+        free(programSlots);
+        programSlotCount = programSlotCount ? 2 * programSlotCount : 256;
+        programSlots = malloc(programSlotCount * sizeof(int));
+        if (!programSlots)
+            return -1;
+        for (int i = 0; i < programSlotCount; i++)
+            programSlots[i] = -1;
+        for (int p = 0; p < batchProgramCount; p++)
+        {
+            unsigned int slot = 5381;
+            for (const char *c = batchPrograms[p].name; *c; c++)
+                slot = slot * 33 + (unsigned char)*c;
+            while (programSlots[slot & (programSlotCount - 1)] >= 0)
+                slot++;
+            programSlots[slot & (programSlotCount - 1)] = p;
+        }
+    }
+
+    unsigned int slot = 5381;
+    for (const char *c = name; *c; c++)
+        slot = slot * 33 + (unsigned char)*c;
+    for (;; slot++)
+    {
+        int p = programSlots[slot & (programSlotCount - 1)];
+        if (p < 0)
+            break;
+        if (strcmp(batchPrograms[p].name, name) == 0)
+            return p;
+    }
+
+    if (batchProgramCount == batchProgramCapacity)
+    {
+        batchProgramCapacity = batchProgramCapacity ? 2 * batchProgramCapacity : 64;
+        BatchProgram *grown = realloc(batchPrograms, batchProgramCapacity * sizeof(BatchProgram));
+        if (!grown)
+            return -1;
+        batchPrograms = grown;
+    }
+    memset(&batchPrograms[batchProgramCount], 0, sizeof(BatchProgram));
+    batchPrograms[batchProgramCount].name = strdup(name);
+    if (!batchPrograms[batchProgramCount].name)
+        return -1;
+    programSlots[slot & (programSlotCount - 1)] = batchProgramCount;
+    return batchProgramCount++;
+}
+
+// Function that reads the job list: one job per line, "program [input]" (an elf file of any format, and a file of
+// input values). Returns 0 if the list can't be read.
+int readBatchJobs(const char *fileName)
+{
+    FILE *list = strcmp(fileName, "-") == 0 ? stdin : fopen(fileName, "r");
+    if (!list)
+        return 0;
+
+    char line[8192], program[4096], input[4096];
+    while (fgets(line, sizeof(line), list))
+    {
+        int fields = sscanf(line, "%4095s %4095s", program, input);
+        if (fields < 1)
+            continue;
+        if (batchCount == batchCapacity)
+        {
+            batchCapacity = batchCapacity ? 2 * batchCapacity : 256;
+            BatchJob *grown = realloc(batchJobs, batchCapacity * sizeof(BatchJob));
+            if (!grown)
+                return 0;
+            batchJobs = grown;
+        }
+        BatchJob *job = &batchJobs[batchCount];
+        memset(job, 0, sizeof(BatchJob));
+        int index = findProgram(program);
+        if (index < 0)
+            return 0;
+        job->program = index;
+        job->input = fields == 2 ? strdup(input) : NULL;
+        batchCount++;
+    }
+    if (list != stdin)
+        fclose(list);
+    return 1;
+}
+
+// Helper function that reads a whole file into a string. Returns NULL if it can't be read.
+char *readFile(const char *fileName)
+{
+    FILE *file = fopen(fileName, "rb");
+    if (!file)
+        return NULL;
+    size_t length = 0, capacity = 4096;
+    char *text = malloc(capacity);
+    size_t count;
+    while (text && (count = fread(text + length, 1, capacity - length - 1, file)) > 0)
+    {
+        length += count;
+        if (length + 1 == capacity)
+        {
+            char *grown = realloc(text, 2 * capacity);
+            if (!grown)
+                free(text);
+            text = grown;
+            capacity *= 2;
+        }
+    }
+    fclose(file);
+    if (text)
+        text[length] = '\0';
+    return text;
+}
+
+// Helper function that returns the next job for a worker, or -1 when every queue is empty: the front of its own
+// queue, or else the back half of the fullest queue, which becomes its own
+int nextJob(int self)
+{
+    WorkQueue *own = &workQueues[self];
+    for (;;)
+    {
+        pthread_mutex_lock(&own->lock);
+        if (own->begin < own->end)
+        {
+            int job = own->begin++;
+            pthread_mutex_unlock(&own->lock);
+            return job;
+        }
+        pthread_mutex_unlock(&own->lock);
+
+        // Steal from the worker with the most jobs left
+        int victim = -1, most = 0;
+        for (int w = 0; w < workerCount; w++)
+        {
+            int left = workQueues[w].end - workQueues[w].begin;
+            if (left > most)
+            {
+                most = left;
+                victim = w;
+            }
+        }
+        if (victim < 0)
+            return -1;
+
+        WorkQueue *queue = &workQueues[victim];
+        pthread_mutex_lock(&queue->lock);
+        int left = queue->end - queue->begin, end = queue->end, take = (left + 1) / 2;
+        if (left > 0)
+            queue->end = end - take;
+        pthread_mutex_unlock(&queue->lock);
+        if (left <= 0)
+            continue; // Someone else got there first
+
+        pthread_mutex_lock(&own->lock);
+        own->begin = end - take;
+        own->end = end;
+        pthread_mutex_unlock(&own->lock);
+    }
+}
+
+// Helper function that runs one job on this thread's machine, with its output going to the job's buffer
+void runJob(BatchJob *job)
+{
+    BatchProgram *program = &batchPrograms[job->program];
+    jobOutput = &job->output;
+    char *volatile input = NULL; // Freed after a stack overflow's siglongjmp too
+    if (!program->loaded)
+        printOutput("%.*s", (int)program->error.length, program->error.text ? program->error.text : "");
+    else if (job->input && !(input = readFile(job->input)))
+        printOutput("Error: Input file %s can't be read\n", job->input);
+    else
+    {
+        TEXT = program->text;
+        textWords = program->textWords;
+        symbols = program->symbols;
+        symbolCount = program->symbolCount;
+        lineTable = program->lineTable;
+        regCode = program->regCode;
+        regCount = program->regCount;
+        jobInput = input ? input : "";
+        resetMachine();
+
+        // Restore the signal mask on a stack overflow: SIGSEGV stays blocked after a handler that doesn't return
+        sigjmp_buf stop;
+        faultExit = &stop;
+        if (sigsetjmp(stop, 1) == 0)
+        {
+            runProgram(batchEngine);
+            job->executed = executedCount;
+        }
+        else
+        {
+            printOutput("%s", stackOverflowMessage);
+            releaseEngineMemory(); // Instructions of a stopped job aren't counted
+        }
+        faultExit = NULL;
+    }
+    free(input);
+    jobInput = NULL;
+    jobOutput = NULL;
+}
+
+// Worker thread of a batch: a machine of its own that runs jobs until there are none left
+void *batchWorker(void *arg)
+{
+    int self = (int)(intptr_t)arg;
+    if (!allocateStack(batchStack))
+        return NULL; // The other workers take its jobs
+    for (int job; (job = nextJob(self)) >= 0; )
+        runJob(&batchJobs[job]);
+    releaseStack();
+    return NULL;
+}
+
+// Function that runs every job of the batch on a work-stealing pool of threads, prints each job's output in job
+// order, then the throughput. Returns 1 on success.
+int runBatch(int threads)
+{
+    // Load every program once, on this thread, then hand it to the workers
+    for (int p = 0; p < batchProgramCount; p++)
+    {
+        BatchProgram *program = &batchPrograms[p];
+        TEXT = NULL;
+        regCode = NULL;
+        textWords = symbolCount = regCount = 0;
+        jobOutput = &program->error;
+        program->loaded = loadProgram(program->name);
+        jobOutput = NULL;
+        program->text = TEXT;
+        program->textWords = textWords;
+        program->symbols = symbols;
+        program->symbolCount = symbolCount;
+        program->lineTable = lineTable;
+        program->regCode = regCode;
+        program->regCount = regCount;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (threads > batchCount)
+        threads = batchCount > 0 ? batchCount : 1;
+
+    // Every worker starts with an equal share of the jobs
+    workerCount = threads;
+    workQueues = calloc(threads, sizeof(WorkQueue));
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    if (!workQueues || !workers)
+    {
+        printf("Error: Out of memory\n");
+        return 0;
+    }
+    for (int w = 0; w < threads; w++)
+    {
+        pthread_mutex_init(&workQueues[w].lock, NULL);
+        workQueues[w].begin = (int)((long long)batchCount * w / threads);
+        workQueues[w].end = (int)((long long)batchCount * (w + 1) / threads);
+    }
+    int started = 0;
+    for (int w = 0; w < threads; w++)
+    {
+        if (pthread_create(&workers[w], NULL, batchWorker, (void *)(intptr_t)w) != 0)
+            break;
+        started++;
+    }
+    if (started == 0)
+        batchWorker(0); // No threads: run everything here
+    for (int w = 0; w < started; w++)
+        pthread_join(workers[w], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (seconds <= 0)
+        seconds = 1e-9;
+
+    // Outputs in job order
+    long long executed = 0;
+    for (int i = 0; i < batchCount; i++)
+    {
+        BatchJob *job = &batchJobs[i];
+        printf("Job %d: %s%s%s\n", i + 1, batchPrograms[job->program].name, job->input ? " " : "",
+               job->input ? job->input : "");
+        if (job->output.length > 0)
+            fwrite(job->output.text, 1, job->output.length, stdout);
+        executed += job->executed;
+        free(job->output.text);
+    }
+    printf("Batch: %d jobs on %d threads in %.1f ms: %.0f jobs/s", batchCount, started > 0 ? started : 1,
+           seconds * 1000, batchCount / seconds);
+    if (batchEngine == ENGINE_SWITCH || batchEngine == ENGINE_THREADED)
+        printf(", %lld instructions (%.0f instructions/s)", executed, executed / seconds);
+    printf("\n");
+
+    free(workers);
+    free(workQueues);
+    return 1;
+}
+
+// Implements a virtual machine that simulates the execution of a P-Machine. Requires a file to be passed as an argument.
+int main(int argc, char *argv[])
+{
+    int engine = ENGINE_SWITCH;
+    const char *fileName = NULL;
+    int badOption = 0;
+    int every = 0, low = 0, high = 0, size = 0, words = STACK_SIZE;
+    const char *batchName = NULL;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN), count = 0;
+    const char *inputName = NULL, *outputName = NULL;
+
+    // Parse options; the last non-option argument is the input file
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--engine=switch") == 0)
+            engine = ENGINE_SWITCH;
+        else if (strcmp(argv[i], "--engine=threaded") == 0)
+            engine = ENGINE_THREADED;
+        else if (strcmp(argv[i], "--engine=jit") == 0)
+            engine = ENGINE_JIT;
+        else if (strcmp(argv[i], "--engine=register") == 0)
+            engine = ENGINE_REGISTER;
+        else if (strcmp(argv[i], "--quiet") == 0)
+            traceMode = TRACE_NONE;
+        else if (strcmp(argv[i], "--trace-lines") == 0)
+            traceLines = 1;
+        else if (sscanf(argv[i], "--stack=%d", &size) == 1 && size > 0 && size <= INT_MAX / 2)
+            words = size;
+        else if (strcmp(argv[i], "--profile") == 0)
+            profileName = "profile.txt";
+        else if (strncmp(argv[i], "--profile=", 10) == 0 && argv[i][10])
+            profileName = argv[i] + 10;
+        else if (strcmp(argv[i], "--flamegraph") == 0)
+            flameName = "profile.folded";
+        else if (strncmp(argv[i], "--flamegraph=", 13) == 0 && argv[i][13])
+            flameName = argv[i] + 13;
+        else if (sscanf(argv[i], "--trace-every=%d", &every) == 1 && every > 0)
+        {
+            traceMode = TRACE_SAMPLED;
+            traceEvery = every;
+        }
+        else if (sscanf(argv[i], "--trace-pc=%d:%d", &low, &high) == 2 && low <= high)
+        {
+            traceMode = TRACE_SAMPLED;
+            traceLow = low;
+            traceHigh = high;
+        }
+        else if (strncmp(argv[i], "--batch=", 8) == 0 && argv[i][8])
+            batchName = argv[i] + 8;
+        else if (sscanf(argv[i], "--jobs=%d", &count) == 1 && count > 0)
+            threads = count;
+        else if (strcmp(argv[i], "--io=stdio") == 0)
+            ioMode = IO_STDIO;
+        else if (strcmp(argv[i], "--io=stream") == 0)
+            ioMode = IO_STREAM;
+        else if (strcmp(argv[i], "--io=raw") == 0)
+            ioMode = IO_RAW;
+        else if (strncmp(argv[i], "--input=", 8) == 0 && argv[i][8])
+            inputName = argv[i] + 8;
+        else if (strncmp(argv[i], "--output=", 9) == 0 && argv[i][9])
+            outputName = argv[i] + 9;
+        else if (argv[i][0] == '-')
+            badOption = 1; // Unknown option
+        else
+            fileName = argv[i];
+    }
+
+    // Input validation to prevent running the program incorrectly by not passing an input file
+    if (badOption || (!fileName && !batchName))
+    {
+        printf("Usage: %s [--engine=switch|threaded|jit|register] [--stack=N] [--profile[=FILE]] [--flamegraph[=FILE]] [--quiet | --trace-every=N --trace-pc=LOW:HIGH --trace-lines] <input file>\n", argv[0]);
+        printf("       %s [--engine=...] [--stack=N] --io=stream|raw [--input=FILE] [--output=FILE] <input file>\n", argv[0]);
+        printf("       %s [--engine=...] [--stack=N] --batch=JOBS [--jobs=N]\n", argv[0]);
+        return 1;
+    }
+
+    // Batch mode: many (program, input) jobs on a pool of machines, without traces or profiles
+    if (batchName)
+    {
+        if (profileName || flameName)
+            printf("Warning: Batch jobs can't be profiled\n");
+        if (ioMode != IO_STDIO || inputName || outputName)
+            printf("Warning: Batch jobs take their input from the job list, --io, --input and --output are ignored\n");
+        if (!readBatchJobs(batchName))
+        {
+            printf("Error: Can't read the job list %s\n", batchName);
+            return 1;
+        }
+        traceMode = TRACE_NONE;
+        countInstructions = 1;
+        batchEngine = engine;
+        batchStack = words;
+        return runBatch(threads < 1 ? 1 : threads) ? 0 : 1;
+    }
+
+    // Buffered I/O runs without prompts or traces. --input and --output alone mean the text stream.
+    if (ioMode == IO_STDIO && (inputName || outputName))
+        ioMode = IO_STREAM;
+    if (ioMode != IO_STDIO)
+    {
+        traceMode = TRACE_NONE;
+        if (inputName && (inputFd = open(inputName, O_RDONLY)) < 0)
+        {
+            printf("Error: Can't open the input file %s\n", inputName);
+            return 1;
+        }
+        if (outputName && (outputFd = open(outputName, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        {
+            printf("Error: Can't open the output file %s\n", outputName);
+            return 1;
+        }
+        ioOut = malloc(IO_BUFFER_SIZE);
+        ioIn = malloc(IO_BUFFER_SIZE + 1);
+        if (!ioOut || !ioIn)
+        {
+            printf("Error: Can't allocate the I/O buffers\n");
+            return 1;
+        }
+        ioIn[0] = '\0';
+    }
+
+    // Allocate the stack, then load the program (binary or text elf)
+    if (!allocateStack(words))
+    {
+        printf("Error: Can't allocate a stack of %d words\n", words);
+        return 1;
+    }
+    if (!loadProgram(fileName))
+        return 1;
+
+    // Register code has no stack to trace, and no P-code to profile
+    if (regCode)
+        traceMode = TRACE_NONE;
+    if (regCode && (profileName || flameName))
+    {
+        printf("Warning: Register elf files can't be profiled\n");
+        profileName = NULL;
+        flameName = NULL;
+    }
+
+    // The profiler counts in the threaded engine
+    if (profileName || flameName)
+    {
+        if (!startProfile())
+        {
+            printf("Error: Can't start the profiler\n");
+            return 1;
+        }
+        engine = ENGINE_THREADED;
+    }
+
+    // Print initial register values (not in production mode)
+    if (traceMode != TRACE_NONE)
+    {
+        printf("                 PC  BP  SP  Stack\n");
+        printf("Initial values:  %-3d %-3d %-3d\n\n", PC, BP, SP);
+    }
+
+    // Run the program on the selected engine (buffered values are written around stdio, so empty it first)
+    if (ioOut)
+        fflush(stdout);
+    runProgram(engine);
+    if (ioOut)
+        flushValues();
+
+    if (profileName)
+        writeProfile(profileName, fileName);
+    if (flameName)
+    {
+        if (!profileName)
+            setitimer(ITIMER_PROF, &(struct itimerval){ { 0, 0 }, { 0, 0 } }, NULL);
+        writeFlameGraph(flameName);
+    }
+
+#ifdef VM_STATS
+    fprintf(stderr, "Dispatches: %lld, PAS reads: %lld, PAS writes: %lld\n", statDispatches, statReads, statWrites);
+#endif
     return 0;
 }
\ No newline at end of file